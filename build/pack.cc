@@ -9,6 +9,9 @@
 #include <stdlib.h>
 #include <sys/wait.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <rpm/rpmlib.h>			/* RPMSIGTAG*, rpmReadPackageFile */
 #include <rpm/rpmfileutil.h>
 #include <rpm/rpmlog.h>
@@ -23,6 +26,7 @@
 
 static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
 				  FD_t cfd, ARGV_t dpaths,
+				  std::vector<uint64_t> * contentOffsets,
 				  rpm_loff_t * archiveSize, char ** failedFile)
 {
     int rc = 0;
@@ -33,6 +37,20 @@ static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
 	FD_t rfd = NULL;
 	const char *path = dpaths[rpmfiFX(archive)];
 
+	/* Remember where the content goes, hardlinks all share it */
+	if (contentOffsets) {
+	    const int *links = NULL;
+	    int fx = rpmfiFX(archive);
+	    int nlinks = rpmfilesFLinks(fi, fx, &links);
+	    uint64_t offset = rpmfiArchiveTell(archive);
+	    if (nlinks > 1) {
+		for (int i = 0; i < nlinks; i++)
+		    (*contentOffsets)[links[i]] = offset;
+	    } else {
+		(*contentOffsets)[fx] = offset;
+	    }
+	}
+
 	rfd = Fopen(path, "r.ufdio");
 	if (Ferror(rfd)) {
 	    rc = RPMERR_OPEN_FAILED;
@@ -68,7 +86,7 @@ static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
  * @todo Create transaction set *much* earlier.
  */
 static rpmRC cpio_doio(FD_t fdo, Package pkg, const char * fmodeMacro,
-			int pld_algo,
+			int pld_algo, std::vector<uint64_t> * contentOffsets,
 			rpm_loff_t *archiveSize, char ** pldig)
 {
     char *failedFile = NULL;
@@ -83,7 +101,7 @@ static rpmRC cpio_doio(FD_t fdo, Package pkg, const char * fmodeMacro,
     /* Calculate alternative (uncompressed) payload digest while writing */
     fdInitDigestID(cfd, pld_algo, RPMTAG_PAYLOADDIGESTALT, 0);
     fsmrc = rpmPackageFilesArchive(pkg->cpioList, headerIsSource(pkg->header),
-				   cfd, pkg->dpaths,
+				   cfd, pkg->dpaths, contentOffsets,
 				   archiveSize, &failedFile);
     fdFiniDigest(cfd, RPMTAG_PAYLOADDIGESTALT, (void **)pldig, NULL, 1);
 
@@ -443,6 +461,57 @@ exit:
  * header. In other words, we need to write things in the exact opposite
  * order to how the RPM format is laid on disk.
  */
+/* Only zstd payloads written in frames ('S' flag) are seekable */
+static int payloadIsSeekable(const char *rpmio_flags)
+{
+    const char *s = strchr(rpmio_flags, '.');
+    return (s && rstreq(s+1, "zstdio") && memchr(rpmio_flags, 'S', s - rpmio_flags));
+}
+
+/*
+ * Turn uncompressed archive offsets of file contents into payload frame
+ * offset + offset within the frame pairs using the payload seek table.
+ */
+static rpmRC addPayloadIndex(Header h, FD_t fd, off_t start, off_t end,
+			     const std::vector<uint64_t> & contentOffsets)
+{
+    std::vector<std::pair<uint64_t,uint64_t>> frames;
+    std::vector<uint64_t> cstart, ustart;
+    size_t fc = contentOffsets.size();
+    std::vector<uint64_t> fframes(fc, UINT64_MAX);
+    std::vector<uint64_t> foffsets(fc, UINT64_MAX);
+    uint64_t coff = 0, uoff = 0;
+
+    if (fdSeekableFrames(fd, start, end, frames)) {
+	rpmlog(RPMLOG_ERR, _("Unable to read payload seek table\n"));
+	return RPMRC_FAIL;
+    }
+
+    for (auto const & frame : frames) {
+	cstart.push_back(coff);
+	ustart.push_back(uoff);
+	coff += frame.first;
+	uoff += frame.second;
+    }
+
+    for (size_t i = 0; i < fc; i++) {
+	uint64_t offset = contentOffsets[i];
+	if (offset >= uoff)
+	    continue;
+	auto it = std::upper_bound(ustart.begin(), ustart.end(), offset);
+	size_t k = (it - ustart.begin()) - 1;
+	fframes[i] = cstart[k];
+	foffsets[i] = offset - ustart[k];
+    }
+
+    headerDel(h, RPMTAG_FILEPAYLOADFRAMES);
+    headerPutUint64(h, RPMTAG_FILEPAYLOADFRAMES, fframes.data(), fc);
+    headerDel(h, RPMTAG_FILEPAYLOADOFFSETS);
+    headerPutUint64(h, RPMTAG_FILEPAYLOADOFFSETS, foffsets.data(), fc);
+
+    return RPMRC_OK;
+}
+
 static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
 		      const char *fileName, char **cookie,
 		      rpm_time_t buildTime, const char* buildHost)
@@ -459,6 +528,7 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
     rpm_loff_t archiveSize = 0; /* uncompressed */
     rpm_loff_t payloadSize = 0; /* compressed */
     off_t sigStart, hdrStart, payloadStart, payloadEnd;
+    std::vector<uint64_t> contentOffsets;
 
     if (pkgidp)
 	*pkgidp = NULL;
@@ -490,6 +560,16 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
 	headerPutUint64(pkg->header, RPMTAG_PAYLOADSIZEALT, &archiveSize, 1);
     }
 
+    /* Seekable payloads get an index of file content locations */
+    if (rpmfilesFC(pkg->cpioList) > 0 && payloadIsSeekable(rpmio_flags)) {
+	int fc = rpmfilesFC(pkg->cpioList);
+	contentOffsets.assign(fc, UINT64_MAX);
+	headerPutUint64(pkg->header, RPMTAG_FILEPAYLOADFRAMES,
+			contentOffsets.data(), fc);
+	headerPutUint64(pkg->header, RPMTAG_FILEPAYLOADOFFSETS,
+			contentOffsets.data(), fc);
+    }
+
     /* Check for UTF-8 encoding of string tags, add encoding tag if all good */
     if (checkForEncoding(pkg->header, 1))
 	goto exit;
@@ -530,7 +610,9 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
 
     /* Write payload section (cpio archive) */
     payloadStart = Ftell(fd);
-    if (cpio_doio(fd, pkg, rpmio_flags, pld_algo, &archiveSize, &upld))
+    if (cpio_doio(fd, pkg, rpmio_flags, pld_algo,
+		  contentOffsets.empty() ? NULL : &contentOffsets,
+		  &archiveSize, &upld))
 	goto exit;
     payloadEnd = Ftell(fd);
     payloadSize = payloadEnd - payloadStart;
@@ -548,6 +630,12 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
     headerPutString(pkg->header, RPMTAG_PAYLOADDIGESTALT, upld);
     pld = _free(pld);
 
+    if (!contentOffsets.empty()) {
+	if (addPayloadIndex(pkg->header, fd, payloadStart, payloadEnd,
+			    contentOffsets))
+	    goto exit;
+    }
+
     if (pkg->rpmformat >= 6) {
 	headerDel(pkg->header, RPMTAG_PAYLOADSIZE);
 	headerPutUint64(pkg->header, RPMTAG_PAYLOADSIZE, &payloadSize, 1);
@@ -89,12 +89,20 @@ Header headerCopy(Header h);
 enum headerImportFlags_e {
     HEADERIMPORT_COPY		= (1 << 0), /* Make copy of blob on import? */
     HEADERIMPORT_FAST		= (1 << 1), /* Faster but less safe? */
+    HEADERIMPORT_LAZY		= (1 << 2), /* Decode tags on demand? */
 };
 
 typedef rpmFlags headerImportFlags;
 
 /** \ingroup header
  * Import header to in-memory representation.
+ *
+ * With HEADERIMPORT_LAZY, tags are only decoded when first retrieved,
+ * which is considerably cheaper when just a few tags are needed. Such a
+ * header is converted to the regular form automatically when modified,
+ * exported or iterated over. Like with regular headers, retrieving tags
+ * from and iterating over a lazy header from several threads at once is
+ * safe, as long as none of them modifies it.
  * @param blob		on-disk header blob (i.e. with offsets)
  * @param bsize		on-disk header blob size in bytes (0 if unknown)
  * @param flags		flags to control operation
@@ -262,6 +270,37 @@ int headerDel(Header h, rpmTagVal tag);
  */
 char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg);
 
+/** \ingroup header
+ * Create a reusable header formatter. The format is parsed only once,
+ * for formatting any number of headers with it. A formatter must not be
+ * used from more than one thread at a time.
+ *
+ * @param fmt		format to use
+ * @param[out] errmsg	error message (if any)
+ * @return		new formatter, NULL on invalid format
+ */
+rpmHeaderFormatter rpmHeaderFormatterNew(const char * fmt, errmsg_t * errmsg);
+
+/** \ingroup header
+ * Return formatted output string from header tags.
+ * The returned string is owned by the formatter and only valid until
+ * the next call on the same formatter.
+ *
+ * @param hf		header formatter
+ * @param h		header
+ * @param[out] errmsg	error message (if any)
+ * @return		formatted output string, NULL on error
+ */
+const char * rpmHeaderFormatterFormat(rpmHeaderFormatter hf, Header h,
+				      errmsg_t * errmsg);
+
+/** \ingroup header
+ * Free a header formatter.
+ * @param hf		header formatter
+ * @return		NULL always
+ */
+rpmHeaderFormatter rpmHeaderFormatterFree(rpmHeaderFormatter hf);
+
 /** \ingroup header
  * Duplicate tag values from one header into another.
  * @param headerFrom	source header
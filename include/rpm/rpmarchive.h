@@ -89,6 +89,26 @@ rpmfi rpmfiNewArchiveWriter(FD_t fd, rpmfiles files);
  */
     rpmfi rpmfiNewArchiveReader(FD_t fd, rpmfiles files, int itype);
 
+/** \ingroup payload
+ * Open the payload of a package directly at the content of a file.
+ * This is only possible for packages with a seekable payload, which
+ * carry an index of file content locations. Only the payload frame
+ * containing the start of the file content needs to be decompressed.
+ * Read rpmfilesFSize() bytes from the returned handle to get the
+ * content, and close it with Fclose() when done.
+ * Note that this moves the file position of the package file, except
+ * when NULL is returned, so the caller can fall back to reading the
+ * payload sequentially then.
+ * @param files		file info (of the package header)
+ * @param ix		file index
+ * @param fd		package file
+ * @param payloadoff	offset of the payload in the package file
+ * @return		payload handle at file content, NULL if the file
+ *			content is not indexed or on error
+ */
+FD_t rpmfilesFOpenContent(rpmfiles files, int ix, FD_t fd,
+			  rpm_loff_t payloadoff);
+
 /** \ingroup payload
  * Close payload archive
  * @param fi		file info
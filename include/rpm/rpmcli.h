@@ -115,7 +115,8 @@ enum rpmQueryFlags_e {
 	/* bits 19-21 unused */
     QUERY_FOR_LIST	= (1 << 23),	/*!< query:  from --list */
     QUERY_FOR_STATE	= (1 << 24),	/*!< query:  from --state */
-	/* bits 25-26 unused */
+    QUERY_BATCH		= (1 << 25),	/*!< query:  from --batch */
+	/* bit 26 unused */
     QUERY_FOR_DUMPFILES	= (1 << 27),	/*!< query:  from --dump */
 };
 
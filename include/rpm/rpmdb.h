@@ -142,6 +142,22 @@ int rpmdbSetHdrChk(rpmdbMatchIterator mi, rpmts ts,
 rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmDbiTagVal rpmtag,
 			const void * keyp, size_t keylen);
 
+/** \ingroup rpmdb
+ * Return database iterators for a batch of file paths.
+ * Equivalent to calling rpmdbInitIterator() on each of the paths, but
+ * the index lookups, header loads and fingerprinting are shared between
+ * the paths, making this much faster on large batches.
+ * @param db		rpm database
+ * @param rpmtag	RPMDBI_BASENAMES or RPMDBI_INSTFILENAMES
+ * @param files		file paths
+ * @param nfiles	number of file paths
+ * @param[out] mis	iterator per path, NULL on no match (nfiles items)
+ * @return		0 on success, -1 on failure
+ */
+int rpmdbInitFileIterators(rpmdb db, rpmDbiTagVal rpmtag,
+			const char * const * files, int nfiles,
+			rpmdbMatchIterator * mis);
+
 /** \ingroup rpmdb
  * Return next package header from iteration.
  * @param mi		rpm database iterator
@@ -230,9 +246,24 @@ rpmdbIndexIterator rpmdbIndexIteratorFree(rpmdbIndexIterator ii);
  */
 int rpmdbCtrl(rpmdb db, rpmdbCtrlOp ctrl);
 
+/** \ingroup rpmdb
+ * Retrieve rpm database change generation.
+ * The generation is maintained by the database backend and changes on
+ * every package addition and removal. Unlike rpmdbCookie(), it's only
+ * meaningful for comparison within the same database file. Backends
+ * may keep a narrower counter that wraps around, so only compare for
+ * (in)equality.
+ * @param db		rpm database
+ * @param[out] generation	change generation
+ * @return 		0 on success, -1 if not supported, > 0 on error
+ */
+int rpmdbGeneration(rpmdb db, uint64_t *generation);
+
 /** \ingroup rpmdb
  * Retrieve rpm database changed-cookie.
- * Useful for eg. determining cache validity.
+ * Useful for eg. determining cache validity. The cost doesn't depend
+ * on the number of installed packages, except with backends that lack
+ * a change generation (bdb_ro).
  * @param db		rpm database
  * @return 		cookie string (malloced), or NULL on error
  */
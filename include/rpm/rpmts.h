@@ -327,6 +327,20 @@ int rpmtsVerifyDB(rpmts ts);
 rpmdbMatchIterator rpmtsInitIterator(const rpmts ts, rpmDbiTagVal rpmtag,
 			const void * keyp, size_t keylen);
 
+/** \ingroup rpmts
+ * Return transaction database iterators for a batch of file paths.
+ * @see rpmdbInitFileIterators()
+ * @param ts		transaction set
+ * @param rpmtag	RPMDBI_BASENAMES or RPMDBI_INSTFILENAMES
+ * @param files		file paths
+ * @param nfiles	number of file paths
+ * @param[out] mis	iterator per path, NULL on no match (nfiles items)
+ * @return		0 on success, -1 on failure
+ */
+int rpmtsInitFileIterators(const rpmts ts, rpmDbiTagVal rpmtag,
+			const char * const * files, int nfiles,
+			rpmdbMatchIterator * mis);
+
 /** \ingroup rpmts
  * Import a header into the rpmdb
  * @param txn		transaction handle
@@ -17,6 +17,18 @@ extern "C" {
  */
 int rpmvercmp(const char * a, const char * b);
 
+/** \ingroup rpmver
+ * Generate collation key for a version or release string.
+ * Keys of two strings compare with strcmp() in the same order as the
+ * strings with rpmvercmp(). Keys are self-terminating, so keys of
+ * several strings concatenated compare like the strings one by one.
+ * Useful to avoid re-parsing the same strings when sorting.
+ *
+ * @param s		version or release string
+ * @return		collation key (malloced), NULL on NULL string
+ */
+char *rpmvercmpKey(const char * s);
+
 /** \ingroup rpmver
  * Parse rpm version handle from evr string
  *
@@ -82,6 +94,16 @@ char *rpmverEVR(rpmver rv);
  */
 int rpmverCmp(rpmver v1, rpmver v2);
 
+/** \ingroup rpmver
+ * Generate collation key for rpm version handle.
+ * Keys of two versions compare with strcmp() in the same order as the
+ * versions with rpmverCmp().
+ *
+ * @param rv		rpm version handle
+ * @return		collation key (malloced), NULL on NULL handle
+ */
+char *rpmverKey(rpmver rv);
+
 /** \ingroup rpmver
  * Determine whether two versioned ranges overlap.
  * @param v1		1st version
@@ -695,7 +695,7 @@ static void appenddbt(dbiCursor dbc, unsigned char *val, unsigned int vallen, db
     }
 }
 
-static rpmRC bdbro_idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
+static rpmRC bdbro_idxdbPut(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys)
 {
     return RPMRC_FAIL;
 }
@@ -713,6 +713,34 @@ static rpmRC bdbro_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_
 
     if (!cur)
 	return RPMRC_FAIL;
+    if (searchType == DBC_GLOB_SEARCH) {
+	/* Range scan over the literal prefix on btrees, all keys otherwise */
+	int btree = (cur->db->type == BDB_BTREE);
+	rpmRC rc = RPMRC_NOTFOUND;
+	if (!keyp)
+	    return RPMRC_FAIL;
+	keylen = globPrefixLen(keyp);
+	if (btree && keylen)
+	    r = cur_lookup_ge(cur, (const unsigned char *)keyp, keylen);
+	else
+	    r = cur_next(cur);
+	for (; r == 0; r = cur_next(cur)) {
+	    if (cur->key.len < keylen || memcmp(cur->key.kv, keyp, keylen) != 0) {
+		if (btree)
+		    break;
+		continue;
+	    }
+	    if (!globKeyMatch(keyp, cur->key.kv, cur->key.len))
+		continue;
+	    if (set)
+		appenddbt(dbc, cur->val.kv, cur->val.len, set);
+	    rc = RPMRC_OK;
+	}
+	if (r == -1)
+	    log_error(dbi);
+	cur->key.kv = 0;
+	return r == -1 ? RPMRC_FAIL : rc;
+    }
     if (searchType == DBC_PREFIX_SEARCH) {
 	rpmRC rc = RPMRC_NOTFOUND;
 	if (!keyp)
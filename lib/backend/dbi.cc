@@ -4,8 +4,11 @@
 
 #include "system.h"
 
+#include <string>
+
 #include <stdlib.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmmacro.h>
 #include <rpm/rpmlog.h>
@@ -130,6 +133,13 @@ dbDetectBackend(rpmdb rdb)
     if (rdb->db_ops == NULL && cfg)
 	rdb->db_ops = cfg;
 
+    /* Serve read-only access from an up to date snapshot if enabled */
+    if (rdb->db_ops && (rdb->db_mode & O_ACCMODE) == O_RDONLY &&
+	    !(rdb->db_flags & (RPMDB_FLAG_REBUILD|RPMDB_FLAG_VERIFYONLY|RPMDB_FLAG_SALVAGE)) &&
+	    rpmExpandNumeric("%{?_db_snapshot}") > 0 && dbSnapshotFresh(rdb)) {
+	rdb->db_ops = &snapshot_dbops;
+    }
+
 exit:
     /* If all else fails... */
     if (rdb->db_ops == NULL) {
@@ -164,9 +174,20 @@ int dbCtrl(rpmdb rdb, dbCtrlOp ctrl)
 {
     if (!rdb->db_ops)
 	dbDetectBackend(rdb);
+    if (ctrl == DB_CTRL_GENERATION)
+	rdb->db_changes++;
     return rdb->db_ops->ctrl(rdb, ctrl);
 }
 
+int dbGeneration(rpmdb rdb, uint64_t *generation)
+{
+    if (!rdb->db_ops)
+	dbDetectBackend(rdb);
+    if (rdb->db_ops->generation == NULL)
+	return -1;
+    return rdb->db_ops->generation(rdb, generation);
+}
+
 int dbiOpen(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flags)
 {
     if (!rdb->db_ops)
@@ -214,6 +235,16 @@ unsigned int pkgdbKey(dbiIndex dbi, dbiCursor dbc)
     return dbi->dbi_rpmdb->db_ops->pkgdbKey(dbi, dbc);
 }
 
+rpmRC pkgdbGetMany(dbiIndex dbi, dbiCursor dbc, unsigned int n,
+		   const unsigned int *hdrNums,
+		   unsigned char **hdrBlobs, unsigned int *hdrLens)
+{
+    const struct rpmdbOps_s *ops = dbi->dbi_rpmdb->db_ops;
+    if (ops->pkgdbGetMany == NULL)
+	return RPMRC_NOTFOUND;
+    return ops->pkgdbGetMany(dbi, dbc, n, hdrNums, hdrBlobs, hdrLens);
+}
+
 rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int curFlags)
 {
     return dbi->dbi_rpmdb->db_ops->idxdbGet(dbi, dbc, keyp, keylen, set, curFlags);
@@ -221,7 +252,14 @@ rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbi
 
 rpmRC idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
 {
-    return dbi->dbi_rpmdb->db_ops->idxdbPut(dbi, rpmtag, hdrNum, h);
+    struct idxKeys_s keys;
+    tag2keys(rpmtag, h, keys);
+    return idxdbPutKeys(dbi, hdrNum, keys);
+}
+
+rpmRC idxdbPutKeys(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys)
+{
+    return dbi->dbi_rpmdb->db_ops->idxdbPut(dbi, hdrNum, keys);
 }
 
 rpmRC idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
@@ -234,3 +272,14 @@ const void * idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen)
     return dbi->dbi_rpmdb->db_ops->idxdbKey(dbi, dbc, keylen);
 }
 
+size_t globPrefixLen(const char *pattern)
+{
+    return strcspn(pattern, "*?[\\");
+}
+
+int globKeyMatch(const char *pattern, const void *key, size_t keylen)
+{
+    std::string k((const char *)key, keylen);
+    return (fnmatch(pattern, k.c_str(), 0) == 0);
+}
+
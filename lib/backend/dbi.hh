@@ -1,7 +1,9 @@
 #ifndef _DBI_H
 #define _DBI_H
 
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <stdio.h>
 #include <atomic>
@@ -24,7 +26,8 @@ typedef enum dbCtrlOp_e {
     DB_CTRL_UNLOCK_RO		= 2,
     DB_CTRL_LOCK_RW		= 3,
     DB_CTRL_UNLOCK_RW		= 4,
-    DB_CTRL_INDEXSYNC		= 5
+    DB_CTRL_INDEXSYNC		= 5,
+    DB_CTRL_GENERATION		= 6
 } dbCtrlOp;
 
 typedef struct dbiIndex_s * dbiIndex;
@@ -37,6 +40,8 @@ struct dbConfig_s {
 using dbChk = std::unordered_map<unsigned int,rpmRC>;
 
 struct rpmdbOps_s;
+struct hdrCache_s;
+struct vfyCache_s;
 
 /** \ingroup rpmdb
  * Describes the collection of index databases used by rpm.
@@ -50,6 +55,7 @@ struct rpmdb_s {
     int		db_perms;	/*!< open permissions */
     const char	* db_descr;	/*!< db backend description (for error msgs) */
     dbChk	db_checked;	/*!< headerCheck()'ed package instances */
+    struct vfyCache_s * db_vfycache;	/*!< Persistent headerCheck() results */
     rpmdb	db_next;
     int		db_opens;
     dbiIndex	db_pkgs;	/*!< Package db */
@@ -68,6 +74,14 @@ struct rpmdb_s {
     struct rpmop_s db_getops;
     struct rpmop_s db_putops;
     struct rpmop_s db_delops;
+    struct rpmop_s db_stmthitops;
+    struct rpmop_s db_stmtmissops;
+    struct rpmop_s db_hdrhitops;
+    struct rpmop_s db_hdrmissops;
+
+    struct hdrCache_s * db_hdrcache;	/*!< Imported header LRU cache */
+
+    unsigned int db_changes;	/*!< No. of changes through this handle */
 
     std::atomic_int nrefs;	/*!< Reference count. */
 };
@@ -89,9 +103,15 @@ enum dbcFlags_e {
     DBC_WRITE	= (1 << 0),
 };
 
+/*
+ * A glob search key is a '\0' terminated glob(7) pattern. Backends may
+ * return entries of keys not matching it, callers need to check the
+ * results.
+ */
 enum dbcSearchType_e {
     DBC_NORMAL_SEARCH   = 0,
     DBC_PREFIX_SEARCH   = (1 << 0),
+    DBC_GLOB_SEARCH	= (1 << 1),
 };
 
 /** \ingroup dbi
@@ -104,14 +124,49 @@ struct dbiIndex_s {
     int dbi_flags;
 
     void * dbi_db;		/*!< Backend private handle */
+    void * dbi_cache;		/*!< Backend private cache handle */
+};
+
+/** \ingroup dbi
+ * Secondary index keys of a header for a single index tag.
+ */
+struct idxKey_s {
+    std::string key;		/*!< key data (not necessarily a string) */
+    unsigned int tagNum;	/*!< tag index in header */
+};
+
+struct idxKeys_s {
+    rpm_count_t count;		/*!< no. of tag data items */
+    rpmTagType type;		/*!< type of tag data */
+    std::vector<idxKey_s> items;
 };
 
 typedef rpmRC (*idxfunc)(dbiIndex dbi, dbiCursor dbc,
 			const char *keyp, size_t keylen, dbiIndexItem rec);
 
+/** \ingroup dbi
+ * Generate the index keys of a header for an index tag. This only
+ * looks at the header, so it's safe to call concurrently on different
+ * headers.
+ * @param rpmtag	index tag
+ * @param h		header
+ * @param[out] keys	generated keys
+ */
 RPM_GNUC_INTERNAL
-rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h,
-		idxfunc idxupdate);
+void tag2keys(rpmTagVal rpmtag, Header h, struct idxKeys_s & keys);
+
+/** \ingroup dbi
+ * Feed previously generated index keys of a header to a backend update
+ * function.
+ * @param dbi		index database handle
+ * @param hdrNum	header instance in db
+ * @param keys		keys from tag2keys()
+ * @param idxupdate	backend update function
+ * @return		RPMRC_OK on success
+ */
+RPM_GNUC_INTERNAL
+rpmRC keys2index(dbiIndex dbi, unsigned int hdrNum,
+		const struct idxKeys_s & keys, idxfunc idxupdate);
 
 RPM_GNUC_INTERNAL
 /* Globally enable/disable fsync in the backend */
@@ -120,6 +175,10 @@ void dbSetFSync(rpmdb rdb, int enable);
 RPM_GNUC_INTERNAL
 int dbCtrl(rpmdb rdb, dbCtrlOp ctrl);
 
+/* Retrieve the change generation, -1 if not supported by the backend */
+RPM_GNUC_INTERNAL
+int dbGeneration(rpmdb rdb, uint64_t *generation);
+
 RPM_GNUC_INTERNAL
 void dbShowRC(FILE* fp);
 
@@ -214,18 +273,43 @@ rpmRC pkgdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum,
 RPM_GNUC_INTERNAL
 unsigned int pkgdbKey(dbiIndex dbi, dbiCursor dbc);
 
+/* Preferred number of headers per pkgdbGetMany() call */
+#define PKGDB_BATCH	64
+
+/*
+ * Fetch the header blobs of n header numbers in one go. The blobs are
+ * malloc()'ed copies owned by the caller, missing headers are returned
+ * as NULL. Returns RPMRC_NOTFOUND if the backend has no batch support.
+ */
+RPM_GNUC_INTERNAL
+rpmRC pkgdbGetMany(dbiIndex dbi, dbiCursor dbc, unsigned int n,
+		   const unsigned int *hdrNums,
+		   unsigned char **hdrBlobs, unsigned int *hdrLens);
+
 RPM_GNUC_INTERNAL
 rpmRC idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen,
                dbiIndexSet *set, int curFlags);
 RPM_GNUC_INTERNAL
 rpmRC idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
 
+RPM_GNUC_INTERNAL
+rpmRC idxdbPutKeys(dbiIndex dbi, unsigned int hdrNum,
+		const struct idxKeys_s & keys);
+
 RPM_GNUC_INTERNAL
 rpmRC idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
 
 RPM_GNUC_INTERNAL
 const void * idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen);
 
+/* Return the length of the literal prefix of a glob(7) pattern */
+RPM_GNUC_INTERNAL
+size_t globPrefixLen(const char *pattern);
+
+/* Does a (not '\0' terminated) index key match a glob(7) pattern? */
+RPM_GNUC_INTERNAL
+int globKeyMatch(const char *pattern, const void *key, size_t keylen);
+
 struct rpmdbOps_s {
     const char *name; /* backend name */
     const char *path; /* main database name */
@@ -235,6 +319,9 @@ struct rpmdbOps_s {
     int (*verify)(dbiIndex dbi, unsigned int flags);
     void (*setFSync)(rpmdb rdb, int enable);
     int (*ctrl)(rpmdb rdb, dbCtrlOp ctrl);
+    int (*generation)(rpmdb rdb, uint64_t *generation);
+    /* Same as generation, but without the database being open */
+    int (*peekGeneration)(rpmdb rdb, uint64_t *generation);
 
     dbiCursor (*cursorInit)(dbiIndex dbi, unsigned int flags);
     dbiCursor (*cursorFree)(dbiIndex dbi, dbiCursor dbc);
@@ -243,9 +330,10 @@ struct rpmdbOps_s {
     rpmRC (*pkgdbPut)(dbiIndex dbi, dbiCursor dbc, unsigned int *hdrNum, unsigned char *hdrBlob, unsigned int hdrLen);
     rpmRC (*pkgdbDel)(dbiIndex dbi, dbiCursor dbc,  unsigned int hdrNum);
     unsigned int (*pkgdbKey)(dbiIndex dbi, dbiCursor dbc);
+    rpmRC (*pkgdbGetMany)(dbiIndex dbi, dbiCursor dbc, unsigned int n, const unsigned int *hdrNums, unsigned char **hdrBlobs, unsigned int *hdrLens);
 
     rpmRC (*idxdbGet)(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int curFlags);
-    rpmRC (*idxdbPut)(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
+    rpmRC (*idxdbPut)(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys);
     rpmRC (*idxdbDel)(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h);
     const void * (*idxdbKey)(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen);
 };
@@ -268,4 +356,20 @@ extern struct rpmdbOps_s sqlite_dbops;
 RPM_GNUC_INTERNAL
 extern struct rpmdbOps_s dummydb_dbops;
 
+RPM_GNUC_INTERNAL
+extern struct rpmdbOps_s snapshot_dbops;
+
+/* Is there a snapshot matching the current state of the primary database? */
+RPM_GNUC_INTERNAL
+int dbSnapshotFresh(rpmdb rdb);
+
+/* Identity of the primary database a snapshot in use was taken from */
+RPM_GNUC_INTERNAL
+int dbSnapshotPrimary(rpmdb rdb, const char **backend, dev_t *dev, ino_t *ino);
+
+/* Write a query snapshot of the primary database and the given indexes */
+RPM_GNUC_INTERNAL
+int dbSnapshotWrite(rpmdb rdb, dbiIndex pkgs,
+		    const std::vector<dbiIndex> & indexes);
+
 #endif /* _DBI_H */
@@ -34,6 +34,13 @@ static int dummydb_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
     return 0;
 }
 
+static int dummydb_Generation(rpmdb rdb, uint64_t *generation)
+{
+    /* Nothing can ever be added or removed */
+    *generation = 0;
+    return 0;
+}
+
 static dbiCursor dummydb_CursorInit(dbiIndex dbi, unsigned int flags)
 {
     return NULL;
@@ -70,7 +77,7 @@ static rpmRC dummydb_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, siz
     return RPMRC_FAIL;
 }
 
-static rpmRC dummydb_idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
+static rpmRC dummydb_idxdbPut(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys)
 {
     return RPMRC_FAIL;
 }
@@ -96,6 +103,7 @@ struct rpmdbOps_s dummydb_dbops = {
     .verify	= dummydb_Verify,
     .setFSync	= dummydb_SetFSync,
     .ctrl	= dummydb_Ctrl,
+    .generation	= dummydb_Generation,
 
     .cursorInit	= dummydb_CursorInit,
     .cursorFree	= dummydb_CursorFree,
@@ -7,6 +7,7 @@
 #include "rpmdb_internal.hh"
 #include <rpm/rpmstring.h>
 #include <rpm/rpmlog.h>
+#include <rpm/rpmmacro.h>
 
 #include "backend/ndb/rpmpkg.h"
 #include "backend/ndb/rpmxdb.h"
@@ -20,6 +21,7 @@ struct dbiCursor_s {
     unsigned int keylen;
     unsigned int hdrNum;
     int flags;
+    int viewref;		/* cursor holds a reference to the views */
 
     unsigned int *list;
     unsigned int nlist;
@@ -36,6 +38,9 @@ struct ndbEnv_s {
     unsigned int hdrNum;
     void *data;
     unsigned int datalen;
+    int datamapped;		/* data is a view into the package db mapping */
+    int usemmap;		/* read packages through rpmpkgGetView() */
+    int viewrefs;		/* cursors that may be using views */
 };
 
 static void closeEnv(rpmdb rdb)
@@ -50,7 +55,7 @@ static void closeEnv(rpmdb rdb)
 	    rpmpkgClose(ndbenv->pkgdb);
 	    rpmlog(RPMLOG_DEBUG, "closed   db index       %s/Packages.db\n", rpmdbHome(rdb));
 	}
-	if (ndbenv->data)
+	if (ndbenv->data && !ndbenv->datamapped)
 	    free(ndbenv->data);
 	delete ndbenv;
 	rdb->db_dbenv = 0;
@@ -147,6 +152,8 @@ static int ndb_Open(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flags)
 	free(path);
 	dbi->dbi_db = ndbenv->pkgdb = pkgdb;
 	rpmpkgSetFsync(pkgdb, ndbenv->dofsync);
+	if (oflags == O_RDONLY && rpmExpandNumeric("%{?_ndb_mmap}") > 0)
+	    ndbenv->usemmap = 1;
     } else {
 	unsigned int id;
 	rpmidxdb idxdb = 0;
@@ -278,6 +285,74 @@ static int ndb_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
     return 0;
 }
 
+/* The package database generation is bumped on every put and delete */
+static int ndb_Generation(rpmdb rdb, uint64_t *generation)
+{
+    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)rdb->db_dbenv;
+    unsigned int gen;
+
+    if (!ndbenv || !ndbenv->pkgdb || rpmpkgGeneration(ndbenv->pkgdb, &gen))
+	return 1;
+    *generation = gen;
+    return 0;
+}
+
+/* Read the generation straight from the file header, without an env */
+static int ndb_PeekGeneration(rpmdb rdb, uint64_t *generation)
+{
+    char *path = rstrscat(NULL, rpmdbHome(rdb), "/", rdb->db_ops->path, NULL);
+    unsigned int gen;
+    int rc = rpmpkgPeekGeneration(path, &gen);
+
+    if (rc == 0)
+	*generation = gen;
+    free(path);
+    return rc ? 1 : 0;
+}
+
+static void setdata(dbiCursor dbc,  unsigned int hdrNum, unsigned char *hdrBlob, unsigned int hdrLen, int mapped = 0)
+{
+    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
+    if (ndbenv->data && !ndbenv->datamapped)
+	free(ndbenv->data);
+    ndbenv->hdrNum  = hdrNum;
+    ndbenv->data    = hdrBlob;
+    ndbenv->datalen = hdrLen;
+    ndbenv->datamapped = mapped;
+}
+
+/*
+ * Views stay valid while the package db stays locked, callers copy the
+ * blob right away on import so they are only needed up to the next get.
+ * Iterators can be nested, so the lock is only released once the last
+ * cursor that may have taken it is freed.
+ */
+static rpmRC pkgGet(dbiCursor dbc, unsigned int hdrNum, unsigned char **hdrBlob, unsigned int *hdrLen)
+{
+    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
+    rpmpkgdb pkgdb = (rpmpkgdb)dbc->dbi->dbi_db;
+    rpmRC rc = RPMRC_FAIL;
+
+    if (ndbenv->usemmap) {
+	const unsigned char *view = NULL;
+	if (!dbc->viewref) {
+	    dbc->viewref = 1;
+	    ndbenv->viewrefs++;
+	}
+	rc = rpmpkgGetView(pkgdb, hdrNum, &view, hdrLen);
+	if (!rc) {
+	    *hdrBlob = (unsigned char *)view;
+	    setdata(dbc, hdrNum, *hdrBlob, *hdrLen, 1);
+	}
+    }
+    if (rc == RPMRC_FAIL) {
+	rc = rpmpkgGet(pkgdb, hdrNum, hdrBlob, hdrLen);
+	if (!rc)
+	    setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
+    }
+    return rc;
+}
+
 static dbiCursor ndb_CursorInit(dbiIndex dbi, unsigned int flags)
 {
     dbiCursor dbc = new dbiCursor_s {};
@@ -289,6 +364,13 @@ static dbiCursor ndb_CursorInit(dbiIndex dbi, unsigned int flags)
 static dbiCursor ndb_CursorFree(dbiIndex dbi, dbiCursor dbc)
 {
     if (dbc) {
+	struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbi->dbi_rpmdb->db_dbenv;
+	if (dbc->viewref && ndbenv && --ndbenv->viewrefs == 0) {
+	    /* let writers in again */
+	    if (ndbenv->datamapped)
+		setdata(dbc, 0, 0, 0);
+	    rpmpkgReleaseView((rpmpkgdb)dbi->dbi_db);
+	}
 	if (dbc->list)
 	    free(dbc->list);
 	if (dbc->listdata)
@@ -299,16 +381,6 @@ static dbiCursor ndb_CursorFree(dbiIndex dbi, dbiCursor dbc)
 }
 
 
-static void setdata(dbiCursor dbc,  unsigned int hdrNum, unsigned char *hdrBlob, unsigned int hdrLen)
-{
-    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
-    if (ndbenv->data)
-	free(ndbenv->data);
-    ndbenv->hdrNum  = hdrNum;
-    ndbenv->data    = hdrBlob;
-    ndbenv->datalen = hdrLen;
-}
-
 static rpmRC ndb_pkgdbPut(dbiIndex dbi, dbiCursor dbc,  unsigned int *hdrNum, unsigned char *hdrBlob, unsigned int hdrLen)
 {
     struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbc->dbi->dbi_rpmdb->db_dbenv;
@@ -361,13 +433,12 @@ static rpmRC ndb_pkgdbIter(dbiIndex dbi, dbiCursor dbc, unsigned char **hdrBlob,
 	}
 	*hdrBlob = 0;
 	hdrNum = dbc->list[dbc->ilist];
-	rc = rpmpkgGet((rpmpkgdb)dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
+	rc = pkgGet(dbc, hdrNum, hdrBlob, hdrLen);
 	if (rc && rc != RPMRC_NOTFOUND)
 	    break;
 	dbc->ilist++;
 	if (!rc) {
 	    dbc->hdrNum = hdrNum;
-	    setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
 	    break;
 	}
     }
@@ -386,11 +457,9 @@ static rpmRC ndb_pkgdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsi
 	*hdrLen = ndbenv->datalen;
 	return RPMRC_OK;
     }
-    rc = rpmpkgGet((rpmpkgdb)dbc->dbi->dbi_db, hdrNum, hdrBlob, hdrLen);
-    if (!rc) {
+    rc = pkgGet(dbc, hdrNum, hdrBlob, hdrLen);
+    if (!rc)
 	dbc->hdrNum = hdrNum;
-	setdata(dbc, hdrNum, *hdrBlob, *hdrLen);
-    }
     return rc;
 }
 
@@ -399,6 +468,15 @@ static unsigned int ndb_pkgdbKey(dbiIndex dbi, dbiCursor dbc)
     return dbc->hdrNum;
 }
 
+static rpmRC ndb_pkgdbGetMany(dbiIndex dbi, dbiCursor dbc, unsigned int n, const unsigned int *hdrNums, unsigned char **hdrBlobs, unsigned int *hdrLens)
+{
+    struct ndbEnv_s *ndbenv = (struct ndbEnv_s *)dbi->dbi_rpmdb->db_dbenv;
+    /* Views into the mapping are cheaper than copies, use single gets */
+    if (ndbenv->usemmap)
+	return RPMRC_NOTFOUND;
+    return rpmpkgGetMany(ndbenv->pkgdb, n, hdrNums, hdrBlobs, hdrLens);
+}
+
 
 static void addtoset(dbiIndexSet *set, unsigned int *pkglist, unsigned int pkglistn)
 {
@@ -472,10 +550,13 @@ static rpmRC ndb_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t
     if (!keyp)
 	return ndb_idxdbIter(dbi, dbc, set);
 
-    if (searchType == DBC_PREFIX_SEARCH) {
+    if (searchType == DBC_PREFIX_SEARCH || searchType == DBC_GLOB_SEARCH) {
 	unsigned int *list = 0, nlist = 0, i = 0;
 	unsigned char *listdata = 0;
 	rpmRC rrc = RPMRC_NOTFOUND;
+	int glob = (searchType == DBC_GLOB_SEARCH);
+	if (glob)
+	    keylen = globPrefixLen(keyp);
 	rc = rpmidxList((rpmidxdb)dbc->dbi->dbi_db, &list, &nlist, &listdata);
 	if (rc)
 	    return rc;
@@ -484,6 +565,8 @@ static rpmRC ndb_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t
 	    unsigned int kl = list[i + 1];
 	    if (kl < keylen || memcmp(k, keyp, keylen) != 0)
 		continue;
+	    if (glob && !globKeyMatch(keyp, k, kl))
+		continue;
 	    rc = ndb_idxdbGet(dbi, dbc, (char *)k, kl, set, DBC_NORMAL_SEARCH);
 	    if (rc == RPMRC_NOTFOUND)
 		rc = RPMRC_OK;
@@ -508,9 +591,9 @@ static rpmRC ndb_idxdbPutOne(dbiIndex dbi, dbiCursor dbc, const char *keyp, size
     return rpmidxPut((rpmidxdb)dbc->dbi->dbi_db, (const unsigned char *)keyp, keylen, rec->hdrNum, rec->tagNum);
 }
 
-static rpmRC ndb_idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
+static rpmRC ndb_idxdbPut(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys)
 {
-    return tag2index(dbi, rpmtag, hdrNum, h, ndb_idxdbPutOne);
+    return keys2index(dbi, hdrNum, keys, ndb_idxdbPutOne);
 }
 
 static rpmRC ndb_idxdbDelOne(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexItem rec)
@@ -520,7 +603,9 @@ static rpmRC ndb_idxdbDelOne(dbiIndex dbi, dbiCursor dbc, const char *keyp, size
 
 static rpmRC ndb_idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
 {
-    return tag2index(dbi, rpmtag, hdrNum, h, ndb_idxdbDelOne);
+    struct idxKeys_s keys;
+    tag2keys(rpmtag, h, keys);
+    return keys2index(dbi, hdrNum, keys, ndb_idxdbDelOne);
 }
 
 static const void * ndb_idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen)
@@ -541,6 +626,8 @@ struct rpmdbOps_s ndb_dbops = {
     .verify	= ndb_Verify,
     .setFSync	= ndb_SetFSync,
     .ctrl	= ndb_Ctrl,
+    .generation	= ndb_Generation,
+    .peekGeneration	= ndb_PeekGeneration,
 
     .cursorInit	= ndb_CursorInit,
     .cursorFree	= ndb_CursorFree,
@@ -549,6 +636,7 @@ struct rpmdbOps_s ndb_dbops = {
     .pkgdbPut	= ndb_pkgdbPut,
     .pkgdbDel	= ndb_pkgdbDel,
     .pkgdbKey	= ndb_pkgdbKey,
+    .pkgdbGetMany	= ndb_pkgdbGetMany,
 
     .idxdbGet	= ndb_idxdbGet,
     .idxdbPut	= ndb_idxdbPut,
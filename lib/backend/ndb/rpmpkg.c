@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -49,6 +50,11 @@ typedef struct rpmpkgdb_s {
     char *filename;
     unsigned int fileblks;	/* file size in blks */
     int dofsync;
+
+    unsigned char *map;		/* read-only mapping of the file */
+    size_t mapsize;
+    unsigned int mapgeneration;	/* generation at the time of mapping */
+    int viewlocked;		/* shared lock held for handed out views */
 } * rpmpkgdb;
 
 
@@ -582,6 +588,61 @@ static int rpmpkgReadBlob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blko
     return RPMRC_OK;
 }
 
+/* map the file for reading, remapping if the file may have changed in size */
+static int rpmpkgMap(rpmpkgdb pkgdb, size_t minsize)
+{
+    struct stat stb;
+    void *map;
+
+    if (pkgdb->map && pkgdb->mapgeneration == pkgdb->generation && minsize <= pkgdb->mapsize)
+	return RPMRC_OK;
+    if (pkgdb->map) {
+	munmap(pkgdb->map, pkgdb->mapsize);
+	pkgdb->map = 0;
+	pkgdb->mapsize = 0;
+    }
+    if (fstat(pkgdb->fd, &stb) || stb.st_size == 0 || (size_t)stb.st_size < minsize)
+	return RPMRC_FAIL;
+    map = mmap(0, stb.st_size, PROT_READ, MAP_SHARED, pkgdb->fd, 0);
+    if (map == MAP_FAILED)
+	return RPMRC_FAIL;
+    pkgdb->map = map;
+    pkgdb->mapsize = stb.st_size;
+    pkgdb->mapgeneration = pkgdb->generation;
+    return RPMRC_OK;
+}
+
+/* like rpmpkgReadBlob, but return a pointer into the mapping */
+static int rpmpkgMapBlob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blkoff, unsigned int blkcnt, const unsigned char **blobp, unsigned int *bloblp)
+{
+    unsigned char *head, *tail;
+    unsigned int bloblen;
+    size_t fileoff;
+
+    /* sanity */
+    if (blkcnt <  (BLOBHEAD_SIZE + BLOBTAIL_SIZE + BLK_SIZE - 1) / BLK_SIZE)
+	return RPMRC_FAIL;	/* blkcnt too small */
+    fileoff = (size_t)blkoff * BLK_SIZE;
+    if (rpmpkgMap(pkgdb, fileoff + (size_t)blkcnt * BLK_SIZE))
+	return RPMRC_FAIL;
+    head = pkgdb->map + fileoff;
+    if (le2h(head) != BLOBHEAD_MAGIC)
+	return RPMRC_FAIL;	/* bad blob */
+    if (le2h(head + 4) != pkgidx)
+	return RPMRC_FAIL;	/* bad blob */
+    bloblen = le2h(head + 12);
+    if (blkcnt != (BLOBHEAD_SIZE + bloblen + BLOBTAIL_SIZE + BLK_SIZE - 1) / BLK_SIZE)
+	return RPMRC_FAIL;	/* bad blob */
+    tail = head + (size_t)blkcnt * BLK_SIZE - BLOBTAIL_SIZE;
+    if (le2h(tail + 4) != bloblen)
+	return RPMRC_FAIL;	/* bad blob, bloblen mismatch */
+    if (le2h(tail + 8) != BLOBTAIL_MAGIC)
+	return RPMRC_FAIL;	/* bad blob */
+    *blobp = head + BLOBHEAD_SIZE;
+    *bloblp = bloblen;
+    return RPMRC_OK;
+}
+
 static int rpmpkgVerifyblob(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned int blkoff, unsigned int blkcnt)
 {
     unsigned char buf[65536];
@@ -896,6 +957,8 @@ void rpmpkgClose(rpmpkgdb pkgdb)
     if (pkgdb->slothash)
 	free(pkgdb->slothash);
     pkgdb->slothash = 0;
+    if (pkgdb->map)
+	munmap(pkgdb->map, pkgdb->mapsize);
     free(pkgdb->filename);
     free(pkgdb);
 }
@@ -1078,6 +1141,23 @@ static rpmRC rpmpkgGetInternal(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned cha
     return RPMRC_OK;
 }
 
+static rpmRC rpmpkgGetViewInternal(rpmpkgdb pkgdb, unsigned int pkgidx, const unsigned char **blobp, unsigned int *bloblp)
+{
+    pkgslot *slot;
+
+    if (!pkgdb->slots && rpmpkgReadSlots(pkgdb)) {
+	return RPMRC_FAIL;
+    }
+    slot = rpmpkgFindSlot(pkgdb, pkgidx);
+    if (!slot) {
+	return RPMRC_NOTFOUND;
+    }
+    if (rpmpkgMapBlob(pkgdb, pkgidx, slot->blkoff, slot->blkcnt, blobp, bloblp)) {
+	return RPMRC_FAIL;
+    }
+    return RPMRC_OK;
+}
+
 static int rpmpkgPutInternal(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl)
 {
     unsigned int blkcnt, blkoff, slotno;
@@ -1274,6 +1354,109 @@ rpmRC rpmpkgGet(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsi
     return rc;
 }
 
+typedef struct pkgreq_s {
+    pkgslot *slot;
+    unsigned int i;
+} pkgreq;
+
+static int pkgreqcmp(const void *a, const void *b)
+{
+    const pkgslot *sa = ((const pkgreq *)a)->slot;
+    const pkgslot *sb = ((const pkgreq *)b)->slot;
+    return (sa->blkoff > sb->blkoff) - (sa->blkoff < sb->blkoff);
+}
+
+/*
+ * Get a batch of blobs under a single lock. The reads are done in file
+ * order after telling the kernel about all of them, so that the reads
+ * of a scattered set of packages turn into mostly sequential I/O.
+ * Missing blobs are returned as NULL.
+ */
+rpmRC rpmpkgGetMany(rpmpkgdb pkgdb, unsigned int n, const unsigned int *pkgidxs, unsigned char **blobps, unsigned int *bloblps)
+{
+    pkgreq *reqs;
+    unsigned int i, nreqs = 0;
+    rpmRC rc = RPMRC_OK;
+
+    for (i = 0; i < n; i++) {
+	blobps[i] = 0;
+	bloblps[i] = 0;
+    }
+    if (rpmpkgLockReadHeader(pkgdb, 0))
+	return RPMRC_FAIL;
+    if (!pkgdb->slots && rpmpkgReadSlots(pkgdb)) {
+	rpmpkgUnlock(pkgdb, 0);
+	return RPMRC_FAIL;
+    }
+    reqs = xcalloc(n ? n : 1, sizeof(*reqs));
+    for (i = 0; i < n; i++) {
+	pkgslot *slot = pkgidxs[i] ? rpmpkgFindSlot(pkgdb, pkgidxs[i]) : 0;
+	if (!slot)
+	    continue;
+	reqs[nreqs].slot = slot;
+	reqs[nreqs].i = i;
+	nreqs++;
+    }
+    if (nreqs > 1)
+	qsort(reqs, nreqs, sizeof(*reqs), pkgreqcmp);
+#if defined(POSIX_FADV_WILLNEED)
+    for (i = 0; i < nreqs; i++) {
+	pkgslot *slot = reqs[i].slot;
+	posix_fadvise(pkgdb->fd, (off_t)slot->blkoff * BLK_SIZE,
+		      (off_t)slot->blkcnt * BLK_SIZE, POSIX_FADV_WILLNEED);
+    }
+#endif
+    for (i = 0; i < nreqs; i++) {
+	pkgslot *slot = reqs[i].slot;
+	unsigned int j = reqs[i].i;
+	unsigned char *blob = xmalloc((size_t)slot->blkcnt * BLK_SIZE);
+	if (rpmpkgReadBlob(pkgdb, slot->pkgidx, slot->blkoff, slot->blkcnt, blob, bloblps + j, (unsigned int *)0)) {
+	    free(blob);
+	    rc = RPMRC_FAIL;
+	    break;
+	}
+	blobps[j] = blob;
+    }
+    rpmpkgUnlock(pkgdb, 0);
+    free(reqs);
+    if (rc) {
+	for (i = 0; i < n; i++) {
+	    free(blobps[i]);
+	    blobps[i] = 0;
+	    bloblps[i] = 0;
+	}
+    }
+    return rc;
+}
+
+/*
+ * Return a blob as a view into a read-only mapping of the database. The
+ * shared lock is kept until rpmpkgReleaseView() so that no writer can
+ * change or truncate the file under the view. Fails (and the caller should
+ * fall back to rpmpkgGet) if we hold the write lock ourselves.
+ */
+rpmRC rpmpkgGetView(rpmpkgdb pkgdb, unsigned int pkgidx, const unsigned char **blobp, unsigned int *bloblp)
+{
+    *blobp = 0;
+    *bloblp = 0;
+    if (!pkgidx || pkgdb->locked_excl)
+	return RPMRC_FAIL;
+    if (!pkgdb->viewlocked) {
+	if (rpmpkgLockReadHeader(pkgdb, 0))
+	    return RPMRC_FAIL;
+	pkgdb->viewlocked = 1;
+    }
+    return rpmpkgGetViewInternal(pkgdb, pkgidx, blobp, bloblp);
+}
+
+void rpmpkgReleaseView(rpmpkgdb pkgdb)
+{
+    if (pkgdb->viewlocked) {
+	pkgdb->viewlocked = 0;
+	rpmpkgUnlock(pkgdb, 0);
+    }
+}
+
 rpmRC rpmpkgPut(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl)
 {
     int rc;
@@ -1349,6 +1532,29 @@ int rpmpkgGeneration(rpmpkgdb pkgdb, unsigned int *generationp)
     return RPMRC_OK;
 }
 
+/* Read the generation from the header of a package database file */
+int rpmpkgPeekGeneration(const char *filename, unsigned int *generationp)
+{
+    unsigned char header[PKGDB_HEADER_SIZE];
+    int rc = RPMRC_FAIL;
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+	return RPMRC_FAIL;
+    /* Don't wait for a writer, the caller can take the slow path */
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+	if (pread(fd, header, PKGDB_HEADER_SIZE, 0) == PKGDB_HEADER_SIZE &&
+		le2h(header + PKGDB_OFFSET_MAGIC) == PKGDB_MAGIC &&
+		le2h(header + PKGDB_OFFSET_VERSION) == PKGDB_VERSION) {
+	    *generationp = le2h(header + PKGDB_OFFSET_GENERATION);
+	    rc = RPMRC_OK;
+	}
+	flock(fd, LOCK_UN);
+    }
+    close(fd);
+    return rc;
+}
+
 int rpmpkgStats(rpmpkgdb pkgdb)
 {
     unsigned int usedblks = 0;
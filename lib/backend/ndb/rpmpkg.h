@@ -16,6 +16,9 @@ int rpmpkgLock(rpmpkgdb pkgdb, int excl);
 int rpmpkgUnlock(rpmpkgdb pkgdb, int excl);
 
 rpmRC rpmpkgGet(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char **blobp, unsigned int *bloblp);
+rpmRC rpmpkgGetMany(rpmpkgdb pkgdb, unsigned int n, const unsigned int *pkgidxs, unsigned char **blobps, unsigned int *bloblps);
+rpmRC rpmpkgGetView(rpmpkgdb pkgdb, unsigned int pkgidx, const unsigned char **blobp, unsigned int *bloblp);
+void rpmpkgReleaseView(rpmpkgdb pkgdb);
 rpmRC rpmpkgPut(rpmpkgdb pkgdb, unsigned int pkgidx, unsigned char *blob, unsigned int blobl);
 rpmRC rpmpkgDel(rpmpkgdb pkgdb, unsigned int pkgidx);
 rpmRC rpmpkgList(rpmpkgdb pkgdb, unsigned int **pkgidxlistp, unsigned int *npkgidxlistp);
@@ -23,6 +26,7 @@ rpmRC rpmpkgVerify(rpmpkgdb pkgdb);
 
 rpmRC rpmpkgNextPkgIdx(rpmpkgdb pkgdb, unsigned int *pkgidxp);
 int rpmpkgGeneration(rpmpkgdb pkgdb, unsigned int *generationp);
+int rpmpkgPeekGeneration(const char *filename, unsigned int *generationp);
 
 int rpmpkgStats(rpmpkgdb pkgdb);
 
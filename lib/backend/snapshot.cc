@@ -0,0 +1,742 @@
+#include "system.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <rpm/rpmlog.h>
+#include <rpm/rpmfileutil.h>
+#include <rpm/rpmstring.h>
+#include "rpmdb_internal.hh"
+
+#include "debug.h"
+
+/*
+ * Read-only query snapshot of an rpmdb. It's written at the end of a
+ * transaction and consists of
+ * - a header identifying the state of the primary database it was taken from
+ * - a directory of tables, one for the packages and one per index
+ * - the package table: (hdrNum, blob) pairs sorted by hdrNum
+ * - per index the keys in bytewise order, stored column by column:
+ *   key offsets, record offsets, the records and the key data
+ * Everything is in host byte order, the snapshot is a local cache and
+ * gets ignored as soon as the primary database changes.
+ */
+
+#define SNAP_MAGIC	"RPMSNAP"
+#define SNAP_VERSION	1
+#define SNAP_BOM	0x01020304
+#define SNAP_ALIGN	8
+
+struct snapHeader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t bom;		/* byte order mark */
+    uint64_t generation;	/* generation of the primary database */
+    uint64_t dev;		/* identity of the primary database file */
+    uint64_t ino;
+    char backend[16];		/* name of the primary backend */
+    uint32_t ntables;
+    uint32_t pad;
+};
+
+struct snapTable_s {
+    uint32_t tag;
+    uint32_t nkeys;	/* no. of keys, or packages for the package table */
+    uint64_t keys;	/* uint32_t key offsets[nkeys + 1] or snapPkg_s[nkeys] */
+    uint64_t recs;	/* uint32_t record offsets[nkeys + 1] */
+    uint64_t items;	/* snapItem_s records */
+    uint64_t data;	/* key data or header blobs */
+    uint64_t datalen;
+};
+
+struct snapPkg_s {
+    uint32_t hdrNum;
+    uint32_t len;
+    uint64_t off;	/* blob offset from table data */
+};
+
+struct snapItem_s {
+    uint32_t hdrNum;
+    uint32_t tagNum;
+};
+
+struct snapEnv_s {
+    int refs;
+    unsigned char *map;
+    size_t size;
+};
+
+struct dbiCursor_s {
+    const struct snapTable_s *t;
+    unsigned int pos;		/* next key or package to iterate */
+    unsigned int hdrNum;
+    const unsigned char *key;
+    unsigned int keylen;
+};
+
+static const struct snapHeader_s *snapHeader(rpmdb rdb)
+{
+    return (const struct snapHeader_s *)((struct snapEnv_s *)rdb->db_dbenv)->map;
+}
+
+static const unsigned char *snapPtr(dbiIndex dbi, uint64_t off)
+{
+    return ((struct snapEnv_s *)dbi->dbi_rpmdb->db_dbenv)->map + off;
+}
+
+static int snapHeaderOk(const struct snapHeader_s *sh)
+{
+    return (memcmp(sh->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) == 0 &&
+	    sh->version == SNAP_VERSION && sh->bom == SNAP_BOM &&
+	    memchr(sh->backend, '\0', sizeof(sh->backend)) != NULL);
+}
+
+static int snapInside(uint64_t off, uint64_t len, size_t size, int aligned)
+{
+    if (aligned && off % SNAP_ALIGN)
+	return 0;
+    return (off <= size && len <= size - off);
+}
+
+/* Sanity check all the table bounds once, lookups can trust them */
+static int snapTableOk(const unsigned char *map, size_t size,
+			const struct snapTable_s *t)
+{
+    if (!snapInside(t->data, t->datalen, size, 0))
+	return 0;
+    if (t->tag == RPMDBI_PACKAGES)
+	return snapInside(t->keys, t->nkeys * sizeof(snapPkg_s), size, 1);
+
+    uint64_t ncols = (uint64_t)t->nkeys + 1;
+    if (!snapInside(t->keys, ncols * sizeof(uint32_t), size, 1) ||
+	!snapInside(t->recs, ncols * sizeof(uint32_t), size, 1))
+	return 0;
+
+    /* Lookups take the differences of neighbouring offsets */
+    const uint32_t *keyoff = (const uint32_t *)(map + t->keys);
+    const uint32_t *recoff = (const uint32_t *)(map + t->recs);
+    for (uint32_t i = 0; i < t->nkeys; i++) {
+	if (keyoff[i] > keyoff[i + 1] || recoff[i] > recoff[i + 1])
+	    return 0;
+    }
+    return (keyoff[t->nkeys] <= t->datalen &&
+	    snapInside(t->items, recoff[t->nkeys] * sizeof(snapItem_s), size, 1));
+}
+
+static const struct snapTable_s *snapTables(const struct snapHeader_s *sh)
+{
+    return (const struct snapTable_s *)(sh + 1);
+}
+
+static const struct snapTable_s *snapFind(const struct snapHeader_s *sh,
+					rpmDbiTagVal rpmtag)
+{
+    const struct snapTable_s *t = snapTables(sh);
+    for (unsigned int i = 0; i < sh->ntables; i++) {
+	if (t[i].tag == rpmtag)
+	    return &t[i];
+    }
+    return NULL;
+}
+
+static char *snapPath(rpmdb rdb)
+{
+    return rpmGenPath(rpmdbHome(rdb), snapshot_dbops.path, NULL);
+}
+
+/* Identify the current state of the primary database */
+static int snapStamp(rpmdb rdb, const struct rpmdbOps_s *ops,
+			int (*generation)(rpmdb rdb, uint64_t *generation),
+			struct snapHeader_s *sh)
+{
+    struct stat sb;
+    char *path = rpmGenPath(rpmdbHome(rdb), ops->path, NULL);
+    int rc = -1;
+
+    if (generation && stat(path, &sb) == 0 &&
+	    generation(rdb, &sh->generation) == 0) {
+	sh->dev = sb.st_dev;
+	sh->ino = sb.st_ino;
+	rstrlcpy(sh->backend, ops->name, sizeof(sh->backend));
+	rc = 0;
+    }
+    free(path);
+    return rc;
+}
+
+static struct snapEnv_s *snapMap(rpmdb rdb)
+{
+    struct snapEnv_s *env = NULL;
+    char *path = snapPath(rdb);
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    struct stat sb;
+    void *map = MAP_FAILED;
+
+    if (fd < 0 || fstat(fd, &sb) || (size_t)sb.st_size < sizeof(snapHeader_s))
+	goto exit;
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+	const struct snapHeader_s *sh = (const struct snapHeader_s *)map;
+	size_t size = sb.st_size;
+	int ok = snapHeaderOk(sh) &&
+		snapInside(sizeof(*sh), sh->ntables * sizeof(snapTable_s),
+			    size, 1);
+	for (unsigned int i = 0; ok && i < sh->ntables; i++)
+	    ok = snapTableOk((const unsigned char *)map, size,
+			    &snapTables(sh)[i]);
+	if (ok) {
+	    env = new snapEnv_s {};
+	    env->map = (unsigned char *)map;
+	    env->size = size;
+	} else {
+	    rpmlog(RPMLOG_ERR, _("damaged rpmdb snapshot %s\n"), path);
+	    munmap(map, size);
+	}
+    }
+
+exit:
+    if (fd >= 0)
+	close(fd);
+    free(path);
+    return env;
+}
+
+int dbSnapshotFresh(rpmdb rdb)
+{
+    const struct rpmdbOps_s *ops = rdb->db_ops;
+    const struct snapHeader_s *snap;
+    struct snapHeader_s cur = {};
+    struct snapEnv_s *env = snapMap(rdb);
+    int fresh = 0;
+    int rc = -1;
+
+    if (env == NULL)
+	return 0;
+
+    /* Check what was mapped, that is what gets used if it's fresh */
+    snap = (const struct snapHeader_s *)env->map;
+    if (!rstreq(snap->backend, ops->name))
+	goto exit;
+
+    /* All the configured indexes need to be there */
+    for (int i = -1; i < rdb->db_ndbi; i++) {
+	rpmDbiTagVal tag = (i < 0) ? RPMDBI_PACKAGES : rdb->db_tags[i];
+	if (snapFind(snap, tag) == NULL)
+	    goto exit;
+    }
+
+    /* Last, compare with the primary. Opening it is the costly bit,
+     * so peek at the generation instead where the backend can. */
+    if (ops->peekGeneration)
+	rc = snapStamp(rdb, ops, ops->peekGeneration, &cur);
+    if (rc) {
+	dbiIndex dbi = NULL;
+	if (ops->open(rdb, RPMDBI_PACKAGES, &dbi, 0) == 0) {
+	    rc = snapStamp(rdb, ops, ops->generation, &cur);
+	    ops->close(dbi, 0);
+	}
+    }
+    fresh = (rc == 0 && cur.generation == snap->generation &&
+	     cur.dev == snap->dev && cur.ino == snap->ino);
+
+    rpmlog(RPMLOG_DEBUG, "%s snapshot %s\n",
+	    fresh ? "using" : "ignoring stale", rpmdbHome(rdb));
+
+exit:
+    if (fresh) {
+	rdb->db_dbenv = env;
+    } else {
+	munmap(env->map, env->size);
+	delete env;
+    }
+    return fresh;
+}
+
+int dbSnapshotPrimary(rpmdb rdb, const char **backend, dev_t *dev, ino_t *ino)
+{
+    if (rdb->db_ops != &snapshot_dbops || rdb->db_dbenv == NULL)
+	return -1;
+
+    /* Only fresh snapshots get used, so this is what stat() would say */
+    const struct snapHeader_s *sh = snapHeader(rdb);
+    *backend = sh->backend;
+    *dev = sh->dev;
+    *ino = sh->ino;
+    return 0;
+}
+
+/* Write out all of buf, keeping track of the file offset */
+static int snapWrite(int fd, const void *buf, size_t len, uint64_t *off)
+{
+    const char *p = (const char *)buf;
+    while (len > 0) {
+	ssize_t n = write(fd, p, len);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	p += n;
+	len -= n;
+	*off += n;
+    }
+    return 0;
+}
+
+static int snapPad(int fd, uint64_t *off)
+{
+    static const char zeros[SNAP_ALIGN] = {};
+    size_t pad = (SNAP_ALIGN - *off % SNAP_ALIGN) % SNAP_ALIGN;
+    return snapWrite(fd, zeros, pad, off);
+}
+
+template <typename T>
+static int snapWriteColumn(int fd, const std::vector<T> & col, uint64_t *off,
+			    uint64_t *start)
+{
+    if (snapPad(fd, off))
+	return -1;
+    *start = *off;
+    return snapWrite(fd, col.data(), col.size() * sizeof(T), off);
+}
+
+static int snapWritePackages(int fd, dbiIndex dbi, struct snapTable_s *t,
+			    uint64_t *off)
+{
+    dbiCursor dbc = dbiCursorInit(dbi, DBC_READ);
+    std::vector<snapPkg_s> pkgs;
+    unsigned char *blob;
+    unsigned int bloblen;
+    unsigned int nget = 0;
+    int rc = 0;
+
+    t->tag = RPMDBI_PACKAGES;
+    t->data = *off;
+    while (pkgdbGet(dbi, dbc, 0, &blob, &bloblen) == RPMRC_OK) {
+	unsigned int hdrNum = pkgdbKey(dbi, dbc);
+	/* Terminate on end of keys, like rpmdbNextIterator() does */
+	if (hdrNum == 0) {
+	    if (nget++)
+		break;
+	    continue;
+	}
+	nget++;
+	pkgs.push_back({ hdrNum, bloblen, *off - t->data });
+	if ((rc = snapWrite(fd, blob, bloblen, off)))
+	    break;
+    }
+    dbiCursorFree(dbi, dbc);
+
+    if (!rc) {
+	auto cmp = [](const snapPkg_s & a, const snapPkg_s & b) {
+	    return a.hdrNum < b.hdrNum;
+	};
+	std::sort(pkgs.begin(), pkgs.end(), cmp);
+	t->datalen = *off - t->data;
+	t->nkeys = pkgs.size();
+	rc = snapWriteColumn(fd, pkgs, off, &t->keys);
+    }
+    return rc;
+}
+
+struct snapKey_s {
+    size_t off;
+    unsigned int len;
+    unsigned int item;
+    unsigned int nitems;
+};
+
+static int keycmp(const unsigned char *a, unsigned int alen,
+		  const unsigned char *b, unsigned int blen)
+{
+    int rc = memcmp(a, b, alen < blen ? alen : blen);
+    if (rc == 0 && alen != blen)
+	rc = (alen < blen) ? -1 : 1;
+    return rc;
+}
+
+static int snapWriteIndex(int fd, dbiIndex dbi, rpmDbiTagVal rpmtag,
+			struct snapTable_s *t, uint64_t *off)
+{
+    dbiCursor dbc = dbiCursorInit(dbi, DBC_READ);
+    dbiIndexSet set = NULL;
+    std::string keydata;
+    std::vector<snapKey_s> keys;
+    std::vector<snapItem_s> items;
+
+    /* Collect, the backend iteration order is arbitrary */
+    while (idxdbGet(dbi, dbc, NULL, 0, &set, DBC_NORMAL_SEARCH) == RPMRC_OK) {
+	unsigned int keylen = 0;
+	const void *key = idxdbKey(dbi, dbc, &keylen);
+	unsigned int n = dbiIndexSetCount(set);
+	keys.push_back({ keydata.size(), keylen, (unsigned int)items.size(), n });
+	keydata.append((const char *)key, keylen);
+	for (unsigned int i = 0; i < n; i++) {
+	    items.push_back({ dbiIndexRecordOffset(set, i),
+			      dbiIndexRecordFileNumber(set, i) });
+	}
+	set = dbiIndexSetFree(set);
+    }
+    dbiIndexSetFree(set);
+    dbiCursorFree(dbi, dbc);
+
+    const unsigned char *kd = (const unsigned char *)keydata.data();
+    auto cmp = [kd](const snapKey_s & a, const snapKey_s & b) {
+	return keycmp(kd + a.off, a.len, kd + b.off, b.len) < 0;
+    };
+    std::sort(keys.begin(), keys.end(), cmp);
+
+    std::vector<uint32_t> keyoff, recoff;
+    std::vector<snapItem_s> recs;
+    std::string data;
+    keyoff.reserve(keys.size() + 1);
+    recoff.reserve(keys.size() + 1);
+    recs.reserve(items.size());
+    data.reserve(keydata.size());
+    for (auto const & k : keys) {
+	keyoff.push_back(data.size());
+	recoff.push_back(recs.size());
+	data.append(keydata, k.off, k.len);
+	recs.insert(recs.end(), items.begin() + k.item,
+		    items.begin() + k.item + k.nitems);
+    }
+    keyoff.push_back(data.size());
+    recoff.push_back(recs.size());
+
+    t->tag = rpmtag;
+    t->nkeys = keys.size();
+    if (snapWriteColumn(fd, keyoff, off, &t->keys) ||
+	snapWriteColumn(fd, recoff, off, &t->recs) ||
+	snapWriteColumn(fd, recs, off, &t->items))
+	return -1;
+    t->data = *off;
+    t->datalen = data.size();
+    return snapWrite(fd, data.data(), data.size(), off);
+}
+
+int dbSnapshotWrite(rpmdb rdb, dbiIndex pkgs,
+		    const std::vector<dbiIndex> & indexes)
+{
+    struct snapHeader_s sh = {};
+    std::vector<snapTable_s> tables(indexes.size() + 1);
+    uint64_t off = 0;
+    char *path = snapPath(rdb);
+    char *tmppath = rstrscat(NULL, path, ".new", NULL);
+    int fd = -1;
+    int rc = -1;
+
+    /* Without a generation the snapshot couldn't ever be trusted */
+    if (snapStamp(rdb, rdb->db_ops, rdb->db_ops->generation, &sh)) {
+	rpmlog(RPMLOG_DEBUG, "%s backend has no generation, no snapshot\n",
+		rdb->db_ops->name);
+	free(tmppath);
+	free(path);
+	return 0;
+    }
+    memcpy(sh.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    sh.version = SNAP_VERSION;
+    sh.bom = SNAP_BOM;
+    sh.ntables = tables.size();
+
+    fd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, rdb->db_perms);
+    if (fd < 0)
+	goto exit;
+
+    /* Header and directory are filled in last */
+    off = sizeof(sh) + tables.size() * sizeof(snapTable_s);
+    if (lseek(fd, off, SEEK_SET) < 0)
+	goto exit;
+
+    if (snapWritePackages(fd, pkgs, &tables[0], &off))
+	goto exit;
+    for (size_t i = 0; i < indexes.size(); i++) {
+	dbiIndex dbi = indexes[i];
+	rpmDbiTagVal tag = rpmTagGetValue(dbi->dbi_file);
+	if (snapWriteIndex(fd, dbi, tag, &tables[i + 1], &off))
+	    goto exit;
+    }
+
+    if (pwrite(fd, &sh, sizeof(sh), 0) != sizeof(sh))
+	goto exit;
+    if (pwrite(fd, tables.data(), tables.size() * sizeof(snapTable_s),
+		sizeof(sh)) != (ssize_t)(tables.size() * sizeof(snapTable_s)))
+	goto exit;
+    if (fdatasync(fd))
+	goto exit;
+    if (close(fd) == 0 && rename(tmppath, path) == 0)
+	rc = 0;
+    fd = -1;
+
+exit:
+    if (fd >= 0)
+	close(fd);
+    if (rc) {
+	rpmlog(RPMLOG_WARNING, _("failed to write rpmdb snapshot %s: %s\n"),
+		path, strerror(errno));
+	unlink(tmppath);
+    } else {
+	rpmlog(RPMLOG_DEBUG, "wrote snapshot %s\n", path);
+    }
+    free(tmppath);
+    free(path);
+    return rc;
+}
+
+static void snapRelease(rpmdb rdb)
+{
+    struct snapEnv_s *env = (struct snapEnv_s *)rdb->db_dbenv;
+    if (env && --env->refs == 0) {
+	munmap(env->map, env->size);
+	delete env;
+	rdb->db_dbenv = NULL;
+    }
+}
+
+static int snapshot_Close(dbiIndex dbi, unsigned int flags)
+{
+    snapRelease(dbi->dbi_rpmdb);
+    dbiFree(dbi);
+    return 0;
+}
+
+static int snapshot_Open(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flags)
+{
+    struct snapEnv_s *env = (struct snapEnv_s *)rdb->db_dbenv;
+    const struct snapTable_s *t;
+    dbiIndex dbi;
+
+    if (env == NULL) {
+	if ((env = snapMap(rdb)) == NULL)
+	    return 1;
+	rdb->db_dbenv = env;
+	rpmlog(RPMLOG_DEBUG, "opened   snapshot       %s\n", rpmdbHome(rdb));
+    }
+    env->refs++;
+
+    if ((t = snapFind(snapHeader(rdb), rpmtag)) == NULL) {
+	snapRelease(rdb);
+	return 1;
+    }
+
+    dbi = dbiNew(rdb, rpmtag);
+    dbi->dbi_db = (void *)t;
+    dbi->dbi_flags |= DBI_RDONLY;
+
+    if (dbip)
+	*dbip = dbi;
+    else
+	snapshot_Close(dbi, 0);
+    return 0;
+}
+
+static int snapshot_Verify(dbiIndex dbi, unsigned int flags)
+{
+    return 0;
+}
+
+static void snapshot_SetFSync(rpmdb rdb, int enable)
+{
+}
+
+static int snapshot_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
+{
+    return 0;
+}
+
+static int snapshot_Generation(rpmdb rdb, uint64_t *generation)
+{
+    if (rdb->db_dbenv == NULL)
+	return 1;
+    *generation = snapHeader(rdb)->generation;
+    return 0;
+}
+
+static dbiCursor snapshot_CursorInit(dbiIndex dbi, unsigned int flags)
+{
+    dbiCursor dbc = new dbiCursor_s {};
+    dbc->t = (const struct snapTable_s *)dbi->dbi_db;
+    return dbc;
+}
+
+static dbiCursor snapshot_CursorFree(dbiIndex dbi, dbiCursor dbc)
+{
+    delete dbc;
+    return NULL;
+}
+
+static rpmRC snapshot_pkgdbPut(dbiIndex dbi, dbiCursor dbc,  unsigned int *hdrNum, unsigned char *hdrBlob, unsigned int hdrLen)
+{
+    return RPMRC_FAIL;
+}
+
+static rpmRC snapshot_pkgdbDel(dbiIndex dbi, dbiCursor dbc,  unsigned int hdrNum)
+{
+    return RPMRC_FAIL;
+}
+
+static rpmRC snapshot_pkgdbGet(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **hdrBlob, unsigned int *hdrLen)
+{
+    const struct snapTable_s *t = dbc->t;
+    const struct snapPkg_s *pkgs = (const struct snapPkg_s *)snapPtr(dbi, t->keys);
+    const struct snapPkg_s *pkg;
+
+    if (hdrNum) {
+	auto cmp = [](const snapPkg_s & p, unsigned int num) {
+	    return p.hdrNum < num;
+	};
+	pkg = std::lower_bound(pkgs, pkgs + t->nkeys, hdrNum, cmp);
+	if (pkg == pkgs + t->nkeys || pkg->hdrNum != hdrNum)
+	    return RPMRC_NOTFOUND;
+    } else {
+	if (dbc->pos >= t->nkeys)
+	    return RPMRC_NOTFOUND;
+	pkg = &pkgs[dbc->pos++];
+    }
+
+    if (!snapInside(pkg->off, pkg->len, t->datalen, 0))
+	return RPMRC_FAIL;
+
+    dbc->hdrNum = pkg->hdrNum;
+    *hdrBlob = (unsigned char *)snapPtr(dbi, t->data + pkg->off);
+    *hdrLen = pkg->len;
+    return RPMRC_OK;
+}
+
+static unsigned int snapshot_pkgdbKey(dbiIndex dbi, dbiCursor dbc)
+{
+    return dbc->hdrNum;
+}
+
+static void snapKey(dbiIndex dbi, const struct snapTable_s *t, unsigned int i,
+		    const unsigned char **key, unsigned int *keylen)
+{
+    const uint32_t *keyoff = (const uint32_t *)snapPtr(dbi, t->keys);
+    *key = snapPtr(dbi, t->data + keyoff[i]);
+    *keylen = keyoff[i + 1] - keyoff[i];
+}
+
+static void snapItems(dbiIndex dbi, const struct snapTable_s *t, unsigned int i,
+			dbiIndexSet *set)
+{
+    const uint32_t *recoff = (const uint32_t *)snapPtr(dbi, t->recs);
+    const struct snapItem_s *items = (const struct snapItem_s *)snapPtr(dbi, t->items);
+
+    if (*set == NULL)
+	*set = dbiIndexSetNew(recoff[i + 1] - recoff[i]);
+    for (unsigned int r = recoff[i]; r < recoff[i + 1]; r++)
+	dbiIndexSetAppendOne(*set, items[r].hdrNum, items[r].tagNum, 0);
+}
+
+/* Index of the first key not less than (prefix) key */
+static unsigned int snapLowerBound(dbiIndex dbi, const struct snapTable_s *t,
+				const unsigned char *key, unsigned int keylen)
+{
+    unsigned int lo = 0, hi = t->nkeys;
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+	const unsigned char *k;
+	unsigned int klen;
+	snapKey(dbi, t, mid, &k, &klen);
+	if (keycmp(k, klen, key, keylen) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static rpmRC snapshot_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexSet *set, int searchType)
+{
+    const struct snapTable_s *t = dbc->t;
+    const unsigned char *k;
+    unsigned int klen;
+
+    if (keyp == NULL) {
+	if (dbc->pos >= t->nkeys)
+	    return RPMRC_NOTFOUND;
+	snapKey(dbi, t, dbc->pos, &dbc->key, &dbc->keylen);
+	if (set)
+	    snapItems(dbi, t, dbc->pos, set);
+	dbc->pos++;
+	return RPMRC_OK;
+    }
+
+    const unsigned char *key = (const unsigned char *)keyp;
+    int found = 0;
+
+    /* Glob matches are within the range of the literal prefix */
+    if (searchType == DBC_GLOB_SEARCH)
+	keylen = globPrefixLen(keyp);
+
+    for (unsigned int i = snapLowerBound(dbi, t, key, keylen); i < t->nkeys; i++) {
+	snapKey(dbi, t, i, &k, &klen);
+	if (searchType == DBC_NORMAL_SEARCH) {
+	    if (keycmp(k, klen, key, keylen))
+		break;
+	} else if (klen < keylen || memcmp(k, key, keylen)) {
+	    break;
+	}
+	if (searchType == DBC_GLOB_SEARCH && !globKeyMatch(keyp, k, klen))
+	    continue;
+	snapItems(dbi, t, i, set);
+	found = 1;
+	if (searchType == DBC_NORMAL_SEARCH)
+	    break;
+    }
+
+    return found ? RPMRC_OK : RPMRC_NOTFOUND;
+}
+
+static rpmRC snapshot_idxdbPut(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys)
+{
+    return RPMRC_FAIL;
+}
+
+static rpmRC snapshot_idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
+{
+    return RPMRC_FAIL;
+}
+
+static const void * snapshot_idxdbKey(dbiIndex dbi, dbiCursor dbc, unsigned int *keylen)
+{
+    const void *key = NULL;
+    if (dbc) {
+	key = dbc->key;
+	if (key && keylen)
+	    *keylen = dbc->keylen;
+    }
+    return key;
+}
+
+struct rpmdbOps_s snapshot_dbops = {
+    .name	= "snapshot",
+    .path	= "rpmdb.snapshot",
+
+    .open	= snapshot_Open,
+    .close	= snapshot_Close,
+    .verify	= snapshot_Verify,
+    .setFSync	= snapshot_SetFSync,
+    .ctrl	= snapshot_Ctrl,
+    .generation	= snapshot_Generation,
+
+    .cursorInit	= snapshot_CursorInit,
+    .cursorFree	= snapshot_CursorFree,
+
+    .pkgdbGet	= snapshot_pkgdbGet,
+    .pkgdbPut	= snapshot_pkgdbPut,
+    .pkgdbDel	= snapshot_pkgdbDel,
+    .pkgdbKey	= snapshot_pkgdbKey,
+
+    .idxdbGet	= snapshot_idxdbGet,
+    .idxdbPut	= snapshot_idxdbPut,
+    .idxdbDel	= snapshot_idxdbDel,
+    .idxdbKey	= snapshot_idxdbKey
+};
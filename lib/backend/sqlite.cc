@@ -4,6 +4,9 @@
 #include <fcntl.h>
 #include <inttypes.h>
 
+#include <string>
+#include <vector>
+
 #include <rpm/rpmlog.h>
 #include <rpm/rpmfileutil.h>
 #include <rpm/rpmmacro.h>
@@ -14,9 +17,50 @@
 
 static const int sleep_ms = 50;
 
+/* Fixed query shapes whose prepared statements are cached per dbi */
+enum stmtSlot_e {
+    STMT_NONE		= -1,
+    STMT_PKG_BYKEY	= 0,
+    STMT_PKG_ITER	= 1,
+    STMT_IDX_BYKEY	= 2,
+    STMT_IDX_PREFIX	= 3,
+    STMT_IDX_ITER	= 4,
+    STMT_IDX_INSERT	= 5,
+    STMT_IDX_DEL	= 6,
+    STMT_PKG_MANY	= 7,
+    STMT_IDX_GLOB	= 8,
+    STMT_MAX		= 9,
+};
+
+/* Max. number of index rows inserted per statement */
+#define IDX_BATCH	64
+
+struct idxRow_s {
+    size_t keyoff;
+    size_t keylen;
+    unsigned int hnum;
+    unsigned int tnum;
+};
+
+/*
+ * Idle prepared statements, borrowed by cursors and returned on
+ * cursor free. Cursors needing a statement which is already in use
+ * by another cursor just prepare their own.
+ */
+struct stmtCache_s {
+    rpmdb rdb;
+    sqlite3_stmt *stmts[STMT_MAX];
+
+    /* Index rows of a header, collected for a batched insert */
+    std::string keys;
+    std::vector<idxRow_s> rows;
+};
+
 struct dbiCursor_s {
     sqlite3 *sdb;
     sqlite3_stmt *stmt;
+    struct stmtCache_s *cache;
+    int slot;
     const char *fmt;
     int flags;
     rpmTagVal tag;
@@ -65,18 +109,34 @@ static rpmRC dbiCursorResult(dbiCursor dbc)
     return err ? RPMRC_FAIL : RPMRC_OK;
 }
 
-static rpmRC dbiCursorPrep(dbiCursor dbc, const char *fmt, ...)
+static rpmRC dbiCursorPrep(dbiCursor dbc, int slot, const char *fmt, ...)
 {
     if (dbc->stmt == NULL) {
-	char *cmd = NULL;
-	va_list ap;
+	struct stmtCache_s *cache = (slot != STMT_NONE) ? dbc->cache : NULL;
+
+	if (cache && cache->stmts[slot]) {
+	    /* Borrow the cached statement, it was reset when returned */
+	    dbc->stmt = cache->stmts[slot];
+	    cache->stmts[slot] = NULL;
+	    cache->rdb->db_stmthitops.count++;
+	} else {
+	    char *cmd = NULL;
+	    va_list ap;
+
+	    if (cache)
+		(void) rpmswEnter(&cache->rdb->db_stmtmissops, 0);
 
-	va_start(ap, fmt); 
-	cmd = sqlite3_vmprintf(fmt, ap);
-	va_end(ap);
+	    va_start(ap, fmt); 
+	    cmd = sqlite3_vmprintf(fmt, ap);
+	    va_end(ap);
 
-	sqlite3_prepare_v2(dbc->sdb, cmd, -1, &dbc->stmt, NULL);
-	sqlite3_free(cmd);
+	    sqlite3_prepare_v2(dbc->sdb, cmd, -1, &dbc->stmt, NULL);
+	    sqlite3_free(cmd);
+
+	    if (cache)
+		(void) rpmswExit(&cache->rdb->db_stmtmissops, 0);
+	}
+	dbc->slot = slot;
     } else {
 	dbiCursorReset(dbc);
     }
@@ -84,6 +144,36 @@ static rpmRC dbiCursorPrep(dbiCursor dbc, const char *fmt, ...)
     return dbiCursorResult(dbc);
 }
 
+/* Return the cursor statement to the cache if possible, finalize if not */
+static void dbiCursorRelease(dbiCursor dbc)
+{
+    if (dbc->stmt && dbc->cache && dbc->slot != STMT_NONE &&
+		dbc->cache->stmts[dbc->slot] == NULL) {
+	dbiCursorReset(dbc);
+	dbc->cache->stmts[dbc->slot] = dbc->stmt;
+    } else {
+	sqlite3_finalize(dbc->stmt);
+    }
+    dbc->stmt = NULL;
+}
+
+static struct stmtCache_s *stmtCacheNew(rpmdb rdb)
+{
+    struct stmtCache_s *cache = new stmtCache_s {};
+    cache->rdb = rdb;
+    return cache;
+}
+
+static struct stmtCache_s *stmtCacheFree(struct stmtCache_s *cache)
+{
+    if (cache) {
+	for (int i = 0; i < STMT_MAX; i++)
+	    sqlite3_finalize(cache->stmts[i]);
+	delete cache;
+    }
+    return NULL;
+}
+
 static rpmRC dbiCursorBindPkg(dbiCursor dbc, unsigned int hnum,
 				void *blob, unsigned int bloblen)
 {
@@ -342,10 +432,12 @@ static int sqlite_Open(rpmdb rdb, rpmDbiTagVal rpmtag, dbiIndex * dbip, int flag
 	if (!rc && !(rdb->db_flags & RPMDB_FLAG_REBUILD))
 	    rc = init_index(dbi, rpmtag);
 
-	if (!rc && dbip)
+	if (!rc && dbip) {
+	    dbi->dbi_cache = stmtCacheNew(rdb);
 	    *dbip = dbi;
-	else
+	} else {
 	    dbiFree(dbi);
+	}
     }
 
     return rc;
@@ -357,6 +449,8 @@ static int sqlite_Close(dbiIndex dbi, unsigned int flags)
     int rc = 0;
     if (rdb->db_flags & RPMDB_FLAG_REBUILD)
 	rc = init_index(dbi, rpmTagGetValue(dbi->dbi_file));
+    /* Unfinalized statements would keep the database open */
+    dbi->dbi_cache = stmtCacheFree((struct stmtCache_s *)dbi->dbi_cache);
     sqlite_fini(dbi->dbi_rpmdb);
     dbiFree(dbi);
     return rc;
@@ -415,6 +509,53 @@ static void sqlite_SetFSync(rpmdb rdb, int enable)
 	    "PRAGMA synchronous = %s", enable ? "FULL" : "OFF");
 }
 
+/*
+ * The change generation lives in the user_version field of the database
+ * header, reading it doesn't touch any of the tables. The field is a
+ * 32bit integer, so the generation wraps around to 0 after 2^32 changes.
+ */
+static int sqliteUserVersion(sqlite3 *sdb, uint64_t *generation)
+{
+    sqlite3_stmt *s = NULL;
+    int rc = 1;
+
+    if (sqlite3_prepare_v2(sdb, "PRAGMA user_version",
+			   -1, &s, NULL) == SQLITE_OK) {
+	if (sqlite3_step(s) == SQLITE_ROW) {
+	    *generation = (uint32_t)sqlite3_column_int(s, 0);
+	    rc = 0;
+	}
+	sqlite3_finalize(s);
+    }
+    return rc;
+}
+
+static int sqlite_Generation(rpmdb rdb, uint64_t *generation)
+{
+    return sqliteUserVersion((sqlite3 *)rdb->db_dbenv, generation);
+}
+
+/*
+ * A bare read-only connection is enough to get at the generation, this
+ * skips all the setup of a regular open. The file header alone won't do
+ * as the latest user_version may still be in the write-ahead log.
+ */
+static int sqlite_PeekGeneration(rpmdb rdb, uint64_t *generation)
+{
+    char *dbfile = rpmGenPath(rpmdbHome(rdb), rdb->db_ops->path, NULL);
+    sqlite3 *sdb = NULL;
+    int rc = 1;
+
+    if (sqlite3_open_v2(dbfile, &sdb, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK) {
+	sqlite3_busy_timeout(sdb, 10000);
+	rc = sqliteUserVersion(sdb, generation);
+    }
+    /* Sqlite allocates resources even on failure to open (!) */
+    sqlite3_close(sdb);
+    free(dbfile);
+    return rc;
+}
+
 static int sqlite_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
 {
     int rc = 0;
@@ -426,6 +567,15 @@ static int sqlite_Ctrl(rpmdb rdb, dbCtrlOp ctrl)
     case DB_CTRL_UNLOCK_RW:
 	rc = sqlexec((sqlite3 *)rdb->db_dbenv, "RELEASE 'rwlock'");
 	break;
+    case DB_CTRL_GENERATION: {
+	/* Called with the rwlock savepoint held, so this is atomic */
+	uint64_t gen = 0;
+	rc = sqlite_Generation(rdb, &gen);
+	if (!rc)
+	    rc = sqlexec((sqlite3 *)rdb->db_dbenv, "PRAGMA user_version = %d",
+			 (int32_t)(uint32_t)(gen + 1));
+	break;
+    }
     default:
 	break;
     }
@@ -437,6 +587,8 @@ static dbiCursor sqlite_CursorInit(dbiIndex dbi, unsigned int flags)
 {
     dbiCursor dbc = new dbiCursor_s {};
     dbc->sdb = (sqlite3 *)dbi->dbi_db;
+    dbc->cache = (struct stmtCache_s *)dbi->dbi_cache;
+    dbc->slot = STMT_NONE;
     dbc->flags = flags;
     dbc->tag = rpmTagGetValue(dbi->dbi_file);
     if (rpmTagGetClass(dbc->tag) == RPM_STRING_CLASS) {
@@ -452,7 +604,7 @@ static dbiCursor sqlite_CursorInit(dbiIndex dbi, unsigned int flags)
 static dbiCursor sqlite_CursorFree(dbiIndex dbi, dbiCursor dbc)
 {
     if (dbc) {
-	sqlite3_finalize(dbc->stmt);
+	dbiCursorRelease(dbc);
 	if (dbc->subc)
 	    dbiCursorFree(dbi, dbc->subc);
 	if (dbc->flags & DBC_WRITE)
@@ -474,7 +626,8 @@ static rpmRC sqlite_pkgdbPut(dbiIndex dbi, dbiCursor dbc,  unsigned int *hdrNum,
     }
 
     if (!rc) {
-	rc = dbiCursorPrep(dbc, "INSERT OR REPLACE INTO '%q' VALUES(?, ?)",
+	rc = dbiCursorPrep(dbc, STMT_NONE,
+			    "INSERT OR REPLACE INTO '%q' VALUES(?, ?)",
 			    dbi->dbi_file);
     }
 
@@ -500,7 +653,7 @@ static rpmRC sqlite_pkgdbPut(dbiIndex dbi, dbiCursor dbc,  unsigned int *hdrNum,
 
 static rpmRC sqlite_pkgdbDel(dbiIndex dbi, dbiCursor dbc,  unsigned int hdrNum)
 {
-    rpmRC rc = dbiCursorPrep(dbc, "DELETE FROM '%q' WHERE hnum=?;",
+    rpmRC rc = dbiCursorPrep(dbc, STMT_NONE, "DELETE FROM '%q' WHERE hnum=?;",
 			    dbi->dbi_file);
 
     if (!rc)
@@ -528,7 +681,8 @@ static rpmRC sqlite_stepPkg(dbiCursor dbc, unsigned char **hdrBlob, unsigned int
 
 static rpmRC sqlite_pkgdbByKey(dbiIndex dbi, dbiCursor dbc, unsigned int hdrNum, unsigned char **hdrBlob, unsigned int *hdrLen)
 {
-    rpmRC rc = dbiCursorPrep(dbc, "SELECT hnum, blob FROM '%q' WHERE hnum=?",
+    rpmRC rc = dbiCursorPrep(dbc, STMT_PKG_BYKEY,
+				"SELECT hnum, blob FROM '%q' WHERE hnum=?",
 				dbi->dbi_file);
 
     if (!rc)
@@ -545,7 +699,8 @@ static rpmRC sqlite_pkgdbIter(dbiIndex dbi, dbiCursor dbc,
 {
     rpmRC rc = RPMRC_OK;
     if (dbc->stmt == NULL) {
-	rc = dbiCursorPrep(dbc, "SELECT hnum, blob FROM '%q'", dbi->dbi_file);
+	rc = dbiCursorPrep(dbc, STMT_PKG_ITER,
+			    "SELECT hnum, blob FROM '%q'", dbi->dbi_file);
     }
 
     if (!rc)
@@ -572,19 +727,91 @@ static unsigned int sqlite_pkgdbKey(dbiIndex dbi, dbiCursor dbc)
     return sqlite3_column_int(dbc->stmt, 0);
 }
 
+static rpmRC sqlite_pkgdbGetMany(dbiIndex dbi, dbiCursor dbc, unsigned int n,
+				const unsigned int *hdrNums,
+				unsigned char **hdrBlobs, unsigned int *hdrLens)
+{
+    /* Avoid trashing the callers cursor, it may be mid-iteration */
+    dbiCursor dbmc = dbiCursorInit(dbi, DBC_READ);
+    std::string in = "?";
+    rpmRC rc;
+
+    for (unsigned int i = 1; i < n; i++)
+	in += ", ?";
+    for (unsigned int i = 0; i < n; i++) {
+	hdrBlobs[i] = NULL;
+	hdrLens[i] = 0;
+    }
+
+    /* Only full batches have a fixed shape worth caching */
+    rc = dbiCursorPrep(dbmc, (n == PKGDB_BATCH) ? STMT_PKG_MANY : STMT_NONE,
+			"SELECT hnum, blob FROM '%q' WHERE hnum IN (%s)",
+			dbi->dbi_file, in.c_str());
+
+    for (unsigned int i = 0; !rc && i < n; i++) {
+	sqlite3_bind_int(dbmc->stmt, i + 1, hdrNums[i]);
+	rc = dbiCursorResult(dbmc);
+    }
+
+    while (!rc) {
+	unsigned char *blob = NULL;
+	unsigned int len = 0;
+
+	if (sqlite_stepPkg(dbmc, &blob, &len))
+	    break;
+
+	unsigned int hnum = sqlite3_column_int(dbmc->stmt, 0);
+	for (unsigned int i = 0; i < n; i++) {
+	    if (hdrNums[i] == hnum && hdrBlobs[i] == NULL) {
+		hdrBlobs[i] = (unsigned char *)memcpy(xmalloc(len), blob, len);
+		hdrLens[i] = len;
+		break;
+	    }
+	}
+    }
+
+    if (!rc)
+	rc = dbiCursorResult(dbmc);
+    dbiCursorFree(dbi, dbmc);
+
+    return rc;
+}
+
 static rpmRC sqlite_idxdbByKey(dbiIndex dbi, dbiCursor dbc,
 			    const char *keyp, size_t keylen, int searchType,
 			    dbiIndexSet *set)
 {
     rpmRC rc = RPMRC_NOTFOUND;
 
-    if (searchType == DBC_PREFIX_SEARCH) {
-	rc = dbiCursorPrep(dbc, "SELECT hnum, idx FROM '%q' "
-				"WHERE MATCH(key,'%q',%d) "
+    /* Bracket and escape syntax of GLOB differs from glob(7) */
+    if (searchType == DBC_GLOB_SEARCH && strpbrk(keyp, "[\\")) {
+	keylen = globPrefixLen(keyp);
+	searchType = DBC_PREFIX_SEARCH;
+    }
+
+    if (searchType == DBC_GLOB_SEARCH) {
+	/* With a literal prefix, this is a range scan on the key index */
+	rc = dbiCursorPrep(dbc, STMT_IDX_GLOB,
+				"SELECT hnum, idx FROM '%q' "
+				"WHERE key GLOB ?",
+				dbi->dbi_file);
+	if (!rc)
+	    rc = dbiCursorBindIdx(dbc, keyp, keylen, NULL);
+    } else if (searchType == DBC_PREFIX_SEARCH) {
+	rc = dbiCursorPrep(dbc, STMT_IDX_PREFIX,
+				"SELECT hnum, idx FROM '%q' "
+				"WHERE MATCH(key,?1,?2) "
 				"ORDER BY key",
-				dbi->dbi_file, keyp, keylen);
+				dbi->dbi_file);
+	if (!rc)
+	    rc = dbiCursorBindIdx(dbc, keyp, keylen, NULL);
+	if (!rc) {
+	    sqlite3_bind_int(dbc->stmt, 2, keylen);
+	    rc = dbiCursorResult(dbc);
+	}
     } else {
-	rc = dbiCursorPrep(dbc, "SELECT hnum, idx FROM '%q' WHERE key=?",
+	rc = dbiCursorPrep(dbc, STMT_IDX_BYKEY,
+			"SELECT hnum, idx FROM '%q' WHERE key=?",
 			dbi->dbi_file);
 	if (!rc)
 	    rc = dbiCursorBindIdx(dbc, keyp, keylen, NULL);
@@ -617,7 +844,8 @@ static rpmRC sqlite_idxdbIter(dbiIndex dbi, dbiCursor dbc, dbiIndexSet *set)
     rpmRC rc = RPMRC_OK;
 
     if (dbc->stmt == NULL) {
-	rc = dbiCursorPrep(dbc, "SELECT DISTINCT key FROM '%q' ORDER BY key",
+	rc = dbiCursorPrep(dbc, STMT_IDX_ITER,
+				"SELECT DISTINCT key FROM '%q' ORDER BY key",
 				dbi->dbi_file);
 	if (set)
 	    dbc->subc = dbiCursorInit(dbi, 0);
@@ -662,29 +890,83 @@ static rpmRC sqlite_idxdbGet(dbiIndex dbi, dbiCursor dbc, const char *keyp, size
     return rc;
 }
 
+/* Collect an index row for sqlite_idxdbPutRows(), keys get copied */
 static rpmRC sqlite_idxdbPutOne(dbiIndex dbi, dbiCursor dbc, const char *keyp, size_t keylen, dbiIndexItem rec)
 {
-    rpmRC rc = dbiCursorPrep(dbc, "INSERT INTO '%q' VALUES(?, ?, ?)",
-			dbi->dbi_file);
+    struct stmtCache_s *cache = (struct stmtCache_s *)dbi->dbi_cache;
+    idxRow_s row = { cache->keys.size(), keylen, rec->hdrNum, rec->tagNum };
 
-    if (!rc)
-	rc = dbiCursorBindIdx(dbc, keyp, keylen, rec);
+    cache->keys.append(keyp, keylen);
+    cache->rows.push_back(row);
+    return RPMRC_OK;
+}
 
-    if (!rc)
-	while (sqlite3_step(dbc->stmt) == SQLITE_ROW) {};
+/* Insert the collected index rows, IDX_BATCH rows per statement */
+static rpmRC sqlite_idxdbPutRows(dbiIndex dbi)
+{
+    struct stmtCache_s *cache = (struct stmtCache_s *)dbi->dbi_cache;
+    dbiCursor dbc = dbiCursorInit(dbi, DBC_WRITE);
+    size_t nrows = cache->rows.size();
+    rpmRC rc = RPMRC_OK;
 
-    return dbiCursorResult(dbc);
+    for (size_t i = 0; !rc && i < nrows; i += IDX_BATCH) {
+	size_t n = (nrows - i < IDX_BATCH) ? nrows - i : IDX_BATCH;
+	std::string values = "(?, ?, ?)";
+	for (size_t j = 1; j < n; j++)
+	    values += ", (?, ?, ?)";
+
+	/* Only full batches have a fixed shape worth caching */
+	if (n == IDX_BATCH) {
+	    rc = dbiCursorPrep(dbc, STMT_IDX_INSERT,
+				"INSERT INTO '%q' VALUES %s",
+				dbi->dbi_file, values.c_str());
+	} else {
+	    dbiCursorRelease(dbc);
+	    rc = dbiCursorPrep(dbc, STMT_NONE, "INSERT INTO '%q' VALUES %s",
+				dbi->dbi_file, values.c_str());
+	}
+
+	for (size_t j = 0; !rc && j < n; j++) {
+	    const idxRow_s & row = cache->rows[i + j];
+	    const char *key = cache->keys.data() + row.keyoff;
+	    int col = j * 3 + 1;
+	    if (dbc->ctype == SQLITE_TEXT)
+		sqlite3_bind_text(dbc->stmt, col, key, row.keylen, NULL);
+	    else
+		sqlite3_bind_blob(dbc->stmt, col, key, row.keylen, NULL);
+	    sqlite3_bind_int(dbc->stmt, col + 1, row.hnum);
+	    sqlite3_bind_int(dbc->stmt, col + 2, row.tnum);
+	    rc = dbiCursorResult(dbc);
+	}
+
+	if (!rc) {
+	    while (sqlite3_step(dbc->stmt) == SQLITE_ROW) {};
+	    rc = dbiCursorResult(dbc);
+	}
+    }
+
+    dbiCursorFree(dbi, dbc);
+    return rc;
 }
 
-static rpmRC sqlite_idxdbPut(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
+static rpmRC sqlite_idxdbPut(dbiIndex dbi, unsigned int hdrNum, const struct idxKeys_s & keys)
 {
-    return tag2index(dbi, rpmtag, hdrNum, h, sqlite_idxdbPutOne);
+    struct stmtCache_s *cache = (struct stmtCache_s *)dbi->dbi_cache;
+    rpmRC rc = keys2index(dbi, hdrNum, keys, sqlite_idxdbPutOne);
+
+    if (!rc && !cache->rows.empty())
+	rc = sqlite_idxdbPutRows(dbi);
+
+    cache->keys.clear();
+    cache->rows.clear();
+    return rc;
 }
 
 static rpmRC sqlite_idxdbDel(dbiIndex dbi, rpmTagVal rpmtag, unsigned int hdrNum, Header h)
 {
     dbiCursor dbc = dbiCursorInit(dbi, DBC_WRITE);
-    rpmRC rc = dbiCursorPrep(dbc, "DELETE FROM '%q' WHERE hnum=?", dbi->dbi_file);
+    rpmRC rc = dbiCursorPrep(dbc, STMT_IDX_DEL, "DELETE FROM '%q' WHERE hnum=?",
+			    dbi->dbi_file);
 
     if (!rc)
 	rc = dbiCursorBindPkg(dbc, hdrNum, NULL, 0);
@@ -719,6 +1001,8 @@ struct rpmdbOps_s sqlite_dbops = {
     .verify	= sqlite_Verify,
     .setFSync	= sqlite_SetFSync,
     .ctrl	= sqlite_Ctrl,
+    .generation	= sqlite_Generation,
+    .peekGeneration	= sqlite_PeekGeneration,
 
     .cursorInit	= sqlite_CursorInit,
     .cursorFree	= sqlite_CursorFree,
@@ -727,6 +1011,7 @@ struct rpmdbOps_s sqlite_dbops = {
     .pkgdbPut	= sqlite_pkgdbPut,
     .pkgdbDel	= sqlite_pkgdbDel,
     .pkgdbKey	= sqlite_pkgdbKey,
+    .pkgdbGetMany	= sqlite_pkgdbGetMany,
 
     .idxdbGet	= sqlite_idxdbGet,
     .idxdbPut	= sqlite_idxdbPut,
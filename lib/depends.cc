@@ -4,9 +4,13 @@
 
 #include "system.h"
 
+#include <fcntl.h>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <rpm/rpmlib.h>		/* rpmVersionCompare, rpmlib provides */
 #include <rpm/rpmtag.h>
@@ -14,12 +18,14 @@
 #include <rpm/rpmdb.h>
 #include <rpm/rpmds.h>
 #include <rpm/rpmfi.h>
+#include <rpm/rpmkeyring.h>
 #include <rpm/rpmstring.h>
 
 #include "rpmts_internal.hh"
 #include "rpmte_internal.hh"
 #include "rpmds_internal.hh"
 #include "rpmfi_internal.hh" /* rpmfiles stuff for now */
+#include "header_internal.hh"
 #include "misc.hh"
 
 #include "backend/dbiset.hh"
@@ -34,7 +40,11 @@ const char * const rpmEVR = VERSION;
 
 const int rpmFLAGS = RPMSENSE_EQUAL;
 
-using depCache = std::unordered_map<std::string,int>;
+/* rpmdb lookup results, shared between the rpmtsCheck() threads */
+struct depCache {
+    std::unordered_map<std::string,int> results;
+    std::shared_mutex mutex;
+};
 using depexistsHash = std::unordered_set<rpmsid>;
 using filedepHash = std::unordered_map<rpmsid,rpmsid>;
 
@@ -115,11 +125,21 @@ static int removePackage(rpmts ts, Header h, rpmte depends)
     return 0;
 }
 
+/* Private database handle of a rpmtsCheck() thread, if any */
+static __thread rpmdb checkdb = NULL;
+
 /* Return rpmdb iterator with removals optionally pruned out */
 rpmdbMatchIterator rpmtsPrunedIterator(rpmts ts, rpmDbiTagVal tag,
 					      const char * key, int prune)
 {
-    rpmdbMatchIterator mi = rpmtsInitIterator(ts, tag, key, 0);
+    rpmdbMatchIterator mi;
+    if (checkdb) {
+	mi = rpmdbInitIterator(checkdb, tag, key, 0);
+	if (mi && !(rpmtsVSFlags(ts) & RPMVSF_NOHDRCHK))
+	    rpmdbSetHdrChk(mi, ts, headerCheck);
+    } else {
+	mi = rpmtsInitIterator(ts, tag, key, 0);
+    }
     if (prune) {
 	tsMembers tsmem = rpmtsMembers(ts);
 	rpmdbPruneIterator(mi, tsmem->removedPackages);
@@ -490,6 +510,22 @@ int rpmtsAddEraseElement(rpmts ts, Header h, int dboffset)
     return removePackage(ts, h, NULL);
 }
 
+static int depCacheGet(depCache *dcache, const char *dnevr, int *rc)
+{
+    std::shared_lock<std::shared_mutex> lock(dcache->mutex);
+    auto ret = dcache->results.find(dnevr);
+    if (ret == dcache->results.end())
+	return 0;
+    *rc = ret->second;
+    return 1;
+}
+
+static void depCachePut(depCache *dcache, const char *dnevr, int rc)
+{
+    std::unique_lock<std::shared_mutex> lock(dcache->mutex);
+    dcache->results.insert({dnevr, rc});
+}
+
 /* Cached rpmdb provide lookup, returns 0 if satisfied, 1 otherwise */
 static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *matches)
 {
@@ -503,13 +539,9 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
     int prune = (rpmdsFlags(dep) & (RPMSENSE_PRETRANS|RPMSENSE_PREUNTRANS)) ? 0 : 1;
 
     /* See if we already looked this up */
-    if (prune && !matches) {
-	auto ret = dcache->find(DNEVR);
-	if (ret != dcache->end()) {
-	    rc = ret->second;
-	    rpmdsNotify(dep, "(cached)", rc);
-	    return rc;
-	}
+    if (prune && !matches && depCacheGet(dcache, DNEVR, &rc)) {
+	rpmdsNotify(dep, "(cached)", rc);
+	return rc;
     }
 
     if (matches)
@@ -581,7 +613,7 @@ static int rpmdbProvides(rpmts ts, depCache *dcache, rpmds dep, dbiIndexSet *mat
     /* Cache the relatively expensive rpmdb lookup results */
     /* Caching the oddball non-pruned case would mess up other results */
     if (prune && !matches)
-	dcache->insert({DNEVR, rc});
+	depCachePut(dcache, DNEVR, rc);
     return rc;
 }
 
@@ -967,51 +999,14 @@ int rpmtsCheck(rpmts ts)
     depexistsHash *reqnothash = NULL;
     fingerPrintCache fpc = NULL;
     rpmdb rdb = NULL;
-    
-    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_CHECK), 0);
-
-    /* Do lazy, readonly, open of rpm database. */
-    rdb = rpmtsGetRdb(ts);
-    if (rdb == NULL && rpmtsGetDBMode(ts) != -1) {
-	if ((rc = rpmtsOpenDB(ts, rpmtsGetDBMode(ts))) != 0)
-	    goto exit;
-	rdb = rpmtsGetRdb(ts);
-	closeatexit = 1;
-    }
-
-    if (rdb)
-	rpmdbCtrl(rdb, RPMDB_CTRL_LOCK_RO);
-
-    /* build hashes of all confilict sdependencies */
-    confilehash = new filedepHash {};
-    connothash = new depexistsHash {};
-    connotfilehash = new filedepHash {};
-    addIndexToDepHashes(ts, RPMDBI_CONFLICTNAME, NULL, confilehash, connothash, connotfilehash);
-    if (confilehash->empty())
-	confilehash = filedepHashFree(confilehash);
-    if (connothash->empty())
-	connothash = depexistsHashFree(connothash);
-    if (connotfilehash->empty())
-	connotfilehash = filedepHashFree(connotfilehash);
-
-    /* build hashes of all requires dependencies */
-    reqfilehash = new filedepHash {};
-    reqnothash = new depexistsHash {};
-    reqnotfilehash = new filedepHash {};
-    addIndexToDepHashes(ts, RPMDBI_REQUIRENAME, NULL, reqfilehash, reqnothash, reqnotfilehash);
-    if (reqfilehash->empty())
-	reqfilehash = filedepHashFree(reqfilehash);
-    if (reqnothash->empty())
-	reqnothash = depexistsHashFree(reqnothash);
-    if (reqnotfilehash->empty())
-	reqnotfilehash = filedepHashFree(reqnotfilehash);
+    std::vector<rpmdb> dbs;
+    int nthreads;
 
     /*
      * Look at all of the added packages and make sure their dependencies
      * are satisfied.
      */
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL) {
+    auto checkAdded = [&](rpmte p, fingerPrintCache *fpcp) {
 	rpmds provides = rpmdsInit(rpmteDS(p, RPMTAG_PROVIDENAME));
 
 	rpmlog(RPMLOG_DEBUG, "========== +++ %s %s/%s 0x%x\n",
@@ -1026,7 +1021,7 @@ int rpmtsCheck(rpmts ts)
 
 	/* Skip obsoletion and provides checks for source packages (ie build) */
 	if (rpmteIsSource(p))
-	    continue;
+	    return;
 
 	/* Check provides against conflicts in installed packages. */
 	while (rpmdsNext(provides) >= 0) {
@@ -1044,21 +1039,19 @@ int rpmtsCheck(rpmts ts)
 	    rpmfi fi = rpmfilesIter(files, RPMFI_ITER_FWD);
 	    while (rpmfiNext(fi) >= 0) {
 		if (confilehash)
-		    checkInstFileDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, fi, 0, confilehash, &fpc);
+		    checkInstFileDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, fi, 0, confilehash, fpcp);
 		if (reqnotfilehash)
-		    checkInstFileDeps(ts, dcache, p, RPMTAG_REQUIRENAME, fi, 1, reqnotfilehash, &fpc);
+		    checkInstFileDeps(ts, dcache, p, RPMTAG_REQUIRENAME, fi, 1, reqnotfilehash, fpcp);
 	    }
 	    rpmfiFree(fi);
 	    rpmfilesFree(files);
 	}
-    }
-    rpmtsiFree(pi);
+    };
 
     /*
      * Look at the removed packages and make sure they aren't critical.
      */
-    pi = rpmtsiInit(ts);
-    while ((p = rpmtsiNext(pi, TR_REMOVED)) != NULL) {
+    auto checkRemoved = [&](rpmte p, fingerPrintCache *fpcp) {
 	rpmds provides = rpmdsInit(rpmteDS(p, RPMTAG_PROVIDENAME));
 
 	rpmlog(RPMLOG_DEBUG, "========== --- %s %s/%s 0x%x\n",
@@ -1077,21 +1070,151 @@ int rpmtsCheck(rpmts ts)
 	    while (rpmfiNext(fi) >= 0) {
 		if (RPMFILE_IS_INSTALLED(rpmfiFState(fi))) {
 		    if (reqfilehash)
-			checkInstFileDeps(ts, dcache, p, RPMTAG_REQUIRENAME, fi, 0, reqfilehash, &fpc);
+			checkInstFileDeps(ts, dcache, p, RPMTAG_REQUIRENAME, fi, 0, reqfilehash, fpcp);
 		    if (connotfilehash)
-			checkInstFileDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, fi, 1, connotfilehash, &fpc);
+			checkInstFileDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, fi, 1, connotfilehash, fpcp);
 		}
 	    }
 	    rpmfiFree(fi);
 	    rpmfilesFree(files);
 	}
+    };
+
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_CHECK), 0);
+
+    /* Do lazy, readonly, open of rpm database. */
+    rdb = rpmtsGetRdb(ts);
+    if (rdb == NULL && rpmtsGetDBMode(ts) != -1) {
+	if ((rc = rpmtsOpenDB(ts, rpmtsGetDBMode(ts))) != 0)
+	    goto exit;
+	rdb = rpmtsGetRdb(ts);
+	closeatexit = 1;
+    }
+
+    if (rdb)
+	rpmdbCtrl(rdb, RPMDB_CTRL_LOCK_RO);
+
+    /* build hashes of all confilict sdependencies */
+    confilehash = new filedepHash {};
+    connothash = new depexistsHash {};
+    connotfilehash = new filedepHash {};
+    addIndexToDepHashes(ts, RPMDBI_CONFLICTNAME, NULL, confilehash, connothash, connotfilehash);
+    if (confilehash->empty())
+	confilehash = filedepHashFree(confilehash);
+    if (connothash->empty())
+	connothash = depexistsHashFree(connothash);
+    if (connotfilehash->empty())
+	connotfilehash = filedepHashFree(connotfilehash);
+
+    /* build hashes of all requires dependencies */
+    reqfilehash = new filedepHash {};
+    reqnothash = new depexistsHash {};
+    reqnotfilehash = new filedepHash {};
+    addIndexToDepHashes(ts, RPMDBI_REQUIRENAME, NULL, reqfilehash, reqnothash, reqnotfilehash);
+    if (reqfilehash->empty())
+	reqfilehash = filedepHashFree(reqfilehash);
+    if (reqnothash->empty())
+	reqnothash = depexistsHashFree(reqnothash);
+    if (reqnotfilehash->empty())
+	reqnotfilehash = filedepHashFree(reqnotfilehash);
+
+    /*
+     * The elements can be checked independently of each other as the
+     * problems are recorded in the elements themselves, and collected in
+     * transaction order by rpmtsProblems(). Solve callbacks can change the
+     * transaction set behind our back, those always run serially.
+     */
+    nthreads = (rdb && ts->solve == NULL) ?
+		rpmExpandThreads("_depcheck_threads") : 1;
+
+    if (nthreads > 1) {
+	tsMembers tsmem = rpmtsMembers(ts);
+
+	/* Set up everything the lookups would otherwise create on demand */
+	if (tsmem->rpmlib == NULL)
+	    rpmdsRpmlibPool(rpmtsPool(ts), &(tsmem->rpmlib), NULL);
+	rpmalMakeIndex(tsmem->addedPackages);
+	rpmKeyringFree(rpmtsGetKeyring(ts, 1));
+
+	/* Database handles aren't shareable, open one for each extra thread */
+	for (int i = 1; i < nthreads; i++) {
+	    rpmdb db = NULL;
+	    if (rpmdbOpen(rpmtsRootDir(ts), &db, O_RDONLY, 0644))
+		break;
+	    rpmdbCtrl(db, RPMDB_CTRL_LOCK_RO);
+	    dbs.push_back(db);
+	}
+	nthreads = dbs.size() + 1;
+    }
+
+    if (nthreads > 1) {
+	std::vector<rpmte> added, removed;
+	std::vector<rpmdb> unused = dbs;
+
+	pi = rpmtsiInit(ts);
+	while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL)
+	    added.push_back(p);
+	rpmtsiFree(pi);
+	pi = rpmtsiInit(ts);
+	while ((p = rpmtsiNext(pi, TR_REMOVED)) != NULL)
+	    removed.push_back(p);
+	rpmtsiFree(pi);
+
+	#pragma omp parallel num_threads(nthreads)
+	{
+	    fingerPrintCache tfpc = NULL;
+	    /* Digest statistics of ts can't be shared between threads */
+	    struct rpmop_s digestop = {};
+
+	    #pragma omp critical(depcheck_db)
+	    {
+		if (!unused.empty()) {
+		    checkdb = unused.back();
+		    unused.pop_back();
+		}
+	    }
+	    headerCheckSetStats(&digestop);
+
+	    #pragma omp for schedule(dynamic)
+	    for (size_t i = 0; i < added.size(); i++)
+		checkAdded(added[i], &tfpc);
+
+	    #pragma omp for schedule(dynamic)
+	    for (size_t i = 0; i < removed.size(); i++)
+		checkRemoved(removed[i], &tfpc);
+
+	    fpCacheFree(tfpc);
+	    checkdb = NULL;
+	    headerCheckSetStats(NULL);
+
+	    #pragma omp critical(depcheck_db)
+	    (void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST), &digestop);
+	}
+
+	for (rpmdb db : dbs) {
+	    for (int i = RPMDB_OP_DBGET; i < RPMDB_OP_INTERNAL_MAX; i++)
+		rpmswAdd(rpmdbOp(rdb, (rpmdbOpX) i), rpmdbOp(db, (rpmdbOpX) i));
+	}
+    } else {
+	pi = rpmtsiInit(ts);
+	while ((p = rpmtsiNext(pi, TR_ADDED)) != NULL)
+	    checkAdded(p, &fpc);
+	rpmtsiFree(pi);
+
+	pi = rpmtsiInit(ts);
+	while ((p = rpmtsiNext(pi, TR_REMOVED)) != NULL)
+	    checkRemoved(p, &fpc);
+	rpmtsiFree(pi);
     }
-    rpmtsiFree(pi);
 
     if (rdb)
 	rpmdbCtrl(rdb, RPMDB_CTRL_UNLOCK_RO);
 
 exit:
+    for (rpmdb db : dbs) {
+	rpmdbCtrl(db, RPMDB_CTRL_UNLOCK_RO);
+	rpmdbClose(db);
+    }
     filedepHashFree(confilehash);
     filedepHashFree(connotfilehash);
     depexistsHashFree(connothash);
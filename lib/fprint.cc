@@ -4,7 +4,10 @@
 
 #include "system.h"
 
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 #include <rpm/rpmfileutil.h>	/* for rpmCleanPath */
 #include <rpm/rpmstring.h>
@@ -94,15 +97,36 @@ struct fpEqual
 using rpmFpEntryHash = std::unordered_multimap<rpmsid,fprintCacheEntry_s>;
 using rpmFpHash = std::unordered_map<fingerPrint *,rpmffi_s,fpHash,fpEqual>;
 
+using wrlock = std::unique_lock<std::shared_mutex>;
+using rdlock = std::shared_lock<std::shared_mutex>;
+
+/* Number of directory cache shards, must be a power of two */
+#define FP_NSHARDS 16
+
+/**
+ * Directory cache shard. The directory cache is split by dirId so
+ * concurrent lookups only contend on the same shard, entries are never
+ * removed so pointers to them stay valid for the lifetime of the cache.
+ */
+struct fprintCacheShard_s {
+    rpmFpEntryHash ht;			/*!< hashed by dirName */
+    std::shared_mutex mutex;
+};
+
 /**
  * Finger print cache.
  */
 struct fprintCache_s {
-    rpmFpEntryHash ht;			/*!< hashed by dirName */
+    fprintCacheShard_s shards[FP_NSHARDS];	/*!< directory cache */
     rpmFpHash fp;			/*!< hashed by fingerprint */
     rpmstrPool pool;			/*!< string pool */
 };
 
+static fprintCacheShard_s & cacheShard(fingerPrintCache cache, rpmsid dirId)
+{
+    return cache->shards[sidHash(dirId) & (FP_NSHARDS - 1)];
+}
+
 fingerPrintCache fpCacheCreate(int sizeHint, rpmstrPool pool)
 {
     fingerPrintCache fpc = new fprintCache_s {};
@@ -128,12 +152,39 @@ fingerPrintCache fpCacheFree(fingerPrintCache cache)
 static const struct fprintCacheEntry_s * cacheContainsDirectory(
 			    fingerPrintCache cache, rpmsid dirId)
 {
-    auto entry = cache->ht.find(dirId);
-    if (entry != cache->ht.end())
+    fprintCacheShard_s & shard = cacheShard(cache, dirId);
+    rdlock lock(shard.mutex);
+    auto entry = shard.ht.find(dirId);
+    if (entry != shard.ht.end())
 	return &entry->second;
     return NULL;
 }
 
+/**
+ * Add directory name entry to cache, unless another thread beat us to it.
+ * @param cache		pointer to fingerprint cache
+ * @param dirId		string id of the directory
+ * @param sb		stat(2) info of the directory
+ * @return pointer to directory name entry
+ */
+static const struct fprintCacheEntry_s * cacheAddDirectory(
+			    fingerPrintCache cache, rpmsid dirId,
+			    const struct stat *sb)
+{
+    fprintCacheShard_s & shard = cacheShard(cache, dirId);
+    wrlock lock(shard.mutex);
+    auto entry = shard.ht.find(dirId);
+    if (entry == shard.ht.end()) {
+	struct fprintCacheEntry_s newEntry = {
+	    .dirId = dirId,
+	    .dev = sb->st_dev,
+	    .ino = sb->st_ino,
+	};
+	entry = shard.ht.insert({dirId, newEntry});
+    }
+    return &entry->second;
+}
+
 static char * canonDir(rpmstrPool pool, rpmsid dirNameId)
 {
     const char * dirName = rpmstrPoolStr(pool, dirNameId);
@@ -187,13 +238,7 @@ static int doLookupId(fingerPrintCache cache,
 	if (cacheHit != NULL) {
 	    fp->entry = cacheHit;
 	} else if (!stat(rpmstrPoolStr(cache->pool, fpId), &sb)) {
-	    struct fprintCacheEntry_s newEntry = {
-		.dirId = fpId,
-		.dev = sb.st_dev,
-		.ino = sb.st_ino,
-	    };
-	    auto ret = cache->ht.insert({fpId, newEntry});
-	    fp->entry = &ret->second;
+	    fp->entry = cacheAddDirectory(cache, fpId, &sb);
 	}
 
         if (fp->entry) {
@@ -422,16 +467,32 @@ void fpCachePopulate(fingerPrintCache fpc, rpmts ts, int fileCount)
     int havesymlinks = 0;
 
     rpmFpHash symlinks;
+    std::vector<std::pair<rpmte,rpmfiles>> elems;
+    int nthreads = rpmExpandThreads("_fprint_threads");
 
-    /* populate the fingerprints of all packages in the transaction */
-    /* also create a hash of all symlinks in the new packages */
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, 0)) != NULL) {
-	if ((fi = rpmteFiles(p)) == NULL)
-	    continue;
+	if ((fi = rpmteFiles(p)) != NULL)
+	    elems.push_back({p, fi});
+    }
+    rpmtsiFree(pi);
 
+    /*
+     * Populate the fingerprints of all packages in the transaction.
+     * Lookups are independent of each other and the directory cache
+     * handles concurrent updates, so this can be spread over threads.
+     */
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) if(nthreads > 1)
+    for (size_t j = 0; j < elems.size(); j++)
+	rpmfilesFpLookup(elems[j].second, fpc);
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+
+    /* create a hash of all symlinks in the new packages */
+    for (auto & elem : elems) {
+	p = elem.first;
+	fi = elem.second;
 	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
-	rpmfilesFpLookup(fi, fpc);
 	fs = rpmteGetFileStates(p);
 	fc = rpmfsFC(fs);
 
@@ -456,7 +517,6 @@ void fpCachePopulate(fingerPrintCache fpc, rpmts ts, int fileCount)
 	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fc);
 	rpmfilesFree(fi);
     }
-    rpmtsiFree(pi);
 
     /* ===============================================
      * Create the fingerprint -> (p, fileno) hash table
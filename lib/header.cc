@@ -13,8 +13,10 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <atomic>
+#include <mutex>
 #include <rpm/rpmtypes.h>
 #include <rpm/rpmstring.h>
+#include <rpm/rpmlog.h>
 #include "header_internal.hh"
 #include "misc.hh"			/* tag function proto */
 
@@ -74,6 +76,7 @@ enum headerFlags_e {
     HEADERFLAG_ALLOCATED = (1 << 1), /*!< Is 1st header region allocated? */
     HEADERFLAG_LEGACY    = (1 << 2), /*!< Header came from legacy source? */
     HEADERFLAG_DEBUG     = (1 << 3), /*!< Debug this header? */
+    HEADERFLAG_LAZY      = (1 << 4), /*!< Entries decoded on demand? */
 };
 
 typedef rpmFlags headerFlags;
@@ -99,6 +102,39 @@ struct indexEntry_s {
     uint32_t rdlen;		/*!< No. bytes of data in region. */
 };
 
+enum lazyState_e {
+    LAZY_NEW	= 0,	/*!< Entry not decoded yet */
+    LAZY_OK	= 1,	/*!< Entry data points to the blob */
+    LAZY_ALLOC	= 2,	/*!< Entry data is a byte-swapped copy */
+    LAZY_BAD	= 3,	/*!< Entry failed to decode */
+};
+
+#define	LAZY_DELETED	0x80000000	/*!< Tag hash slot of a replaced tag */
+
+/** \ingroup header
+ * On-demand decoding state of a header imported with HEADERIMPORT_LAZY.
+ * The blob is kept in on-disk (big-endian) form, entries are looked up
+ * through a tag hash and decoded individually on first access. Anything
+ * needing the whole index first converts the header to the regular form,
+ * see headerUnlazy().
+ *
+ * Until the conversion, h->index is an empty placeholder that gets
+ * replaced. Every path reading the index must therefore go through
+ * headerUnlazy() (or getEntry()) first, which take the mutex. After
+ * the conversion the index only changes on modification, as usual.
+ */
+typedef struct headerLazy_s * headerLazy;
+struct headerLazy_s {
+    struct hdrblob_s blob;	/*!< Blob the header was imported from */
+    uint32_t ril;		/*!< No. of entries in the region */
+    int fast;			/*!< Use offsets for data sizes if possible */
+    uint32_t nslots;		/*!< Size of tag hash (power of 2) */
+    uint32_t *slots;		/*!< Tag hash of entry number + 1, 0 if empty */
+    indexEntry entries;		/*!< Decoded entries, by entry number */
+    uint8_t *state;		/*!< Entry decoding states */
+    std::mutex mutex;		/*!< Serialize decoding */
+};
+
 /** \ingroup header
  * The Header data structure.
  */
@@ -110,9 +146,13 @@ struct headerToken_s {
     unsigned int instance;	/*!< Rpmdb instance */
     headerFlags flags;
     int sorted;			/*!< Current sort method */
+    headerLazy lazy;		/*!< On-demand decoding state (or NULL) */
     std::atomic_int nrefs;			/*!< Reference count. */
 };
 
+static headerLazy lazyFree(headerLazy lz);
+static void headerUnlazy(Header h);
+
 /** \ingroup header
  * Maximum no. of bytes permitted in a header.
  */
@@ -245,6 +285,15 @@ Header headerFree(Header h)
     if (h == NULL || --h->nrefs > 0)
 	return NULL;
 
+    if (h->lazy) {
+	headerLazy lz = h->lazy;
+	for (uint32_t i = 0; i < lz->blob.il; i++) {
+	    if (lz->state[i] == LAZY_ALLOC)
+		free(lz->entries[i].data);
+	}
+	h->lazy = lazyFree(lz);
+    }
+
     if (h->index) {
 	indexEntry entry = h->index;
 	int i;
@@ -363,6 +412,7 @@ static int indexCmp(const void * avp, const void * bvp)
 
 static void headerSort(Header h)
 {
+    headerUnlazy(h);
     if (!h->sorted) {
 	qsort(h->index, h->indexUsed, sizeof(*h->index), indexCmp);
 	h->sorted = 1;
@@ -859,6 +909,7 @@ void * headerExport(Header h, unsigned int *bsize)
     void *blob = NULL;
 
     if (h) {
+	headerUnlazy(h);
 	blob = doExport(h->index, h->indexUsed, h->flags, bsize);
     }
 
@@ -902,10 +953,13 @@ indexEntry findEntry(Header h, rpmTagVal tag, uint32_t type)
 
 int headerDel(Header h, rpmTagVal tag)
 {
-    indexEntry last = h->index + h->indexUsed;
-    indexEntry entry, first;
+    indexEntry last, entry, first;
     int ne;
 
+    /* Converting a lazy header replaces the index */
+    headerUnlazy(h);
+    last = h->index + h->indexUsed;
+
     entry = findEntry(h, tag, RPM_NULL_TYPE);
     if (!entry) return 1;
 
@@ -1044,6 +1098,287 @@ errxit:
     return RPMRC_FAIL;
 }
 
+static inline uint32_t lazyHash(uint32_t tag, uint32_t nslots)
+{
+    return (tag * 2654435761U) & (nslots - 1);
+}
+
+/* Return tag hash slot of tag: either an empty one or the one with tag */
+static uint32_t *lazySlot(headerLazy lz, uint32_t tag)
+{
+    uint32_t i = lazyHash(tag, lz->nslots);
+    while (lz->slots[i]) {
+	uint32_t ix = (lz->slots[i] & ~LAZY_DELETED) - 1;
+	if (ntohl(lz->blob.pe[ix].tag) == tag)
+	    break;
+	i = (i + 1) & (lz->nslots - 1);
+    }
+    return &lz->slots[i];
+}
+
+static headerLazy lazyFree(headerLazy lz)
+{
+    if (lz) {
+	free(lz->slots);
+	free(lz->entries);
+	free(lz->state);
+	delete lz;
+    }
+    return NULL;
+}
+
+/*
+ * Fill in the info, data and length of an entry of a lazy header from
+ * the blob, with the same sanity checks as regionSwab() does. The data
+ * is left in network byte order.
+ */
+static int lazyEntryInit(headerLazy lz, uint32_t ix, indexEntry entry)
+{
+    entryInfo pe = lz->blob.pe + ix;
+    uint32_t segend = (ix < lz->ril) ? lz->ril : lz->blob.il;
+
+    ei2h(pe, &entry->info);
+
+    if (hdrchkType(entry->info.type))
+	return -1;
+    if (hdrchkData(entry->info.count))
+	return -1;
+    if (hdrchkData(entry->info.offset))
+	return -1;
+    if (hdrchkAlign(entry->info.type, entry->info.offset))
+	return -1;
+
+    entry->data = lz->blob.dataStart + entry->info.offset;
+    if ((unsigned char *)entry->data >= lz->blob.dataEnd)
+	return -1;
+
+    /* The offset optimization is only relevant for string types */
+    if (lz->fast && ix + 1 < segend && typeSizes[entry->info.type] == -1) {
+	entry->length = ntohl(pe[1].offset) - entry->info.offset;
+    } else {
+	if (dataLength(entry->info.type, entry->data, entry->info.count,
+			1, lz->blob.dataEnd, &entry->length))
+	    return -1;
+    }
+    if (hdrchkData(entry->length))
+	return -1;
+
+    return 0;
+}
+
+/*
+ * Set up a header for on-demand decoding of the blob. Only the tag hash
+ * is built here, following the same rules as hdrblobImport() does for
+ * dribble entries. Every entry gets the same sanity checks as on a
+ * regular import, so a damaged blob is caught here and not on first use.
+ * Returns RPMRC_NOTFOUND if the blob needs a regular import, which then
+ * also reports what is wrong with a damaged one.
+ */
+static rpmRC hdrblobImportLazy(hdrblob blob, int fast, Header *hdrp)
+{
+    headerLazy lz = NULL;
+    struct entryInfo_s info;
+    uint32_t ril;
+
+    /* Legacy v3 headers need a full conversion */
+    if (!(ntohl(blob->pe->tag) < RPMTAG_HEADERI18NTABLE))
+	return RPMRC_NOTFOUND;
+
+    ei2h(blob->pe, &info);
+    ril = (info.offset != 0) ? blob->ril : blob->il;
+    if (ril < 1 || ril > blob->il)
+	return RPMRC_NOTFOUND;
+
+    lz = new headerLazy_s {};
+    lz->blob = *blob;
+    lz->ril = ril;
+    lz->fast = fast;
+    lz->nslots = 16;
+    while (lz->nslots < 2 * blob->il)
+	lz->nslots <<= 1;
+    lz->slots = (uint32_t *)xcalloc(lz->nslots, sizeof(*lz->slots));
+    lz->entries = (indexEntry)xcalloc(blob->il, sizeof(*lz->entries));
+    lz->state = (uint8_t *)xcalloc(blob->il, sizeof(*lz->state));
+
+    for (uint32_t i = 0; i < blob->il; i++) {
+	struct indexEntry_s entry;
+	if (lazyEntryInit(lz, i, &entry))
+	    goto notfound;
+    }
+
+    for (uint32_t i = 1; i < blob->il; i++) {
+	uint32_t tag = ntohl(blob->pe[i].tag);
+	uint32_t *slot = lazySlot(lz, tag);
+
+	if (*slot) {
+	    uint32_t ix = (*slot & ~LAZY_DELETED) - 1;
+	    /* Duplicates within region or dribbles take the slow path */
+	    if ((i < ril) == (ix < ril))
+		goto notfound;
+	}
+	/* Dribble entries replace duplicate region entries */
+	*slot = i + 1;
+
+	if (i >= ril && tag == RPMTAG_BASENAMES) {
+	    slot = lazySlot(lz, RPMTAG_OLDFILENAMES);
+	    if (*slot)
+		*slot |= LAZY_DELETED;
+	}
+    }
+
+    *hdrp = headerCreate(blob->ei, 0);
+    (*hdrp)->lazy = lz;
+    (*hdrp)->flags |= (HEADERFLAG_ALLOCATED | HEADERFLAG_LAZY);
+
+    /* We own the memory now, avoid double-frees */
+    blob->ei = NULL;
+
+    return RPMRC_OK;
+
+notfound:
+    lazyFree(lz);
+    return RPMRC_NOTFOUND;
+}
+
+/* Decode a single entry of a lazy header, like regionSwab() does */
+static indexEntry lazyDecode(headerLazy lz, uint32_t ix)
+{
+    indexEntry entry = lz->entries + ix;
+    uint32_t ril = lz->ril;
+    int32_t rid = -(ril * sizeof(struct entryInfo_s));
+
+    if (lz->state[ix] != LAZY_NEW)
+	goto exit;
+
+    lz->state[ix] = LAZY_BAD;
+    if (lazyEntryInit(lz, ix, entry))
+	goto exit;
+
+    entry->info.offset = (ix < ril) ? rid : rid + 1;
+    entry->rdlen = 0;
+    lz->state[ix] = LAZY_OK;
+
+    /* Leave the blob alone, swap integers in a copy */
+    switch (entry->info.type) {
+    case RPM_INT64_TYPE:
+    {   uint64_t * it = (uint64_t *)memcpy(xmalloc(entry->length),
+					    entry->data, entry->length);
+	entry->data = it;
+	for (uint32_t c = entry->info.count; c > 0; c--, it++)
+	    *it = htonll(*it);
+	lz->state[ix] = LAZY_ALLOC;
+    }   break;
+    case RPM_INT32_TYPE:
+    {   uint32_t * it = (uint32_t *)memcpy(xmalloc(entry->length),
+					    entry->data, entry->length);
+	entry->data = it;
+	for (uint32_t c = entry->info.count; c > 0; c--, it++)
+	    *it = htonl(*it);
+	lz->state[ix] = LAZY_ALLOC;
+    }   break;
+    case RPM_INT16_TYPE:
+    {   uint16_t * it = (uint16_t *)memcpy(xmalloc(entry->length),
+					    entry->data, entry->length);
+	entry->data = it;
+	for (uint32_t c = entry->info.count; c > 0; c--, it++)
+	    *it = htons(*it);
+	lz->state[ix] = LAZY_ALLOC;
+    }   break;
+    }
+
+exit:
+    return (lz->state[ix] == LAZY_BAD) ? NULL : entry;
+}
+
+/*
+ * Look up an entry of a lazy header through the tag hash, decoding it
+ * if necessary. Returns -1 if the header needs the regular lookup.
+ * Called with the lazy mutex held.
+ */
+static int lazyFindEntry(Header h, rpmTagVal tag, uint32_t type,
+			indexEntry *entryp)
+{
+    headerLazy lz = h->lazy;
+    indexEntry entry = NULL;
+
+    /* Regions are only available from the full index */
+    if (tag >= RPMTAG_HEADERIMAGE && tag < RPMTAG_HEADERREGIONS)
+	return -1;
+
+    uint32_t *slot = lazySlot(lz, tag);
+    if (*slot && !(*slot & LAZY_DELETED))
+	entry = lazyDecode(lz, *slot - 1);
+
+    if (entry && type != RPM_NULL_TYPE && entry->info.type != type)
+	entry = NULL;
+
+    *entryp = entry;
+    return 0;
+}
+
+/*
+ * Convert a lazy header to the regular form. Entries decoded so far stay
+ * around until the header is freed as their data may still be in use.
+ * Called with the lazy mutex held.
+ */
+static void lazyConvert(Header h)
+{
+    Header nh = NULL;
+    char *msg = NULL;
+
+    if (!(h->flags & HEADERFLAG_LAZY))
+	return;
+
+    struct hdrblob_s blob = h->lazy->blob;
+    h->flags &= ~HEADERFLAG_LAZY;
+
+    if (hdrblobImport(&blob, h->lazy->fast, &nh, &msg) == RPMRC_OK) {
+	/* Take over the index, the blob is ours already */
+	free(h->index);
+	h->index = nh->index;
+	h->indexUsed = nh->indexUsed;
+	h->indexAlloced = nh->indexAlloced;
+	h->sorted = nh->sorted;
+	h->flags |= nh->flags;
+	nh->index = NULL;
+	nh->blob = NULL;
+	delete nh;
+    } else {
+	/* Checked on import already, so this shouldn't happen */
+	rpmlog(RPMLOG_ERR, _("damaged header: %s\n"), msg ? msg : "");
+    }
+    free(msg);
+}
+
+static void headerUnlazy(Header h)
+{
+    if (h && h->lazy) {
+	std::lock_guard<std::mutex> lock(h->lazy->mutex);
+	lazyConvert(h);
+    }
+}
+
+/**
+ * Find matching (tag,type) entry in header for reading.
+ * @param h		header
+ * @param tag		entry tag
+ * @param type		entry type
+ * @return 		header entry
+ */
+static indexEntry getEntry(Header h, rpmTagVal tag, uint32_t type)
+{
+    if (h && h->lazy) {
+	std::lock_guard<std::mutex> lock(h->lazy->mutex);
+	if (h->flags & HEADERFLAG_LAZY) {
+	    indexEntry entry = NULL;
+	    if (lazyFindEntry(h, tag, type, &entry) == 0)
+		return entry;
+	    lazyConvert(h);
+	}
+    }
+    return findEntry(h, tag, type);
+}
+
 Header headerReload(Header h, rpmTagVal tag)
 {
     Header nh;
@@ -1103,7 +1438,7 @@ exit:
 int headerIsEntry(Header h, rpmTagVal tag)
 {
    		/* FIX: h modified by sort. */
-    return (findEntry(h, tag, RPM_NULL_TYPE) ? 1 : 0);
+    return (getEntry(h, tag, RPM_NULL_TYPE) ? 1 : 0);
    	
 }
 
@@ -1113,7 +1448,7 @@ int headerIsEntry(Header h, rpmTagVal tag)
  */
 int headerIsSourceHeuristic(Header h)
 {
-    indexEntry entry = findEntry(h, RPMTAG_DIRNAMES, RPM_STRING_ARRAY_TYPE);
+    indexEntry entry = getEntry(h, RPMTAG_DIRNAMES, RPM_STRING_ARRAY_TYPE);
     return entry && entry->info.count == 1 && entry->data && !*(const char *)entry->data;
 }
 
@@ -1325,7 +1660,7 @@ static int copyI18NEntry(Header h, indexEntry entry, rpmtd td,
 	(lang = getenv("LANG")) == NULL)
 	    goto exit;
     
-    if ((table = findEntry(h, RPMTAG_HEADERI18NTABLE, RPM_STRING_ARRAY_TYPE)) == NULL)
+    if ((table = getEntry(h, RPMTAG_HEADERI18NTABLE, RPM_STRING_ARRAY_TYPE)) == NULL)
 	goto exit;
 
     for (l = lang; *l != '\0'; l = le) {
@@ -1382,7 +1717,7 @@ static int intGetTdEntry(Header h, rpmtd td, headerGetFlags flags)
 
     /* First find the tag */
     /* FIX: h modified by sort. */
-    entry = findEntry(h, td->tag, RPM_NULL_TYPE);
+    entry = getEntry(h, td->tag, RPM_NULL_TYPE);
     if (entry == NULL) {
 	/* Td is zeroed above, just return... */
 	return 0;
@@ -1495,6 +1830,8 @@ static int intAddEntry(Header h, rpmtd td)
     if (data == NULL)
 	return 0;
 
+    headerUnlazy(h);
+
     /* Allocate more index space if necessary */
     if (h->indexUsed == h->indexAlloced) {
 	h->indexAlloced += INDEX_MALLOC_SIZE;
@@ -1558,6 +1895,7 @@ int headerPut(Header h, rpmtd td, headerPutFlags flags)
     int rc;
     
     assert(td != NULL);
+    headerUnlazy(h);
     if (flags & HEADERPUT_APPEND) {
 	rc = findEntry(h, td->tag, td->type) ?
 		intAppendEntry(h, td) :
@@ -1713,6 +2051,8 @@ int headerMod(Header h, rpmtd td)
     void * data;
     uint32_t length = 0;
 
+    headerUnlazy(h);
+
     /* First find the tag */
     entry = findEntry(h, td->tag, td->type);
     if (!entry)
@@ -2129,8 +2469,12 @@ Header headerImport(void * blob, unsigned int bsize, headerImportFlags flags)
     }
 
     /* Sanity checks on header intro. */
-    if (hdrblobInit(b, bsize, 0, 0, &hblob, &buf) == RPMRC_OK)
-	hdrblobImport(&hblob, (flags & HEADERIMPORT_FAST), &h, &buf);
+    if (hdrblobInit(b, bsize, 0, 0, &hblob, &buf) == RPMRC_OK) {
+	int fast = (flags & HEADERIMPORT_FAST);
+	if (!((flags & HEADERIMPORT_LAZY) &&
+		hdrblobImportLazy(&hblob, fast, &h) == RPMRC_OK))
+	    hdrblobImport(&hblob, fast, &h, &buf);
+    }
 
 exit:
     if (h == NULL && b != blob)
@@ -7,6 +7,7 @@
 
 #include <rpm/header.h>
 #include <rpm/rpmcrypto.h>
+#include <rpm/rpmsw.h>
 
 typedef struct entryInfo_s * entryInfo;
 typedef struct hdrblob_s * hdrblob;
@@ -62,4 +63,12 @@ ssize_t Freadall(FD_t fd, void * buf, ssize_t size);
 RPM_GNUC_INTERNAL
 int headerIsSourceHeuristic(Header h);
 
+/*
+ * Collect the digest statistics of headerCheck() calls on the calling
+ * thread in op instead of the transaction set, whose statistics can't
+ * be updated from several threads at once. NULL restores the default.
+ */
+RPM_GNUC_INTERNAL
+void headerCheckSetStats(rpmop op);
+
 #endif  /* H_HEADER_INTERNAL */
@@ -201,6 +201,14 @@ static sprintfToken hsaNext(headerSprintfArgs hsa)
  */
 static void hsaFini(headerSprintfArgs hsa)
 {
+    /* Restore the tag iteration marker for the next header */
+    if (hsa->hi) {
+	sprintfTag tag =
+	    (hsa->format->type == PTOK_TAG
+		? &hsa->format->u.tag :
+		&hsa->format->u.array.format->u.tag);
+	tag->tag = -2;
+    }
     hsa->hi = headerFreeIterator(hsa->hi);
     hsa->i = 0;
 }
@@ -873,39 +881,70 @@ static bool singleSprintf(headerSprintfArgs hsa, sprintfToken token,
     return false;
 }
 
-char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+/*
+ * A parsed query format. The tokens reference the mangled copy of the
+ * format string, and the output buffer is reused from header to header.
+ */
+struct rpmHeaderFormatter_s {
+    char * fmt;
+    sprintfToken format;
+    int numTokens;
+    struct xformat_s xfmt;
+    std::string val;
+};
+
+rpmHeaderFormatter rpmHeaderFormatterNew(const char * fmt, errmsg_t * errmsg)
 {
     struct headerSprintfArgs_s hsa {};
-    sprintfToken nextfmt;
+    rpmHeaderFormatter hf = new rpmHeaderFormatter_s {};
     sprintfTag tag;
- 
-    hsa.h = headerLink(h);
-    hsa.fmt = xstrdup(fmt);
-    hsa.errmsg = NULL;
 
-    if (parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN))
+    hf->fmt = xstrdup(fmt);
+    if (parseFormat(&hsa, hf->fmt, &hf->format, &hf->numTokens, NULL, PARSER_BEGIN)) {
+	hf = rpmHeaderFormatterFree(hf);
 	goto exit;
+    }
 
     tag =
-	(hsa.format->type == PTOK_TAG
-	    ? &hsa.format->u.tag :
-	(hsa.format->type == PTOK_ARRAY
-	    ? &hsa.format->u.array.format->u.tag :
+	(hf->format->type == PTOK_TAG
+	    ? &hf->format->u.tag :
+	(hf->format->type == PTOK_ARRAY
+	    ? &hf->format->u.array.format->u.tag :
 	NULL));
     if (tag != NULL && tag->tag == -2 && tag->type != NULL) {
 	if (rstreq(tag->type, "xml"))
-	    hsa.xfmt = xformat_xml; /* struct assignment */
+	    hf->xfmt = xformat_xml; /* struct assignment */
 	else if (rstreq(tag->type, "json"))
-	    hsa.xfmt = xformat_json; /* struct assignment */
+	    hf->xfmt = xformat_json; /* struct assignment */
     }
 
+exit:
+    if (errmsg)
+	*errmsg = hsa.errmsg;
+    return hf;
+}
+
+const char * rpmHeaderFormatterFormat(rpmHeaderFormatter hf, Header h,
+				      errmsg_t * errmsg)
+{
+    struct headerSprintfArgs_s hsa {};
+    sprintfToken nextfmt;
+
+    hsa.h = headerLink(h);
+    hsa.format = hf->format;
+    hsa.numTokens = hf->numTokens;
+    hsa.xfmt = hf->xfmt;
+    /* Borrow the output buffer, keeping its capacity */
+    hsa.val.swap(hf->val);
+    hsa.val.clear();
+
     if (hsa.xfmt.xHeader)
 	hsa.xfmt.xHeader(&hsa);
 
     hsaInit(&hsa);
     while ((nextfmt = hsaNext(&hsa)) != NULL) {
 	if (singleSprintf(&hsa, nextfmt, 0)) {
-	    hsa.val = "";
+	    hsa.val.clear();
 	    break;
 	}
     }
@@ -916,13 +955,34 @@ char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg)
 
     for (auto & val : hsa.cache)
 	rpmtdFreeData(&val.second);
-    hsa.format = freeFormat(hsa.format, hsa.numTokens);
 
-exit:
     if (errmsg)
 	*errmsg = hsa.errmsg;
     hsa.h = headerFree(hsa.h);
-    hsa.fmt = _free(hsa.fmt);
-    return hsa.errmsg ? NULL : xstrdup(hsa.val.c_str());
+    hsa.val.swap(hf->val);
+    return hsa.errmsg ? NULL : hf->val.c_str();
 }
 
+rpmHeaderFormatter rpmHeaderFormatterFree(rpmHeaderFormatter hf)
+{
+    if (hf) {
+	freeFormat(hf->format, hf->numTokens);
+	free(hf->fmt);
+	delete hf;
+    }
+    return NULL;
+}
+
+char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+{
+    char *str = NULL;
+    rpmHeaderFormatter hf = rpmHeaderFormatterNew(fmt, errmsg);
+
+    if (hf) {
+	const char *val = rpmHeaderFormatterFormat(hf, h, errmsg);
+	if (val)
+	    str = xstrdup(val);
+	rpmHeaderFormatterFree(hf);
+    }
+    return str;
+}
@@ -60,4 +60,14 @@ void rpmRelocationBuild(Header h, rpmRelocation *rawrelocs,
 
 RPM_GNUC_INTERNAL
 int rpmIsValidHex(const char *str, size_t slen);
+
+/**
+ * Return number of threads to use for an operation, as configured by
+ * the given macro: undefined or 1 means serial, 0 (or less) autodetects
+ * from the available cpus. Always capped by %_smp_nthreads_max.
+ * @param macro		macro name (without the leading %)
+ * @return		number of threads to use (1 without OpenMP)
+ */
+RPM_GNUC_INTERNAL
+int rpmExpandThreads(const char *macro);
 #endif	/* H_MISC */
@@ -4,8 +4,9 @@
 
 #include "system.h"
 
-#include <forward_list>
+#include <list>
 #include <queue>
+#include <vector>
 
 #include <string.h>
 
@@ -38,14 +39,36 @@ struct relation_s {
 
 typedef struct relation_s * relation;
 
+/*
+ * Relations of a package: a slice of the transaction wide adjacency
+ * arrays, most recently recorded relation first
+ */
+struct relations_s {
+    relation first;
+    relation last;
+
+    relation begin() const { return first; }
+    relation end() const { return last; }
+};
+
+/* Relation as recorded, "req" requires "prov" */
+struct relationRec_s {
+    tsortInfo req;
+    tsortInfo prov;
+    rpmsenseFlags flags;
+};
+
+using relationRecs = std::vector<relationRec_s>;
+
 struct tsortInfo_s {
     rpmte te;
     int	     tsi_count;     // #pkgs this pkg requires
     int	     tsi_qcnt;      // #pkgs requiring this package
     int	     tsi_reqx;       // requires Idx/mark as (queued/loop)
-    std::forward_list<relation_s> tsi_relations;
-    std::forward_list<relation_s> tsi_forward_relations;
-    tsortInfo tsi_suc;        // used for queuing (addQ)
+    relations_s tsi_relations;
+    relations_s tsi_forward_relations;
+    int      tsi_lastrel;   // latest record requiring this package
+    int      tsi_lastfwd;   // latest record required by this package
     int      tsi_SccIdx;     // # of the SCC the node belongs to
                              // (1 for trivial SCCs)
     int      tsi_SccLowlink; // used for SCC detection
@@ -53,7 +76,8 @@ struct tsortInfo_s {
 
 static inline int addSingleRelation(rpmte p,
 				    rpmte q,
-				    rpmds dep)
+				    rpmds dep,
+				    relationRecs & recs)
 {
     struct tsortInfo_s *tsi_p, *tsi_q;
     rpmElementType teType = rpmteType(p);
@@ -105,62 +129,76 @@ static inline int addSingleRelation(rpmte p,
     tsi_q = rpmteTSI(q);
 
     /* if relation got already added just update the flags */
-    if (!reversed && tsi_q->tsi_relations.empty() == false &&
-	    tsi_q->tsi_relations.front().rel_suc == tsi_p)
+    /* must be latest one added to q as we add all rels to p at once */
+    if (!reversed && tsi_q->tsi_lastrel >= 0 &&
+	    recs[tsi_q->tsi_lastrel].req == tsi_p)
     {
-	/* must be latest one added to q as we add all rels to p at once */
-	tsi_q->tsi_relations.front().rel_flags |= flags;
-	/* search entry in p */
-	for (auto & tsi : tsi_p->tsi_forward_relations) {
-	    if (tsi.rel_suc == tsi_q) {
-		tsi.rel_flags |= flags;
-		return 0;
-	    }
-	}
-	assert(0);
+	recs[tsi_q->tsi_lastrel].flags |= flags;
+	return 0;
     }
 
     /* if relation got already added just update the flags */
-    if (reversed && tsi_q->tsi_forward_relations.empty() == false &&
-	tsi_q->tsi_forward_relations.front().rel_suc == tsi_p)
+    if (reversed && tsi_q->tsi_lastfwd >= 0 &&
+	    recs[tsi_q->tsi_lastfwd].prov == tsi_p)
     {
-	/* must be latest one added to q as we add all rels to p at once */
-	tsi_q->tsi_forward_relations.front().rel_flags |= flags;
-	/* search entry in p */
-	for (auto & tsi : tsi_p->tsi_relations) {
-	    if (tsi.rel_suc == tsi_q) {
-		tsi.rel_flags |= flags;
-		return 0;
-	    }
-	}
-	assert(0);
+	recs[tsi_q->tsi_lastfwd].flags |= flags;
+	return 0;
     }
 
     /* Record next "q <- p" relation (i.e. "p" requires "q"). */
+    tsi_q->tsi_lastrel = tsi_p->tsi_lastfwd = recs.size();
+    recs.push_back({ tsi_p, tsi_q, flags });
 
     /* bump p predecessor count */
     tsi_p->tsi_count++;
-    tsi_q->tsi_relations.push_front({ tsi_p, flags});
-    
+
     /* bump q successor count */
     tsi_q->tsi_qcnt++;
-    tsi_p->tsi_forward_relations.push_front({ tsi_q, flags});
 
     return 0;
 }
 
+/*
+ * Lay out the recorded relations as adjacency arrays, with the slice of
+ * each package in the order the relations are visited in.
+ */
+static void buildRelations(std::vector<tsortInfo_s> & sortInfo,
+			   const relationRecs & recs,
+			   std::vector<relation_s> & relations,
+			   std::vector<relation_s> & forward)
+{
+    relations.resize(recs.size());
+    forward.resize(recs.size());
+
+    relation r = relations.data();
+    relation f = forward.data();
+    for (auto & tsi : sortInfo) {
+	tsi.tsi_relations = { r, r };
+	tsi.tsi_forward_relations = { f, f };
+	r += tsi.tsi_qcnt;
+	f += tsi.tsi_count;
+    }
+
+    for (auto rec = recs.rbegin(); rec != recs.rend(); ++rec) {
+	*rec->prov->tsi_relations.last++ = { rec->req, rec->flags };
+	*rec->req->tsi_forward_relations.last++ = { rec->prov, rec->flags };
+    }
+}
+
 /**
  * Record next "q <- p" relation (i.e. "p" requires "q").
  * @param ts		transaction set
  * @param al		packages list
  * @param p		predecessor (i.e. package that "Requires: q")
  * @param dep		dependency relation
+ * @param recs		recorded relations
  * @return		0 always
  */
 static inline int addRelation(rpmts ts,
 			      rpmal al,
 			      rpmte p,
-			      rpmds dep)
+			      rpmds dep,
+			      relationRecs & recs)
 {
     rpmte q;
 
@@ -173,18 +211,18 @@ static inline int addRelation(rpmts ts,
 	rpmrichOp op;
 	if (rpmdsParseRichDep(dep, &ds1, &ds2, &op, NULL) == RPMRC_OK) {
 	    if (op != RPMRICHOP_ELSE)
-		addRelation(ts, al, p, ds1);
+		addRelation(ts, al, p, ds1, recs);
 	    if (op == RPMRICHOP_IF || op == RPMRICHOP_UNLESS) {
 	      rpmds ds21, ds22;
 	      rpmrichOp op2;
 	      if (rpmdsParseRichDep(dep, &ds21, &ds22, &op2, NULL) == RPMRC_OK && op2 == RPMRICHOP_ELSE) {
-		  addRelation(ts, al, p, ds22);
+		  addRelation(ts, al, p, ds22, recs);
 	      }
 	      ds21 = rpmdsFree(ds21);
 	      ds22 = rpmdsFree(ds22);
 	    }
 	    if (op == RPMRICHOP_AND || op == RPMRICHOP_OR)
-		addRelation(ts, al, p, ds2);
+		addRelation(ts, al, p, ds2, recs);
 	    ds1 = rpmdsFree(ds1);
 	    ds2 = rpmdsFree(ds2);
 	}
@@ -196,74 +234,164 @@ static inline int addRelation(rpmts ts,
     if (q == NULL || q == p)
 	return 0;
 
-    addSingleRelation(p, q, dep);
+    addSingleRelation(p, q, dep, recs);
 
     return 0;
 }
 
+/*
+ * Queue of packages ready to be collected, see push() for the order.
+ * The queue is kept in blocks of bounded size that know the lowest
+ * tsi_qcnt of each color in them, so finding the place for a package
+ * only needs to look into the blocks it could go into.
+ */
+class tsortQueue {
+public:
+    tsortQueue(rpm_color_t prefcolor) : prefcolor(prefcolor) {}
+
+    bool empty() const { return blocks.empty(); }
+    tsortInfo pop();
+    void push(tsortInfo p);
+
+private:
+    static constexpr size_t blockSize = 64;
+
+    struct qblock {
+	std::vector<tsortInfo> items;
+	int minQcnt = INT_MAX;	/* lower bound of tsi_qcnt of all items */
+	std::vector<std::pair<rpm_color_t,int>> colorMinQcnt; /* per color */
+
+	void add(tsortInfo p, rpm_color_t color);
+	void reindex();
+	bool mayHold(int qcnt, int tailcond, rpm_color_t color) const;
+    };
+
+    rpm_color_t prefcolor;
+    std::list<qblock> blocks;
+};
+
+void tsortQueue::qblock::add(tsortInfo p, rpm_color_t color)
+{
+    if (p->tsi_qcnt < minQcnt)
+	minQcnt = p->tsi_qcnt;
+    for (auto & cm : colorMinQcnt) {
+	if (cm.first == color) {
+	    if (p->tsi_qcnt < cm.second)
+		cm.second = p->tsi_qcnt;
+	    return;
+	}
+    }
+    colorMinQcnt.push_back({ color, p->tsi_qcnt });
+}
+
+/* Recompute the minimums from the current items */
+void tsortQueue::qblock::reindex()
+{
+    minQcnt = INT_MAX;
+    colorMinQcnt.clear();
+    for (auto item : items)
+	add(item, rpmteColor(item->te));
+}
+
+/* Could the block hold an element a package with qcnt goes in front of? */
+bool tsortQueue::qblock::mayHold(int qcnt, int tailcond,
+				 rpm_color_t color) const
+{
+    if (!tailcond)
+	return minQcnt <= qcnt;
+    for (auto & cm : colorMinQcnt) {
+	if (cm.first == color)
+	    return cm.second <= qcnt;
+    }
+    return false;
+}
+
+/**
+ * Remove the head of the queue.
+ * @return		the package at the head
+ */
+tsortInfo tsortQueue::pop()
+{
+    qblock & b = blocks.front();
+    tsortInfo q = b.items.front();
+
+    /* Block minimums may go stale here, they stay valid lower bounds. */
+    b.items.erase(b.items.begin());
+    if (b.items.empty())
+	blocks.pop_front();
+
+    /* Mark the package as unqueued. */
+    q->tsi_reqx = 0;
+    return q;
+}
+
 /**
- * Add element to list sorting by tsi_qcnt.
+ * Add package to queue sorting by tsi_qcnt. The package goes in front
+ * of the first element with lower or equal tsi_qcnt, ie. last among the
+ * ones with higher tsi_qcnt. To place the preferred color towards the
+ * queue head on install and towards the tail on erase, colored packages
+ * not of the preferred color on install (of it on erase) are only
+ * compared against packages of their own color, and go to the very end
+ * if none of those has a lower or equal tsi_qcnt.
  * @param p		new element
- * @param[out] qp		address of first element
- * @param[out] rp		address of last element
- * @param prefcolor
  */
-static void addQ(tsortInfo p, tsortInfo * qp, tsortInfo * rp,
-		rpm_color_t prefcolor)
+void tsortQueue::push(tsortInfo p)
 {
-    tsortInfo q, qprev;
     rpm_color_t pcolor = rpmteColor(p->te);
     int tailcond;
 
     /* Mark the package as queued. */
     p->tsi_reqx = 1;
 
-    if ((*rp) == NULL) {	/* 1st element */
-	/* FIX: double indirection */
-	(*rp) = (*qp) = p;
-	return;
-    }
-
     if (rpmteType(p->te) == TR_ADDED)
 	tailcond = (pcolor && pcolor != prefcolor);
     else
 	tailcond = (pcolor && pcolor == prefcolor);
 
     /* Find location in queue using metric tsi_qcnt and color. */
-    for (qprev = NULL, q = (*qp);
-	 q != NULL;
-	 qprev = q, q = q->tsi_suc)
-    {
-	/* Place preferred color towards queue head on install, tail on erase */
-	if (tailcond && (pcolor != rpmteColor(q->te)))
+    for (auto b = blocks.begin(); b != blocks.end(); ++b) {
+	if (!b->mayHold(p->tsi_qcnt, tailcond, pcolor))
 	    continue;
 
-	if (q->tsi_qcnt <= p->tsi_qcnt)
-	    break;
-    }
+	for (auto q = b->items.begin(); q != b->items.end(); ++q) {
+	    if (tailcond && (pcolor != rpmteColor((*q)->te)))
+		continue;
+	    if ((*q)->tsi_qcnt > p->tsi_qcnt)
+		continue;
 
-    if (qprev == NULL) {	/* insert at beginning of list */
-	p->tsi_suc = q;
-	(*qp) = p;		/* new head */
-    } else if (q == NULL) {	/* insert at end of list */
-	qprev->tsi_suc = p;
-	(*rp) = p;		/* new tail */
-    } else {			/* insert between qprev and q */
-	p->tsi_suc = q;
-	qprev->tsi_suc = p;
+	    b->items.insert(q, p);
+	    b->add(p, pcolor);
+
+	    /* Split oversized blocks in half */
+	    if (b->items.size() > 2 * blockSize) {
+		auto half = b->items.begin() + blockSize;
+		qblock & nb = *blocks.emplace(std::next(b));
+		nb.items.assign(half, b->items.end());
+		b->items.erase(half, b->items.end());
+		b->reindex();
+		nb.reindex();
+	    }
+	    return;
+	}
     }
+
+    /* Insert at end of queue */
+    if (blocks.empty() || blocks.back().items.size() >= blockSize)
+	blocks.emplace_back();
+    blocks.back().items.push_back(p);
+    blocks.back().add(p, pcolor);
 }
 
 typedef struct sccData_s {
     int index;			/* DFS node number counter */
     std::vector<tsortInfo> stack; /* Stack of nodes */
     int sccCnt;			/* Number of SCC's found */
+    std::vector<std::pair<tsortInfo,relation>> path; /* DFS path, with the
+						       next relation to visit */
 } * sccData;
 
-static void tarjan(sccData sd, scc & SCCs, tsortInfo tsi)
+static void tarjanVisit(sccData sd, tsortInfo tsi)
 {
-    tsortInfo tsi_q;
-
     /* use negative index numbers */
     sd->index--;
     /* Set the depth index for p */
@@ -271,25 +399,12 @@ static void tarjan(sccData sd, scc & SCCs, tsortInfo tsi)
     tsi->tsi_SccLowlink = sd->index;
 
     sd->stack.push_back(tsi); /* Push p on the stack */
-    for (auto & rel : tsi->tsi_relations) {
-	/* Consider successors of p */
-	tsi_q = rel.rel_suc;
-	if (tsi_q->tsi_SccIdx > 0)
-	    /* Ignore already found SCCs */
-	    continue;
-	if (tsi_q->tsi_SccIdx == 0){
-	    /* Was successor q not yet visited? */
-	    tarjan(sd, SCCs, tsi_q);                       /* Recurse */
-	    /* negative index numers: use max as it is closer to 0 */
-	    tsi->tsi_SccLowlink = (
-		tsi->tsi_SccLowlink > tsi_q->tsi_SccLowlink
-		? tsi->tsi_SccLowlink : tsi_q->tsi_SccLowlink);
-	} else {
-	    tsi->tsi_SccLowlink = (
-		tsi->tsi_SccLowlink > tsi_q->tsi_SccIdx
-		? tsi->tsi_SccLowlink : tsi_q->tsi_SccIdx);
-	}
-    }
+    sd->path.push_back({ tsi, tsi->tsi_relations.begin() });
+}
+
+static void tarjanFinish(sccData sd, scc & SCCs, tsortInfo tsi)
+{
+    tsortInfo tsi_q;
 
     if (tsi->tsi_SccLowlink == tsi->tsi_SccIdx) {
 	/* v is the root of an SCC? */
@@ -327,12 +442,54 @@ static void tarjan(sccData sd, scc & SCCs, tsortInfo tsi)
     }
 }
 
+/* Iterative depth first search, large transactions would blow the stack */
+static void tarjan(sccData sd, scc & SCCs, tsortInfo root)
+{
+    tarjanVisit(sd, root);
+
+    while (!sd->path.empty()) {
+	tsortInfo tsi = sd->path.back().first;
+	relation rel = sd->path.back().second;
+
+	if (rel != tsi->tsi_relations.end()) {
+	    /* Consider successors of p */
+	    tsortInfo tsi_q = rel->rel_suc;
+	    if (tsi_q->tsi_SccIdx == 0) {
+		/* Was successor q not yet visited? Descend */
+		tarjanVisit(sd, tsi_q);
+		continue;
+	    }
+	    /* Ignore already found SCCs */
+	    if (tsi_q->tsi_SccIdx < 0) {
+		/* negative index numers: use max as it is closer to 0 */
+		tsi->tsi_SccLowlink = (
+		    tsi->tsi_SccLowlink > tsi_q->tsi_SccIdx
+		    ? tsi->tsi_SccLowlink : tsi_q->tsi_SccIdx);
+	    }
+	    sd->path.back().second++;
+	    continue;
+	}
+
+	tarjanFinish(sd, SCCs, tsi);
+	sd->path.pop_back();
+
+	/* Back in the parent, continue after the relation to p */
+	if (!sd->path.empty()) {
+	    tsortInfo parent = sd->path.back().first;
+	    parent->tsi_SccLowlink = (
+		parent->tsi_SccLowlink > tsi->tsi_SccLowlink
+		? parent->tsi_SccLowlink : tsi->tsi_SccLowlink);
+	    sd->path.back().second++;
+	}
+    }
+}
+
 /* Search for SCCs and return an array last entry has a .size of 0 */
 static scc detectSCCs(std::vector<tsortInfo_s> & orderInfo, int debugloops)
 {
     /* Set up data structures needed for the tarjan algorithm */
     scc SCCs(orderInfo.size()+3);
-    struct sccData_s sd = { 0, {}, 2 };
+    struct sccData_s sd = { 0, {}, 2, {} };
 
     for (auto & tsi : orderInfo) {
 	/* Start a DFS at each node */
@@ -364,12 +521,11 @@ static scc detectSCCs(std::vector<tsortInfo_s> & orderInfo, int debugloops)
     return SCCs;
 }
 
-static void collectTE(rpm_color_t prefcolor, tsortInfo q,
+static void collectTE(tsortInfo q,
 		      std::vector<rpmte> & newOrder,
 		      scc & SCCs,
-		      tsortInfo * queue_end,
-		      tsortInfo * outer_queue,
-		      tsortInfo * outer_queue_end)
+		      tsortQueue & queue,
+		      tsortQueue * outer_queue)
 {
     char deptypechar = (rpmteType(q->te) == TR_REMOVED ? '-' : '+');
 
@@ -397,10 +553,10 @@ static void collectTE(rpm_color_t prefcolor, tsortInfo q,
 
 	    if (q->tsi_SccIdx > 1 && q->tsi_SccIdx != p->tsi_SccIdx) {
                 /* Relation point outside of this SCC: add to outside queue */
-		assert(outer_queue != NULL && outer_queue_end != NULL);
-		addQ(p, outer_queue, outer_queue_end, prefcolor);
+		assert(outer_queue != NULL);
+		outer_queue->push(p);
 	    } else {
-		addQ(p, &q->tsi_suc, queue_end, prefcolor);
+		queue.push(p);
 	    }
 	}
 	if (p && p->tsi_SccIdx > 1 &&
@@ -410,9 +566,9 @@ static void collectTE(rpm_color_t prefcolor, tsortInfo q,
 		(void) rpmteSetParent(p->te, q->te);
 
 		if (outer_queue != NULL) {
-		    addQ(p, outer_queue, outer_queue_end, prefcolor);
+		    outer_queue->push(p);
 		} else {
-		    addQ(p, &q->tsi_suc, queue_end, prefcolor);
+		    queue.push(p);
 		}
 	    }
 	}
@@ -469,15 +625,11 @@ static void dijkstra(const struct scc_s *SCC, int sccNr)
 
 static void collectSCC(rpm_color_t prefcolor, tsortInfo p_tsi,
 		       std::vector<rpmte> & newOrder,
-		       scc & SCCs, tsortInfo * queue_end)
+		       scc & SCCs, tsortQueue & outer_queue)
 {
     int sccNr = p_tsi->tsi_SccIdx;
     const struct scc_s * SCC = &SCCs[sccNr];
 
-    /* remove p from the outer queue */
-    tsortInfo outer_queue_start = p_tsi->tsi_suc;
-    p_tsi->tsi_suc = NULL;
-
     /*
      * Run a multi source Dijkstra's algorithm to find relations
      * that can be zapped with least danger to pre reqs.
@@ -487,18 +639,25 @@ static void collectSCC(rpm_color_t prefcolor, tsortInfo p_tsi,
     */
     dijkstra(SCC, sccNr);
 
+    /*
+     * Candidates by distance, the last member wins on ties. Distances
+     * don't change while collecting, so a heap can hand them out.
+     */
+    std::priority_queue<std::pair<int,size_t>> candidates;
+    for (size_t i = 0; i < SCC->members.size(); i++)
+	candidates.push({ SCC->members[i]->tsi_SccLowlink, i });
+
     while (1) {
 	tsortInfo best = NULL;
-	tsortInfo inner_queue_start, inner_queue_end;
-	int best_score = 0;
+	tsortQueue inner_queue(prefcolor);
 
 	/* select best candidate to start with */
-	for (auto & tsi : SCC->members) {
-	    if (tsi->tsi_SccIdx == 0) /* package already collected */
-		continue;
-	    if (tsi->tsi_SccLowlink >= best_score) {
+	while (!candidates.empty()) {
+	    tsortInfo tsi = SCC->members[candidates.top().second];
+	    candidates.pop();
+	    if (tsi->tsi_SccIdx != 0) { /* package not collected yet */
 		best = tsi;
-		best_score = tsi->tsi_SccLowlink;
+		break;
 	    }
 	}
 
@@ -506,20 +665,13 @@ static void collectSCC(rpm_color_t prefcolor, tsortInfo p_tsi,
 	    break;
 
 	/* collect best candidate and all packages that get freed */
-	inner_queue_start = inner_queue_end = NULL;
-	addQ(best, &inner_queue_start, &inner_queue_end, prefcolor);
-
-	for (; inner_queue_start != NULL;
-	     inner_queue_start = inner_queue_start->tsi_suc) {
-	    /* Mark the package as unqueued. */
-	    inner_queue_start->tsi_reqx = 0;
-	    collectTE(prefcolor, inner_queue_start, newOrder,
-		      SCCs, &inner_queue_end, &outer_queue_start, queue_end);
+	inner_queue.push(best);
+
+	while (!inner_queue.empty()) {
+	    collectTE(inner_queue.pop(), newOrder, SCCs,
+		      inner_queue, &outer_queue);
 	}
     }
-
-    /* restore outer queue */
-    p_tsi->tsi_suc = outer_queue_start;
 }
 
 int rpmtsOrder(rpmts ts)
@@ -527,11 +679,12 @@ int rpmtsOrder(rpmts ts)
     tsMembers tsmem = rpmtsMembers(ts);
     rpm_color_t prefcolor = rpmtsPrefColor(ts);
     rpmtsi pi; rpmte p;
-    tsortInfo q, r;
     int rc;
     rpmal erasedPackages;
     int nelem = rpmtsNElements(ts);
     std::vector<tsortInfo_s> sortInfo(nelem);
+    std::vector<relation_s> relations, forward;
+    relationRecs recs;
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_ORDER), 0);
 
@@ -540,6 +693,8 @@ int rpmtsOrder(rpmts ts)
 
     for (int i = 0; i < nelem; i++) {
 	sortInfo[i].te = tsmem->order[i];
+	sortInfo[i].tsi_lastrel = -1;
+	sortInfo[i].tsi_lastfwd = -1;
 	rpmteSetTSI(tsmem->order[i], &sortInfo[i]);
     }
 
@@ -562,12 +717,15 @@ int rpmtsOrder(rpmts ts)
 	for (int i = 0; ordertags[i]; i++) {
 	    rpmds dep = rpmdsInit(rpmteDS(p, ordertags[i]));
 	    while (rpmdsNext(dep) >= 0)
-		addRelation(ts, al, p, dep);
+		addRelation(ts, al, p, dep, recs);
 	}
     }
 
     rpmtsiFree(pi);
 
+    buildRelations(sortInfo, recs, relations, forward);
+    recs = relationRecs();
+
     std::vector<rpmte> newOrder;
     scc SCCs = detectSCCs(sortInfo, (rpmtsFlags(ts) & RPMTRANS_FLAG_DEPLOOPS));
 
@@ -584,35 +742,31 @@ int rpmtsOrder(rpmts ts)
     for (int i = 0; i < 2; i++) {
 	/* Do two separate runs: installs first - then erases */
 	int oType = !i ? TR_ADDED : TR_REMOVED;
-	q = r = NULL;
+	tsortQueue queue(prefcolor);
 	/* Scan for zeroes and add them to the queue */
 	for (int e = 0; e < nelem; e++) {
 	    tsortInfo p = &sortInfo[e];
 	    if (rpmteType(p->te) != oType) continue;
 	    if (p->tsi_count != 0)
 		continue;
-	    p->tsi_suc = NULL;
-	    addQ(p, &q, &r, prefcolor);
+	    queue.push(p);
 	}
 
 	/* Add one member of each leaf SCC */
 	for (int i = 2; SCCs[i].members.empty() == false; i++) {
 	    tsortInfo member = SCCs[i].members[0];
 	    if (SCCs[i].count == 0 && rpmteType(member->te) == oType) {
-		addQ(member, &q, &r, prefcolor);
+		queue.push(member);
 	    }
 	}
 
-	while (q != NULL) {
-	    /* Mark the package as unqueued. */
-	    q->tsi_reqx = 0;
+	while (!queue.empty()) {
+	    tsortInfo q = queue.pop();
 	    if (q->tsi_SccIdx > 1) {
-		collectSCC(prefcolor, q, newOrder, SCCs, &r);
+		collectSCC(prefcolor, q, newOrder, SCCs, queue);
 	    } else {
-		collectTE(prefcolor, q, newOrder, SCCs, &r,
-			  NULL, NULL);
+		collectTE(q, newOrder, SCCs, queue, NULL);
 	    }
-	    q = q->tsi_suc;
 	}
     }
 
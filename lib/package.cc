@@ -141,9 +141,18 @@ static void appendhdrmsg(struct rpmsinfo_s *sinfo, struct pkgdata_s *pkgdata,
     pkgdata->msg = rstrscat(&pkgdata->msg, "\n", msg, NULL);
 }
 
+/* Per-thread digest statistics of headerCheck(), if set */
+static __thread rpmop checkop = NULL;
+
+void headerCheckSetStats(rpmop op)
+{
+    checkop = op;
+}
+
 rpmRC headerCheck(rpmts ts, const void * uh, size_t uc, char ** msg)
 {
     rpmRC rc = RPMRC_FAIL;
+    rpmop op = checkop ? checkop : rpmtsOp(ts, RPMTS_OP_DIGEST);
     rpmVSFlags vsflags = rpmtsVSFlags(ts) | RPMVSF_NEEDPAYLOAD;
     rpmKeyring keyring = rpmtsGetKeyring(ts, 1);
     struct hdrblob_s blob;
@@ -159,7 +168,7 @@ rpmRC headerCheck(rpmts ts, const void * uh, size_t uc, char ** msg)
 	struct rpmvs_s *vs = rpmvsCreate(0, vsflags, keyring);
 	rpmDigestBundle bundle = rpmDigestBundleNew();
 
-	rpmswEnter(rpmtsOp(ts, RPMTS_OP_DIGEST), 0);
+	rpmswEnter(op, 0);
 
 	rpmvsInit(vs, &blob, bundle);
 	rpmvsInitRange(vs, RPMSIG_HEADER);
@@ -168,7 +177,7 @@ rpmRC headerCheck(rpmts ts, const void * uh, size_t uc, char ** msg)
 
 	rpmvsVerify(vs, RPMSIG_VERIFIABLE_TYPE, handleHdrVS, &pkgdata);
 
-	rpmswExit(rpmtsOp(ts, RPMTS_OP_DIGEST), uc);
+	rpmswExit(op, uc);
 
 	rc = pkgdata.rc;
 
@@ -216,6 +216,8 @@ struct poptOption rpmQVFilePoptTable[] = {
 struct poptOption rpmQueryPoptTable[] = {
  { NULL, '\0', POPT_ARG_CALLBACK | POPT_CBFLAG_INC_DATA | POPT_CBFLAG_CONTINUE,
 	(void *)queryArgCallback, 0, NULL, NULL },
+ { "batch", '\0', POPT_BIT_SET, &rpmQVKArgs.qva_flags, QUERY_BATCH,
+	N_("look up all file/path arguments in one go"), NULL },
  { "dump", '\0', 0, 0, POPT_DUMP,
 	N_("dump basic file information"), NULL },
  { NULL, 'i', POPT_ARGFLAG_DOC_HIDDEN, 0, 'i',
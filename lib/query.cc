@@ -9,6 +9,9 @@
 #include <inttypes.h>
 #include <ctype.h>
 
+#include <string>
+#include <vector>
+
 #include <rpm/rpmcli.h>
 #include <rpm/header.h>
 #include <rpm/rpmdb.h>
@@ -21,6 +24,7 @@
 
 #include "rpmgi.hh"
 #include "manifest.hh"
+#include "misc.hh"
 
 #include "debug.h"
 
@@ -91,6 +95,30 @@ static void printFileInfo(const char * name,
     free(link);
 }
 
+/* The query format in use, parsed once for all the headers of a query */
+struct queryFmt_s {
+    char * fmt;
+    rpmHeaderFormatter hf;
+};
+static __thread struct queryFmt_s queryFmt;
+
+static void queryFormatterFree(void)
+{
+    queryFmt.hf = rpmHeaderFormatterFree(queryFmt.hf);
+    queryFmt.fmt = _free(queryFmt.fmt);
+}
+
+static rpmHeaderFormatter queryFormatter(const char * fmt, errmsg_t * errstr)
+{
+    if (queryFmt.fmt == NULL || !rstreq(queryFmt.fmt, fmt)) {
+	queryFormatterFree();
+	queryFmt.hf = rpmHeaderFormatterNew(fmt, errstr);
+	if (queryFmt.hf)
+	    queryFmt.fmt = xstrdup(fmt);
+    }
+    return queryFmt.hf;
+}
+
 int showQueryPackage(QVA_t qva, rpmts ts, Header h)
 {
     rpmfi fi = NULL;
@@ -99,12 +127,12 @@ int showQueryPackage(QVA_t qva, rpmts ts, Header h)
     time_t now = 0;
 
     if (qva->qva_queryFormat != NULL) {
-	const char *errstr;
-	char *str = headerFormat(h, qva->qva_queryFormat, &errstr);
+	const char *errstr = NULL;
+	rpmHeaderFormatter hf = queryFormatter(qva->qva_queryFormat, &errstr);
+	const char *str = hf ? rpmHeaderFormatterFormat(hf, h, &errstr) : NULL;
 
 	if ( str != NULL ) {
 	    rpmlog(RPMLOG_NOTICE, "%s", str);
-	    free(str);
 	} else {
 	    rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), errstr);
 	}
@@ -277,6 +305,72 @@ static int rpmgiShowMatches(QVA_t qva, rpmts ts, rpmgi gi)
     return ec + rpmgiNumErrors(gi);
 }
 
+struct fmtRec_s {
+    Header h;
+    int rc;
+    std::string str;		/*!< output or error message */
+};
+
+/*
+ * Query format only queries spend their time in headerFormat(). Read the
+ * headers in batches, format them on %_query_threads threads and print
+ * the results in iteration order, so the output is the same as from
+ * showQueryPackage() one header at a time.
+ */
+static int rpmcliFormatMatches(QVA_t qva, rpmdbMatchIterator mi, int nthreads)
+{
+    size_t batch = 64 * nthreads;
+    std::vector<fmtRec_s> recs;
+    int done = 0;
+
+    recs.reserve(batch);
+    while (!done) {
+	Header h;
+
+	/* Stage 0: read a batch of headers, iterators aren't thread safe */
+	while (recs.size() < batch) {
+	    if ((h = rpmdbNextIterator(mi)) == NULL) {
+		done = 1;
+		break;
+	    }
+	    struct fmtRec_s r = {};
+	    r.h = headerLink(h);
+	    recs.push_back(r);
+	}
+
+	/* Stage 1: format, formatters can't be shared between threads */
+	#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+	{
+	    errmsg_t errstr = NULL;
+	    rpmHeaderFormatter hf =
+		rpmHeaderFormatterNew(qva->qva_queryFormat, &errstr);
+
+	    #pragma omp for schedule(dynamic)
+	    for (size_t i = 0; i < recs.size(); i++) {
+		struct fmtRec_s & r = recs[i];
+		const char *str = hf ?
+			rpmHeaderFormatterFormat(hf, r.h, &errstr) : NULL;
+		/* Error messages live in a thread local buffer, copy now */
+		r.rc = (str == NULL);
+		r.str = str ? str : (errstr ? errstr : "");
+	    }
+	    rpmHeaderFormatterFree(hf);
+	}
+
+	/* Stage 2: output in the original order */
+	for (auto & r : recs) {
+	    if (r.rc == 0) {
+		rpmlog(RPMLOG_NOTICE, "%s", r.str.c_str());
+	    } else {
+		rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), r.str.c_str());
+	    }
+	    headerFree(r.h);
+	}
+	recs.clear();
+    }
+    return 0;
+}
+
 static int rpmcliShowMatches(QVA_t qva, rpmts ts, rpmdbMatchIterator mi)
 {
     Header h;
@@ -285,6 +379,14 @@ static int rpmcliShowMatches(QVA_t qva, rpmts ts, rpmdbMatchIterator mi)
     if (mi == NULL)
 	return 1;
 
+    if (qva->qva_showPackage == showQueryPackage &&
+	    qva->qva_queryFormat != NULL && qva->qva_incattr == 0 &&
+	    !(qva->qva_flags & QUERY_FOR_LIST)) {
+	int nthreads = rpmExpandThreads("_query_threads");
+	if (nthreads > 1)
+	    return rpmcliFormatMatches(qva, mi, nthreads);
+    }
+
     while ((h = rpmdbNextIterator(mi)) != NULL) {
 	int rc;
 	if ((rc = qva->qva_showPackage(qva, ts, h)) != 0)
@@ -306,9 +408,95 @@ static rpmdbMatchIterator matchesIterator(rpmts ts, rpmDbiTag dbi,
     return mi;
 }
 
-static rpmdbMatchIterator initQueryIterator(QVA_t qva, rpmts ts, const char * arg)
+/* Return the absolute, cleaned up path of a file query argument */
+static char * queryPath(const char * arg)
 {
     const char * s;
+    char * fn;
+
+    for (s = arg; *s != '\0'; s++)
+	if (!(*s == '.' || *s == '/'))
+	    break;
+
+    if (*s == '\0') {
+	fn = realpath(arg, NULL);
+	if (!fn)
+	    fn = xstrdup(arg);
+    } else if (*arg != '/') {
+	char *curDir = rpmGetCwd();
+	fn = (char *) rpmGetPath(curDir, "/", arg, NULL);
+	free(curDir);
+    } else
+	fn = xstrdup(arg);
+    (void) rpmCleanPath(fn);
+
+    return fn;
+}
+
+static rpmDbiTagVal queryPathTag(QVA_t qva)
+{
+    return (qva->qva_source == RPMQV_PATH_ALL) ?
+	    RPMDBI_BASENAMES : RPMDBI_INSTFILENAMES;
+}
+
+/* Look up a path not found in the file index from provides instead */
+static rpmdbMatchIterator queryPathFallback(rpmts ts, const char * fn)
+{
+    rpmdbMatchIterator mi = rpmtsInitIterator(ts, RPMDBI_PROVIDENAME, fn, 0);
+
+    if (mi == NULL) {
+	struct stat sb;
+	char * full_fn = rpmGetPath(rpmtsRootDir(ts), fn, NULL);
+	if (lstat(full_fn, &sb) != 0)
+	    rpmlog(RPMLOG_ERR, _("file %s: %s\n"), fn, strerror(errno));
+	else
+	    rpmlog(RPMLOG_NOTICE,
+		    _("file %s is not owned by any package\n"), fn);
+	free(full_fn);
+    }
+    return mi;
+}
+
+/*
+ * Query a batch of paths. The file index lookups of all the paths are
+ * done in one go, the results are shown in argument order as usual.
+ */
+static int queryPaths(QVA_t qva, rpmts ts, ARGV_const_t argv)
+{
+    int nfiles = argvCount(argv);
+    char ** fns = (char **) xcalloc(nfiles, sizeof(*fns));
+    rpmdbMatchIterator * mis = (rpmdbMatchIterator *)
+				xcalloc(nfiles, sizeof(*mis));
+    int ec = 0;
+
+    for (int i = 0; i < nfiles; i++)
+	fns[i] = queryPath(argv[i]);
+
+    if (qva->qva_showPackage == NULL ||
+	    rpmtsInitFileIterators(ts, queryPathTag(qva), fns, nfiles, mis)) {
+	ec = nfiles;
+	goto exit;
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+	if (mis[i] == NULL)
+	    mis[i] = queryPathFallback(ts, fns[i]);
+	ec += rpmcliShowMatches(qva, ts, mis[i]);
+	mis[i] = rpmdbFreeIterator(mis[i]);
+    }
+
+exit:
+    for (int i = 0; i < nfiles; i++) {
+	rpmdbFreeIterator(mis[i]);
+	free(fns[i]);
+    }
+    free(mis);
+    free(fns);
+    return ec;
+}
+
+static rpmdbMatchIterator initQueryIterator(QVA_t qva, rpmts ts, const char * arg)
+{
     rpmdbMatchIterator mi = NULL;
 
     if (qva->qva_showPackage == NULL)
@@ -405,41 +593,11 @@ static rpmdbMatchIterator initQueryIterator(QVA_t qva, rpmts ts, const char * ar
 	/* fallthrough on absolute and relative paths */
     case RPMQV_PATH:
     case RPMQV_PATH_ALL:
-    {   char * fn;
+    {   char * fn = queryPath(arg);
 
-	for (s = arg; *s != '\0'; s++)
-	    if (!(*s == '.' || *s == '/'))
-		break;
-
-	if (*s == '\0') {
-	    fn = realpath(arg, NULL);
-	    if (!fn)
-		fn = xstrdup(arg);
-	} else if (*arg != '/') {
-	    char *curDir = rpmGetCwd();
-	    fn = (char *) rpmGetPath(curDir, "/", arg, NULL);
-	    free(curDir);
-	} else
-	    fn = xstrdup(arg);
-	(void) rpmCleanPath(fn);
-
-	rpmDbiTagVal tag = RPMDBI_INSTFILENAMES;
-	if (qva->qva_source == RPMQV_PATH_ALL)
-	    tag = RPMDBI_BASENAMES;
-	mi = rpmtsInitIterator(ts, tag, fn, 0);
+	mi = rpmtsInitIterator(ts, queryPathTag(qva), fn, 0);
 	if (mi == NULL)
-	    mi = rpmtsInitIterator(ts, RPMDBI_PROVIDENAME, fn, 0);
-
-	if (mi == NULL) {
-	    struct stat sb;
-	    char * full_fn = rpmGetPath(rpmtsRootDir(ts), fn, NULL);
-	    if (lstat(full_fn, &sb) != 0)
-		rpmlog(RPMLOG_ERR, _("file %s: %s\n"), fn, strerror(errno));
-	    else
-		rpmlog(RPMLOG_NOTICE,
-			_("file %s is not owned by any package\n"), fn);
-	    free(full_fn);
-	}
+	    mi = queryPathFallback(ts, fn);
 
 	free(fn);
     }	break;
@@ -539,6 +697,13 @@ int rpmcliArgIter(rpmts ts, QVA_t qva, ARGV_const_t argv)
 	free(target);
 	break;
     }
+    case RPMQV_PATH:
+    case RPMQV_PATH_ALL:
+	if (qva->qva_flags & QUERY_BATCH) {
+	    ec = queryPaths(qva, ts, argv);
+	    break;
+	}
+	/* fallthrough */
     default:
 	for (ARGV_const_t arg = argv; arg && *arg; arg++) {
 	    int ecLocal;
@@ -589,6 +754,7 @@ int rpmcliQuery(rpmts ts, QVA_t qva, char * const * argv)
 
     if (qva->qva_showPackage == showQueryPackage)
 	qva->qva_showPackage = NULL;
+    queryFormatterFree();
 
     return ec;
 }
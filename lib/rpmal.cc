@@ -4,7 +4,10 @@
 
 #include "system.h"
 
+#include <algorithm>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include <rpm/rpmte.h>
 #include <rpm/rpmfi.h>
@@ -36,18 +39,157 @@ struct availablePackage_s {
  * A single available item (e.g. a Provides: dependency).
  */
 typedef struct availableIndexEntry_s {
+    rpmsid key;			/*!< Dependency name. */
     rpmalNum pkgNum;	        /*!< Containing package index. */
     unsigned int entryIx;	/*!< Dependency index. */
 } * availableIndexEntry;
 
 typedef struct availableIndexFileEntry_s {
+    rpmsid key;			/*!< File base name. */
     rpmsid dirName;
     rpmalNum pkgNum;	        /*!< Containing package index. */
-    unsigned int entryIx;	/*!< Dependency index. */
+    unsigned int entryIx;	/*!< File index. */
 } * availableIndexFileEntry;
 
-using rpmalDepHash = std::unordered_multimap<rpmsid,availableIndexEntry_s>;
-using rpmalFileHash = std::unordered_multimap<rpmsid,availableIndexFileEntry_s>;
+/** \ingroup rpmdep
+ * Available items in a flat array sorted by key, the most recently added
+ * item comes first on equal keys. The first item of each key is found
+ * through an open addressing table. Items added after the index is built
+ * are kept on the side, and merged in once there are enough of them.
+ */
+template <typename T>
+struct availableIndex {
+    std::vector<T> entries;		/*!< Items in key order. */
+    std::unordered_map<rpmsid,std::vector<T>> recent; /*!< Items added since, by key, newest first. */
+    size_t nrecent = 0;			/*!< Number of recent items. */
+    std::vector<unsigned int> slots;	/*!< Key run starts, by key hash. */
+
+    static constexpr unsigned int NOSLOT = (unsigned int) -1;
+
+    /* Iterates the recent items of a key, then the rest of them */
+    struct iterator {
+	const T *cur, *curEnd;
+	const T *next, *nextEnd;
+
+	const T & operator*() const { return *cur; }
+	const T * operator->() const { return cur; }
+
+	iterator & operator++()
+	{
+	    if (++cur == curEnd) {
+		cur = next;
+		curEnd = nextEnd;
+		next = nextEnd;
+	    }
+	    return *this;
+	}
+
+	bool operator==(const iterator & o) const
+	{
+	    return cur == o.cur && curEnd == o.curEnd;
+	}
+
+	bool operator!=(const iterator & o) const
+	{
+	    return !(*this == o);
+	}
+    };
+
+    static bool before(const T & a, const T & b)
+    {
+	if (a.key != b.key)
+	    return a.key < b.key;
+	if (a.pkgNum != b.pkgNum)
+	    return a.pkgNum > b.pkgNum;
+	return a.entryIx > b.entryIx;
+    }
+
+    static size_t hash(rpmsid key, size_t mask)
+    {
+	return (key * 2654435761U) & mask;
+    }
+
+    void add(const T & entry)
+    {
+	/* Until built, just collect */
+	if (slots.empty()) {
+	    entries.push_back(entry);
+	    return;
+	}
+
+	auto & run = recent[entry.key];
+	run.insert(run.begin(), entry);
+	if (++nrecent > entries.size() / 2)
+	    build();
+    }
+
+    void build()
+    {
+	size_t nsorted = slots.empty() ? 0 : entries.size();
+
+	for (auto const & run : recent)
+	    entries.insert(entries.end(), run.second.begin(), run.second.end());
+	recent.clear();
+	nrecent = 0;
+	auto mid = entries.begin() + nsorted;
+	std::sort(mid, entries.end(), before);
+	std::inplace_merge(entries.begin(), mid, entries.end(), before);
+
+	/* Keep the table at most half full */
+	size_t nkeys = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+	    if (i == 0 || entries[i].key != entries[i-1].key)
+		nkeys++;
+	}
+	size_t size = 16;
+	while (size < nkeys * 2)
+	    size <<= 1;
+	slots.assign(size, NOSLOT);
+
+	size_t mask = size - 1;
+	for (size_t i = 0; i < entries.size(); i++) {
+	    if (i > 0 && entries[i].key == entries[i-1].key)
+		continue;
+	    size_t h = hash(entries[i].key, mask);
+	    while (slots[h] != NOSLOT)
+		h = (h + 1) & mask;
+	    slots[h] = i;
+	}
+    }
+
+    std::pair<iterator, iterator> equal_range(rpmsid key) const
+    {
+	const T *rfirst = NULL;
+	const T *rlast = NULL;
+	const T *first = entries.data();
+	const T *last = first;
+
+	auto run = recent.find(key);
+	if (run != recent.end()) {
+	    rfirst = run->second.data();
+	    rlast = rfirst + run->second.size();
+	}
+
+	size_t mask = slots.size() - 1;
+	for (size_t h = hash(key, mask); slots[h] != NOSLOT; h = (h + 1) & mask) {
+	    if (entries[slots[h]].key == key) {
+		first += slots[h];
+		last = first;
+		while (last < entries.data() + entries.size() && last->key == key)
+		    last++;
+		break;
+	    }
+	}
+
+	iterator end = { last, last, last, last };
+	if (rfirst == rlast)
+	    return { { first, last, last, last }, end };
+	return { { rfirst, rlast, first, last }, end };
+    }
+};
+
+using rpmalDepIndex = availableIndex<availableIndexEntry_s>;
+using rpmalFileIndex = availableIndex<availableIndexFileEntry_s>;
 
 /** \ingroup rpmdep
  * Set of available packages, items, and directories.
@@ -55,13 +197,14 @@ using rpmalFileHash = std::unordered_multimap<rpmsid,availableIndexFileEntry_s>;
 struct rpmal_s {
     rpmstrPool pool;		/*!< String pool */
     std::vector<availablePackage_s> list;/*!< Set of packages. */
-    rpmalDepHash *providesHash;
-    rpmalDepHash *obsoletesHash;
-    rpmalFileHash *fileHash;
+    rpmalDepIndex *providesIndex;
+    rpmalDepIndex *obsoletesIndex;
+    rpmalFileIndex *fileIndex;
     rpmtransFlags tsflags;	/*!< Transaction control flags. */
     rpm_color_t tscolor;	/*!< Transaction color. */
     rpm_color_t prefcolor;	/*!< Transaction preferred color. */
     fingerPrintCache fpc;
+    std::mutex fpcMutex;	/*!< Fingerprint cache lock. */
 };
 
 /**
@@ -70,9 +213,9 @@ struct rpmal_s {
  */
 static void rpmalFreeIndex(rpmal al)
 {
-    delete al->providesHash;
-    delete al->obsoletesHash;
-    delete al->fileHash;
+    delete al->providesIndex;
+    delete al->obsoletesIndex;
+    delete al->fileIndex;
     al->fpc = fpCacheFree(al->fpc);
 }
 
@@ -143,10 +286,11 @@ static void rpmalAddFiles(rpmal al, rpmalNum pkgNum, rpmfiles fi)
 	if (skipconf && (rpmfilesFFlags(fi, i) & RPMFILE_CONFIG))
 	    continue;
 
+	fileEntry.key = rpmfilesBNId(fi, i);
 	fileEntry.dirName = rpmfilesDNId(fi, rpmfilesDI(fi, i));
 	fileEntry.entryIx = i;
 
-	al->fileHash->insert({rpmfilesBNId(fi, i), fileEntry});
+	al->fileIndex->add(fileEntry);
     }
 }
 
@@ -169,8 +313,9 @@ static void rpmalAddProvides(rpmal al, rpmalNum pkgNum, rpmds provides)
 	if (skipconf & (rpmdsFlagsIndex(provides, i) & RPMSENSE_CONFIG))
 	    continue;
 
-	indexEntry.entryIx = i;;
-	al->providesHash->insert({rpmdsNIdIndex(provides, i), indexEntry});
+	indexEntry.key = rpmdsNIdIndex(provides, i);
+	indexEntry.entryIx = i;
+	al->providesIndex->add(indexEntry);
     }
 }
 
@@ -188,8 +333,9 @@ static void rpmalAddObsoletes(rpmal al, rpmalNum pkgNum, rpmds obsoletes)
         if (al->tscolor && dscolor && !(al->tscolor & dscolor))
             continue;
 
-	indexEntry.entryIx = i;;
-	al->obsoletesHash->insert({rpmdsNIdIndex(obsoletes, i), indexEntry});
+	indexEntry.key = rpmdsNIdIndex(obsoletes, i);
+	indexEntry.entryIx = i;
+	al->obsoletesIndex->add(indexEntry);
     }
 }
 
@@ -210,12 +356,12 @@ void rpmalAdd(rpmal al, rpmte p)
 
     al->list.push_back(alp);
 
-    /* Try to be lazy as delayed hash creation is cheaper */
-    if (al->providesHash != NULL)
+    /* Try to be lazy as delayed index creation is cheaper */
+    if (al->providesIndex != NULL)
 	rpmalAddProvides(al, pkgNum, alp.provides);
-    if (al->obsoletesHash != NULL)
+    if (al->obsoletesIndex != NULL)
 	rpmalAddObsoletes(al, pkgNum, alp.obsoletes);
-    if (al->fileHash != NULL)
+    if (al->fileIndex != NULL)
 	rpmalAddFiles(al, pkgNum, alp.fi);
 }
 
@@ -227,11 +373,13 @@ static void rpmalMakeFileIndex(rpmal al)
 	if (alp.fi != NULL)
 	    fileCnt += rpmfilesFC(alp.fi);
     }
-    al->fileHash = new rpmalFileHash(fileCnt/4+128);
+    al->fileIndex = new rpmalFileIndex {};
+    al->fileIndex->entries.reserve(fileCnt);
     int i = 0;
     for (auto const & alp : al->list) {
 	rpmalAddFiles(al, i++, alp.fi);
     }
+    al->fileIndex->build();
 }
 
 static void rpmalMakeProvidesIndex(rpmal al)
@@ -242,12 +390,14 @@ static void rpmalMakeProvidesIndex(rpmal al)
 	providesCnt += rpmdsCount(alp.provides);
     }
 
-    al->providesHash = new rpmalDepHash(providesCnt/4+128);
+    al->providesIndex = new rpmalDepIndex {};
+    al->providesIndex->entries.reserve(providesCnt);
 
     int i = 0;
     for (auto const & alp : al->list) {
 	rpmalAddProvides(al, i++, alp.provides);
     }
+    al->providesIndex->build();
 }
 
 static void rpmalMakeObsoletesIndex(rpmal al)
@@ -258,12 +408,26 @@ static void rpmalMakeObsoletesIndex(rpmal al)
 	obsoletesCnt += rpmdsCount(alp.obsoletes);
     }
 
-    al->obsoletesHash = new rpmalDepHash(obsoletesCnt/4+128);
+    al->obsoletesIndex = new rpmalDepIndex {};
+    al->obsoletesIndex->entries.reserve(obsoletesCnt);
 
     int i = 0;
     for (auto const & alp : al->list) {
 	rpmalAddObsoletes(al, i++, alp.obsoletes);
     }
+    al->obsoletesIndex->build();
+}
+
+void rpmalMakeIndex(rpmal al)
+{
+    if (al == NULL)
+	return;
+    if (al->providesIndex == NULL)
+	rpmalMakeProvidesIndex(al);
+    if (al->obsoletesIndex == NULL)
+	rpmalMakeObsoletesIndex(al);
+    if (al->fileIndex == NULL)
+	rpmalMakeFileIndex(al);
 }
 
 std::vector<rpmte> rpmalAllObsoletes(rpmal al, rpmds ds)
@@ -274,16 +438,16 @@ std::vector<rpmte> rpmalAllObsoletes(rpmal al, rpmds ds)
     if (al == NULL || ds == NULL || (nameId = rpmdsNId(ds)) == 0)
 	return ret;
 
-    if (al->obsoletesHash == NULL)
+    if (al->obsoletesIndex == NULL)
 	rpmalMakeObsoletesIndex(al);
 
-    auto range = al->obsoletesHash->equal_range(nameId);
+    auto range = al->obsoletesIndex->equal_range(nameId);
     for (auto it = range.first; it != range.second; ++it) {
-	auto & alp = al->list[it->second.pkgNum];
+	auto & alp = al->list[it->pkgNum];
 	if (alp.p == NULL) // deleted
 	    continue;
 
-	int rc = rpmdsCompareIndex(alp.obsoletes, it->second.entryIx,
+	int rc = rpmdsCompareIndex(alp.obsoletes, it->entryIx,
 			       ds, rpmdsIx(ds));
 
 	if (rc) {
@@ -308,32 +472,33 @@ static std::vector<rpmte> rpmalAllFileSatisfiesDepend(const rpmal al, const char
 	size_t bnStart = (slash - fileName) + 1;
 	rpmsid baseName;
 
-	if (al->fileHash == NULL)
+	if (al->fileIndex == NULL)
 	    rpmalMakeFileIndex(al);
 
 	baseName = rpmstrPoolId(al->pool, fileName + bnStart, 0);
 	if (!baseName)
 	    return ret;	/* no match possible */
 
-	auto range = al->fileHash->equal_range(baseName);
+	auto range = al->fileIndex->equal_range(baseName);
 	if (range.first != range.second) {
 	    fingerPrint * fp = NULL;
 	    rpmsid dirName = rpmstrPoolIdn(al->pool, fileName, bnStart, 1);
 
 	    for (auto it = range.first; it != range.second; ++it) {
-		auto & alp = al->list[it->second.pkgNum];
+		auto & alp = al->list[it->pkgNum];
 		if (alp.p == NULL) /* deleted */
 		    continue;
 		/* ignore self-conflicts/obsoletes */
 		if (filterds && rpmteDS(alp.p, rpmdsTagN(filterds)) == filterds)
 		    continue;
-		if (it->second.dirName != dirName) {
+		if (it->dirName != dirName) {
 		    /* if the directory is different check the fingerprints */
+		    std::lock_guard<std::mutex> lock(al->fpcMutex);
 		    if (!al->fpc)
 			al->fpc = fpCacheCreate(1001, al->pool);
 		    if (!fp)
 			fpLookupId(al->fpc, dirName, baseName, &fp);
-		    if (!fpLookupEqualsId(al->fpc, fp, it->second.dirName, baseName))
+		    if (!fpLookupEqualsId(al->fpc, fp, it->dirName, baseName))
 			continue;
 		}
 		ret.push_back(alp.p);
@@ -374,18 +539,18 @@ std::vector<rpmte> rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
 	/* ... then, look for files "provided" by package. */
     }
 
-    if (al->providesHash == NULL)
+    if (al->providesIndex == NULL)
 	rpmalMakeProvidesIndex(al);
 
-    auto range = al->providesHash->equal_range(nameId);
+    auto range = al->providesIndex->equal_range(nameId);
     for (auto it = range.first; it != range.second; ++it) {
-	auto & alp = al->list[it->second.pkgNum];
+	auto & alp = al->list[it->pkgNum];
 	if (alp.p == NULL) /* deleted */
 	    continue;
 	/* ignore self-conflicts/obsoletes */
 	if (filterds && rpmteDS(alp.p, rpmdsTagN(filterds)) == filterds)
 	    continue;
-	int ix = it->second.entryIx;
+	int ix = it->entryIx;
 
 	if (obsolete) {
 	    /* Obsoletes are on package NEVR only */
@@ -45,6 +45,14 @@ void rpmalDel(rpmal al, rpmte p);
 RPM_GNUC_INTERNAL
 void rpmalAdd(rpmal al, rpmte p);
 
+/**
+ * Create the lookup indexes of the available list now instead of on
+ * first use, lookups are thread safe after this.
+ * @param al		available list
+ */
+RPM_GNUC_INTERNAL
+void rpmalMakeIndex(rpmal al);
+
 /**
  * Lookup all obsoleters for a dependency in the available list
  * @param al		available list
@@ -4,6 +4,11 @@
 
 #include "system.h"
 
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/file.h>
@@ -29,6 +34,7 @@
 #include <rpm/rpmlog.h>
 #include <rpm/rpmdb.h>
 #include <rpm/rpmts.h>
+#include <rpm/rpmkeyring.h>
 #include <rpm/argv.h>
 
 #include "rpmchroot.hh"
@@ -235,6 +241,22 @@ static rpmRC indexPrefixGet(dbiIndex dbi, const char *pfx, size_t plen,
     return rc;
 }
 
+/* Note that the set may contain entries of keys not matching the glob */
+static rpmRC indexGlobGet(dbiIndex dbi, const char *pattern, dbiIndexSet *set)
+{
+    rpmRC rc = RPMRC_FAIL; /* assume failure */
+
+    if (dbi != NULL && pattern) {
+	dbiCursor dbc = dbiCursorInit(dbi, DBC_READ);
+
+	rc = idxdbGet(dbi, dbc, pattern, strlen(pattern), set,
+		      DBC_GLOB_SEARCH);
+
+	dbiCursorFree(dbi, dbc);
+    }
+    return rc;
+}
+
 
 typedef struct miRE_s {
     rpmTagVal		tag;		/*!< header tag */
@@ -247,6 +269,16 @@ typedef struct miRE_s {
     int			fnflags;	/*!< fnmatch(3) flags */
 } * miRE;
 
+/* Headers of upcoming set members, fetched in one go */
+struct miPrefetch_s {
+    std::vector<unsigned int> hdrNums;
+    std::vector<unsigned char *> blobs;	/*!< malloc()'ed, NULL if missing */
+    std::vector<unsigned int> lens;
+    unsigned int changes;	/*!< db_changes at the time of fetching */
+    int started;		/*!< first header was fetched on its own */
+    int disabled;		/*!< backend has no batch support */
+};
+
 struct rpmdbMatchIterator_s {
     rpmdbMatchIterator	mi_next;
     rpmdb		mi_db;
@@ -265,7 +297,7 @@ struct rpmdbMatchIterator_s {
     miRE		mi_re;
     rpmts		mi_ts;
     rpmRC (*mi_hdrchk) (rpmts ts, const void * uh, size_t uc, char ** msg);
-
+    struct miPrefetch_s mi_pf;
 };
 
 struct rpmdbIndexIterator_s {
@@ -282,7 +314,7 @@ struct rpmdbIndexIterator_s {
 rpmop rpmdbOp(rpmdb rpmdb, rpmdbOpX opx)
 {
     rpmop op = NULL;
-    switch (opx) {
+    switch ((int)opx) {
     case RPMDB_OP_DBGET:
 	op = &rpmdb->db_getops;
 	break;
@@ -292,6 +324,18 @@ rpmop rpmdbOp(rpmdb rpmdb, rpmdbOpX opx)
     case RPMDB_OP_DBDEL:
 	op = &rpmdb->db_delops;
 	break;
+    case RPMDB_OP_STMTHIT:
+	op = &rpmdb->db_stmthitops;
+	break;
+    case RPMDB_OP_STMTMISS:
+	op = &rpmdb->db_stmtmissops;
+	break;
+    case RPMDB_OP_HDRHIT:
+	op = &rpmdb->db_hdrhitops;
+	break;
+    case RPMDB_OP_HDRMISS:
+	op = &rpmdb->db_hdrmissops;
+	break;
     default:
 	break;
     }
@@ -340,6 +384,417 @@ static int dbiForeach(dbiIndex *dbis, int ndbi,
     return rc;
 }
 
+/*
+ * Bounded LRU cache of verified header blobs, keyed by instance number.
+ * Dependency checks and file conflict detection look up the same
+ * installed packages over and over, this saves reading and verifying
+ * them on each lookup. Every hit imports a private header from the blob,
+ * so callers are free to modify what they get like with any other
+ * iterator header. Only read-only set iterators use the cache.
+ */
+struct hdrCache_s {
+    using entry = std::pair<unsigned int,std::vector<unsigned char>>;
+    std::list<entry> lru;		/*!< most recently used first */
+    std::unordered_map<unsigned int,std::list<entry>::iterator> byNum;
+    size_t max;
+    uint64_t generation;	/*!< backend generation of the contents */
+    int locks;			/*!< rpmdbCtrl() lock nesting level */
+    std::mutex mutex;
+};
+
+static void hdrCacheClear(struct hdrCache_s *c)
+{
+    c->lru.clear();
+    c->byNum.clear();
+}
+
+static struct hdrCache_s *hdrCacheNew(void)
+{
+    struct hdrCache_s *c = NULL;
+    int max = rpmExpandNumeric("%{?_db_header_cache}");
+
+    if (max > 0) {
+	c = new hdrCache_s();
+	c->max = max;
+    }
+    return c;
+}
+
+static struct hdrCache_s *hdrCacheFree(struct hdrCache_s *c)
+{
+    if (c) {
+	hdrCacheClear(c);
+	delete c;
+    }
+    return NULL;
+}
+
+/*
+ * Drop the cache contents if the database changed behind our back.
+ * Checking the generation isn't free, so this is done once when taking
+ * a lock or writing, and only on each iterator outside of those.
+ */
+static void hdrCacheSync(rpmdb db)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+    uint64_t generation = 0;
+
+    if (c == NULL)
+	return;
+
+    /* Without a generation there's no telling, play safe */
+    int rc = dbGeneration(db, &generation);
+    std::lock_guard<std::mutex> lock(c->mutex);
+    if (rc || generation != c->generation) {
+	hdrCacheClear(c);
+	c->generation = generation;
+    }
+}
+
+/* Adopt the generation of our own change, the instance was dropped already */
+static void hdrCacheChanged(rpmdb db)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+    uint64_t generation = 0;
+
+    if (c == NULL)
+	return;
+
+    int rc = dbGeneration(db, &generation);
+    std::lock_guard<std::mutex> lock(c->mutex);
+    if (rc)
+	hdrCacheClear(c);
+    c->generation = generation;
+}
+
+static void hdrCacheLock(rpmdb db, rpmdbCtrlOp ctrl)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+    int sync = 0;
+
+    if (c == NULL)
+	return;
+
+    {
+	std::lock_guard<std::mutex> lock(c->mutex);
+	switch (ctrl) {
+	case RPMDB_CTRL_LOCK_RO:
+	case RPMDB_CTRL_LOCK_RW:
+	    sync = (c->locks++ == 0);
+	    break;
+	case RPMDB_CTRL_UNLOCK_RO:
+	case RPMDB_CTRL_UNLOCK_RW:
+	    if (c->locks > 0)
+		c->locks--;
+	    break;
+	default:
+	    break;
+	}
+    }
+    if (sync)
+	hdrCacheSync(db);
+}
+
+static int hdrCacheLocked(rpmdb db)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+    if (c == NULL)
+	return 0;
+    std::lock_guard<std::mutex> lock(c->mutex);
+    return (c->locks > 0);
+}
+
+static int hdrCacheHas(rpmdb db, unsigned int hdrNum)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+    if (c == NULL)
+	return 0;
+    std::lock_guard<std::mutex> lock(c->mutex);
+    return (c->byNum.find(hdrNum) != c->byNum.end());
+}
+
+/* Return a new header imported from a cached blob, NULL if not cached */
+static Header hdrCacheGet(rpmdb db, unsigned int hdrNum,
+			headerImportFlags importFlags)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+    Header h = NULL;
+
+    if (c == NULL)
+	return NULL;
+
+    std::lock_guard<std::mutex> lock(c->mutex);
+    auto it = c->byNum.find(hdrNum);
+    if (it != c->byNum.end()) {
+	auto & blob = it->second->second;
+	c->lru.splice(c->lru.begin(), c->lru, it->second);
+	h = headerImport(blob.data(), blob.size(),
+			 importFlags | HEADERIMPORT_COPY);
+	db->db_hdrhitops.count++;
+    } else {
+	db->db_hdrmissops.count++;
+    }
+    return h;
+}
+
+static void hdrCachePut(rpmdb db, unsigned int hdrNum,
+			const unsigned char *uh, unsigned int uhlen)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+
+    if (c == NULL)
+	return;
+
+    std::lock_guard<std::mutex> lock(c->mutex);
+    auto it = c->byNum.find(hdrNum);
+    if (it != c->byNum.end()) {
+	it->second->second.assign(uh, uh + uhlen);
+	c->lru.splice(c->lru.begin(), c->lru, it->second);
+	return;
+    }
+
+    c->lru.emplace_front(hdrNum, std::vector<unsigned char>(uh, uh + uhlen));
+    c->byNum[hdrNum] = c->lru.begin();
+    if (c->lru.size() > c->max) {
+	c->byNum.erase(c->lru.back().first);
+	c->lru.pop_back();
+    }
+}
+
+/*
+ * Forget an instance that is being added, rewritten or removed. This
+ * runs under the write lock, catch up with other writers while at it.
+ */
+static void hdrCacheDrop(rpmdb db, unsigned int hdrNum)
+{
+    struct hdrCache_s *c = db->db_hdrcache;
+
+    if (c == NULL)
+	return;
+
+    hdrCacheSync(db);
+    std::lock_guard<std::mutex> lock(c->mutex);
+    auto it = c->byNum.find(hdrNum);
+    if (it != c->byNum.end()) {
+	c->lru.erase(it->second);
+	c->byNum.erase(it);
+    }
+}
+
+/*
+ * Instances that passed headerCheck(), persisted next to the database
+ * so other processes don't need to digest them again. The contents are
+ * valid for a single backend generation and set of verify flags, and
+ * each entry is further tied to the SHA256HEADER of the instance.
+ */
+#define VFY_MAGIC	"RPMVFY"
+#define VFY_VERSION	1
+#define VFY_FILE	"rpmdb.verified"
+
+struct vfyHeader_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t vsflags;
+    uint64_t generation;
+    uint32_t count;
+    uint32_t pad;
+};
+
+struct vfyEntry_s {
+    uint32_t hdrNum;
+    char sha256[64];		/*!< hex SHA256HEADER, not terminated */
+};
+
+struct vfyCache_s {
+    std::unordered_map<unsigned int,std::string> verified;
+    uint64_t generation;	/*!< backend generation of the contents */
+    rpmVSFlags vsflags;
+    int disabled;
+    int dirty;
+};
+
+/*
+ * Return the SHA256HEADER digest stored in a header blob. This is a tag
+ * lookup, not a digest calculation: the entries are only trusted under
+ * the generation they were recorded at, during which the blob of an
+ * instance doesn't change, so this merely guards against instance reuse.
+ */
+static int blobSha256(const void *uh, size_t uhlen, std::string & sha256)
+{
+    struct hdrblob_s blob;
+    struct rpmtd_s td;
+    int rc = -1;
+
+    if (hdrblobInit(uh, uhlen, 0, 0, &blob, NULL) == RPMRC_OK &&
+	    hdrblobGet(&blob, RPMTAG_SHA256HEADER, &td) == RPMRC_OK) {
+	const char *s = rpmtdGetString(&td);
+	if (s && strlen(s) == sizeof(vfyEntry_s::sha256)) {
+	    sha256 = s;
+	    rc = 0;
+	}
+	rpmtdFreeData(&td);
+    }
+    return rc;
+}
+
+static void vfyCacheRead(rpmdb db, struct vfyCache_s *c)
+{
+    char *path = rpmGenPath(rpmdbHome(db), VFY_FILE, NULL);
+    FILE *f = fopen(path, "r");
+    struct vfyHeader_s vh;
+
+    if (f == NULL)
+	goto exit;
+
+    if (fread(&vh, sizeof(vh), 1, f) != 1 ||
+	    memcmp(vh.magic, VFY_MAGIC, sizeof(VFY_MAGIC)) ||
+	    vh.version != VFY_VERSION || vh.vsflags != c->vsflags ||
+	    vh.generation != c->generation)
+	goto exit;
+
+    for (uint32_t i = 0; i < vh.count; i++) {
+	struct vfyEntry_s ve;
+	if (fread(&ve, sizeof(ve), 1, f) != 1) {
+	    c->verified.clear();
+	    break;
+	}
+	c->verified[ve.hdrNum].assign(ve.sha256, sizeof(ve.sha256));
+    }
+    rpmlog(RPMLOG_DEBUG, "loaded %zu verified headers from %s\n",
+	    c->verified.size(), path);
+
+exit:
+    if (f)
+	fclose(f);
+    free(path);
+}
+
+/* Write out the cache if it grew and nobody else changed the database */
+static void vfyCacheWrite(rpmdb db, struct vfyCache_s *c)
+{
+    uint64_t generation = 0;
+    struct vfyHeader_s vh = {};
+    char *path, *tmppath;
+    FILE *f = NULL;
+    int fd;
+    int rc = -1;
+
+    if (c->disabled || !c->dirty)
+	return;
+    if (dbGeneration(db, &generation) || generation != c->generation)
+	return;
+
+    path = rpmGenPath(rpmdbHome(db), VFY_FILE, NULL);
+    tmppath = rstrscat(NULL, path, ".new", NULL);
+    memcpy(vh.magic, VFY_MAGIC, sizeof(VFY_MAGIC));
+    vh.version = VFY_VERSION;
+    vh.vsflags = c->vsflags;
+    vh.generation = c->generation;
+    vh.count = c->verified.size();
+
+    /* Same permissions as the database, the umask has no say here */
+    fd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, db->db_perms);
+    if (fd >= 0 && (f = fdopen(fd, "w")) == NULL)
+	close(fd);
+    if (f) {
+	rc = (fwrite(&vh, sizeof(vh), 1, f) != 1);
+	for (auto const & v : c->verified) {
+	    struct vfyEntry_s ve = {};
+	    if (rc)
+		break;
+	    ve.hdrNum = v.first;
+	    memcpy(ve.sha256, v.second.data(), sizeof(ve.sha256));
+	    rc = (fwrite(&ve, sizeof(ve), 1, f) != 1);
+	}
+	/* Don't let a crash leave a truncated file behind the rename */
+	if (rc == 0 && (fflush(f) || fsync(fileno(f))))
+	    rc = -1;
+	if (fclose(f))
+	    rc = -1;
+	if (rc == 0)
+	    rc = rename(tmppath, path);
+    }
+    if (rc && fd >= 0)
+	unlink(tmppath);
+    if (rc == 0)
+	c->dirty = 0;
+
+    /* Merely an optimization, not being able to write it is fine */
+    rpmlog(RPMLOG_DEBUG, "%s %zu verified headers to %s\n",
+	    rc ? "failed to write" : "wrote", c->verified.size(), path);
+    free(tmppath);
+    free(path);
+}
+
+static struct vfyCache_s *vfyCacheGet(rpmdb db, rpmVSFlags vsflags)
+{
+    struct vfyCache_s *c = db->db_vfycache;
+
+    if (c == NULL) {
+	c = db->db_vfycache = new vfyCache_s();
+	c->vsflags = vsflags;
+	c->disabled = (rpmExpandNumeric("%{?_db_verify_cache}") <= 0 ||
+			dbGeneration(db, &c->generation) != 0);
+	if (!c->disabled)
+	    vfyCacheRead(db, c);
+    }
+
+    /* Results under other verify flags are of no use */
+    return (c->disabled || c->vsflags != vsflags) ? NULL : c;
+}
+
+static int vfyCacheCheck(rpmdb db, rpmVSFlags vsflags, unsigned int hdrNum,
+			 const void *uh, size_t uhlen)
+{
+    struct vfyCache_s *c = vfyCacheGet(db, vsflags);
+    std::string sha256;
+
+    if (c == NULL)
+	return 0;
+
+    auto it = c->verified.find(hdrNum);
+    if (it == c->verified.end() || blobSha256(uh, uhlen, sha256))
+	return 0;
+    return (it->second == sha256);
+}
+
+static void vfyCacheAdd(rpmdb db, rpmVSFlags vsflags, unsigned int hdrNum,
+			const void *uh, size_t uhlen)
+{
+    struct vfyCache_s *c = vfyCacheGet(db, vsflags);
+    std::string sha256;
+
+    if (c && blobSha256(uh, uhlen, sha256) == 0) {
+	std::string & v = c->verified[hdrNum];
+	if (v != sha256) {
+	    v = sha256;
+	    c->dirty = 1;
+	}
+    }
+}
+
+/* Forget a changed instance and follow our own generation bump */
+static void vfyCacheChanged(rpmdb db, unsigned int hdrNum)
+{
+    struct vfyCache_s *c = db->db_vfycache;
+
+    if (c && !c->disabled) {
+	c->verified.erase(hdrNum);
+	if (dbGeneration(db, &c->generation))
+	    c->disabled = 1;
+	c->dirty = 1;
+    }
+}
+
+static struct vfyCache_s *vfyCacheFree(rpmdb db, struct vfyCache_s *c)
+{
+    if (c) {
+	vfyCacheWrite(db, c);
+	delete c;
+    }
+    return NULL;
+}
+
 int rpmdbClose(rpmdb db)
 {
     int rc = 0;
@@ -351,10 +806,13 @@ int rpmdbClose(rpmdb db)
     if ((db->db_mode & O_ACCMODE) != O_RDONLY)
 	dbSetFSync(db, 1);
 
+    db->db_vfycache = vfyCacheFree(db, db->db_vfycache);
+
     if (db->db_pkgs)
 	rc = dbiClose(db->db_pkgs, 0);
     rc += dbiForeach(db->db_indexes, db->db_ndbi, dbiClose, 1);
 
+    db->db_hdrcache = hdrCacheFree(db->db_hdrcache);
     db->db_root = _free(db->db_root);
     db->db_home = _free(db->db_home);
     db->db_fullpath = _free(db->db_fullpath);
@@ -412,6 +870,7 @@ static rpmdb newRpmdb(const char * root, const char * home,
     db->db_fullpath = rpmGenPath(db->db_root, db->db_home, NULL);
     db->db_tags = dbiTags;
     db->db_ndbi = sizeof(dbiTags) / sizeof(rpmDbiTag);
+    db->db_hdrcache = hdrCacheNew();
     db->db_indexes = (dbiIndex *)xcalloc(db->db_ndbi, sizeof(*db->db_indexes));
     db->nrefs = 0;
     return rpmdbLink(db);
@@ -903,6 +1362,10 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
 	    dbCtrl(mi->mi_db, DB_CTRL_LOCK_RW);
 	    rc = pkgdbPut(dbi, mi->mi_dbc, &mi->mi_prevoffset,
 			  hdrBlob, hdrLen);
+	    hdrCacheDrop(mi->mi_db, mi->mi_prevoffset);
+	    dbCtrl(mi->mi_db, DB_CTRL_GENERATION);
+	    hdrCacheChanged(mi->mi_db);
+	    vfyCacheChanged(mi->mi_db, mi->mi_prevoffset);
 	    dbCtrl(mi->mi_db, DB_CTRL_INDEXSYNC);
 	    dbCtrl(mi->mi_db, DB_CTRL_UNLOCK_RW);
 	    rpmsqBlock(SIG_UNBLOCK);
@@ -921,6 +1384,15 @@ static int miFreeHeader(rpmdbMatchIterator mi, dbiIndex dbi)
     return rc;
 }
 
+static void miPrefetchFree(rpmdbMatchIterator mi)
+{
+    for (auto blob : mi->mi_pf.blobs)
+	free(blob);
+    mi->mi_pf.hdrNums.clear();
+    mi->mi_pf.blobs.clear();
+    mi->mi_pf.lens.clear();
+}
+
 rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
 {
     dbiIndex dbi = NULL;
@@ -947,6 +1419,7 @@ rpmdbMatchIterator rpmdbFreeIterator(rpmdbMatchIterator mi)
     mi->mi_re = _free(mi->mi_re);
 
     mi->mi_set = dbiIndexSetFree(mi->mi_set);
+    miPrefetchFree(mi);
     rpmdbClose(mi->mi_db);
     mi->mi_ts = rpmtsFree(mi->mi_ts);
 
@@ -1281,6 +1754,103 @@ static int mireSkip (const rpmdbMatchIterator mi)
     return (ntags == nmatches ? 0 : 1);
 }
 
+/**
+ * Return the literal prefix all matches of an anchored regex start with.
+ * @param pattern	extended regex
+ * @return		prefix (malloc'ed), NULL if there's none
+ */
+static char * regexPrefix(const char * pattern)
+{
+    std::string prefix;
+    size_t last = 0;	/* prefix length without the last literal */
+
+    /* Alternatives could match anything, don't bother parsing them */
+    if (*pattern != '^' || strchr(pattern, '|'))
+	return NULL;
+
+    for (const char * s = pattern + 1; *s != '\0'; s++) {
+	char c = *s;
+	if (c == '\\') {
+	    /* Character classes, back-references and such */
+	    if (s[1] == '\0' || risalnum(s[1]))
+		break;
+	    c = *++s;
+	} else if (strchr(".[]()*+?{}^$", c)) {
+	    /* These quantifiers make the preceding literal optional */
+	    if (strchr("*?{", c))
+		prefix.resize(last);
+	    break;
+	}
+	last = prefix.size();
+	prefix += c;
+    }
+
+    return prefix.empty() ? NULL : xstrdup(prefix.c_str());
+}
+
+/**
+ * Push the name patterns of a full package iteration down to the Name
+ * index, so only headers of candidate names get loaded. The patterns
+ * are still applied by mireSkip(), the index just needs to return a
+ * superset. Iterators stay as they are if any of the patterns can't be
+ * looked up in the index.
+ * @param mi		rpm database iterator
+ */
+static void miPushDown(rpmdbMatchIterator mi)
+{
+    dbiIndexSet set = NULL;
+    dbiIndex dbi = NULL;
+    rpmRC rc = RPMRC_OK;
+    int npats = 0;
+
+    for (int i = 0; i < mi->mi_nre; i++) {
+	if (mi->mi_re[i].tag != RPMTAG_NAME)
+	    continue;
+	/* Name patterns are or'ed, a negated one can match anything */
+	if (mi->mi_re[i].notmatch)
+	    return;
+	npats++;
+    }
+
+    if (npats == 0 || indexOpen(mi->mi_db, RPMDBI_NAME, 0, &dbi))
+	return;
+
+    for (int i = 0; rc != RPMRC_FAIL && i < mi->mi_nre; i++) {
+	miRE mire = mi->mi_re + i;
+	char *prefix = NULL;
+
+	if (mire->tag != RPMTAG_NAME)
+	    continue;
+
+	switch (mire->mode) {
+	case RPMMIRE_STRCMP:
+	    rc = indexGet(dbi, mire->pattern, 0, &set);
+	    break;
+	case RPMMIRE_GLOB:
+	    rc = indexGlobGet(dbi, mire->pattern, &set);
+	    break;
+	case RPMMIRE_REGEX:
+	    prefix = regexPrefix(mire->pattern);
+	    rc = prefix ? indexPrefixGet(dbi, prefix, 0, &set) : RPMRC_FAIL;
+	    free(prefix);
+	    break;
+	default:
+	    rc = RPMRC_FAIL;
+	    break;
+	}
+    }
+
+    if (rc == RPMRC_FAIL) {
+	dbiIndexSetFree(set);
+	return;
+    }
+
+    /* No candidates at all is a valid outcome too */
+    mi->mi_set = set ? set : dbiIndexSetNew(0);
+    rpmdbSortIterator(mi);
+    rpmdbUniqIterator(mi);
+}
+
 int rpmdbSetIteratorRewrite(rpmdbMatchIterator mi, int rewrite)
 {
     int rc;
@@ -1324,11 +1894,16 @@ static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
 
     /* Don't bother re-checking a previously read header. */
     int verifyonly = mi->mi_db->db_flags & RPMDB_FLAG_VERIFYONLY;
+    rpmVSFlags vsflags = rpmtsVSFlags(mi->mi_ts);
     if (!verifyonly) {
-	auto const & db_checked = mi->mi_db->db_checked;
+	auto & db_checked = mi->mi_db->db_checked;
 	auto entry = db_checked.find(mi->mi_offset);
-	if (entry != db_checked.end())
+	if (entry != db_checked.end()) {
 	    rpmrc = entry->second;
+	} else if (vfyCacheCheck(mi->mi_db, vsflags, mi->mi_offset, uh, uhlen)) {
+	    rpmrc = RPMRC_OK;
+	    db_checked.insert({mi->mi_offset, rpmrc});
+	}
     }
 
     /* If blob is unchecked, check blob import consistency now. */
@@ -1346,11 +1921,84 @@ static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
 	/* Mark header checked. */
 	if (mi->mi_db && !verifyonly) {
 	    mi->mi_db->db_checked.insert({mi->mi_offset, rpmrc});
+	    if (rpmrc == RPMRC_OK) {
+		vfyCacheAdd(mi->mi_db, vsflags, mi->mi_offset, uh, uhlen);
+	    }
 	}
     }
     return rpmrc;
 }
 
+/*
+ * Serve the current set member from a batch of headers fetched together
+ * with the upcoming members of the set, saving a backend round trip per
+ * header. The first member is left to the caller, so single result
+ * lookups don't pay for a batch. Returns non-zero if the caller needs
+ * to fetch the header itself.
+ */
+static int miPrefetchGet(rpmdbMatchIterator mi, dbiIndex dbi,
+			 unsigned char **uh, unsigned int *uhlen)
+{
+    struct miPrefetch_s & pf = mi->mi_pf;
+
+    /* Rewritten headers must not be served from a stale batch */
+    if (pf.disabled || (mi->mi_cflags & DBC_WRITE))
+	return 1;
+
+    /* Many lookups only ever want one header, batch from the second on */
+    if (!pf.started) {
+	pf.started = 1;
+	return 1;
+    }
+
+    if (pf.changes != mi->mi_db->db_changes)
+	miPrefetchFree(mi);
+
+    auto it = std::find(pf.hdrNums.begin(), pf.hdrNums.end(), mi->mi_offset);
+    if (it == pf.hdrNums.end()) {
+	unsigned int count = dbiIndexSetCount(mi->mi_set);
+
+	miPrefetchFree(mi);
+	/* mi_setx already points past the current member */
+	for (unsigned int i = mi->mi_setx - 1;
+		i < count && pf.hdrNums.size() < PKGDB_BATCH; i++) {
+	    unsigned int offset = dbiIndexRecordOffset(mi->mi_set, i);
+	    if (offset && !hdrCacheHas(mi->mi_db, offset) &&
+		    std::find(pf.hdrNums.begin(), pf.hdrNums.end(),
+			      offset) == pf.hdrNums.end()) {
+		pf.hdrNums.push_back(offset);
+	    }
+	}
+
+	/* Not worth the trouble for a single header */
+	if (pf.hdrNums.size() < 2) {
+	    pf.hdrNums.clear();
+	    return 1;
+	}
+
+	pf.blobs.resize(pf.hdrNums.size());
+	pf.lens.resize(pf.hdrNums.size());
+	rpmRC rc = pkgdbGetMany(dbi, mi->mi_dbc, pf.hdrNums.size(),
+				pf.hdrNums.data(), pf.blobs.data(),
+				pf.lens.data());
+	if (rc) {
+	    pf.disabled = (rc == RPMRC_NOTFOUND);
+	    miPrefetchFree(mi);
+	    return 1;
+	}
+	pf.changes = mi->mi_db->db_changes;
+	it = pf.hdrNums.begin();
+    }
+
+    size_t ix = it - pf.hdrNums.begin();
+    if (pf.blobs[ix] == NULL)
+	return 1;
+
+    *uh = pf.blobs[ix];
+    *uhlen = pf.lens[ix];
+    return 0;
+}
+
 /* FIX: mi->mi_key.data may be NULL */
 Header rpmdbNextIterator(rpmdbMatchIterator mi)
 {
@@ -1369,13 +2017,22 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
 #if defined(_USE_COPY_LOAD)
     importFlags |= HEADERIMPORT_COPY;
 #endif
+    /* Most consumers only look at a few tags, decode them on demand */
+    if (!(mi->mi_cflags & DBC_WRITE))
+	importFlags |= HEADERIMPORT_LAZY;
     /*
      * Cursors are per-iterator, not per-dbi, so get a cursor for the
      * iterator on 1st call. If the iteration is to rewrite headers,
      * then the cursor needs to marked with DBC_WRITE as well.
      */
-    if (mi->mi_dbc == NULL)
+    if (mi->mi_dbc == NULL) {
+	if (mi->mi_set == NULL && mi->mi_nre && mi->mi_rpmtag == RPMDBI_PACKAGES)
+	    miPushDown(mi);
 	mi->mi_dbc = dbiCursorInit(dbi, mi->mi_cflags);
+	if (mi->mi_set && !(mi->mi_cflags & DBC_WRITE) &&
+		!hdrCacheLocked(mi->mi_db))
+	    hdrCacheSync(mi->mi_db);
+    }
 
 top:
     uh = NULL;
@@ -1403,9 +2060,26 @@ top:
     if (mi->mi_prevoffset && mi->mi_offset == mi->mi_prevoffset)
 	return mi->mi_h;
 
+    /* Imported set members may be around in the header cache */
+    if (uh == NULL && !(mi->mi_cflags & DBC_WRITE)) {
+	Header h = hdrCacheGet(mi->mi_db, mi->mi_offset, importFlags);
+	if (h) {
+	    miFreeHeader(mi, dbi);
+	    mi->mi_h = h;
+	    headerSetInstance(mi->mi_h, mi->mi_offset);
+	    goto cached;
+	}
+    }
+
     /* Retrieve next header blob for index iterator. */
     if (uh == NULL) {
-	rc = pkgdbGet(dbi, mi->mi_dbc, mi->mi_offset, &uh, &uhlen);
+	rc = 1;
+#if defined(_USE_COPY_LOAD)
+	/* The batch keeps ownership of the blobs, so only with copy-load */
+	rc = miPrefetchGet(mi, dbi, &uh, &uhlen);
+#endif
+	if (rc)
+	    rc = pkgdbGet(dbi, mi->mi_dbc, mi->mi_offset, &uh, &uhlen);
 	if (rc)
 	    return NULL;
     }
@@ -1430,14 +2104,19 @@ top:
 		mi->mi_offset);
 	goto top;
     }
+    headerSetInstance(mi->mi_h, mi->mi_offset);
+
+    /* Lazy headers leave the blob untouched, safe to copy it from here */
+    if (mi->mi_set && !(mi->mi_cflags & DBC_WRITE))
+	hdrCachePut(mi->mi_db, mi->mi_offset, uh, uhlen);
 
+cached:
     /*
      * Skip this header if iterator selector (if any) doesn't match.
      */
     if (mireSkip(mi)) {
 	goto top;
     }
-    headerSetInstance(mi->mi_h, mi->mi_offset);
 
     mi->mi_prevoffset = mi->mi_offset;
     mi->mi_modified = 0;
@@ -1651,13 +2330,212 @@ static rpmdbMatchIterator indexIterInit(rpmdb db, rpmDbiTagVal rpmtag,
     return mi;
 }
 
-rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmDbiTagVal rpmtag,
-		const void * keyp, size_t keylen)
-{
-    rpmdbMatchIterator mi = NULL;
+/* A file path of a batched lookup, see rpmdbInitFileIterators() */
+struct fileQuery_s {
+    char *dirName;
+    const char *baseName;
+    fingerPrint *fp;
+    dbiIndexSet matches;
+};
 
-    if (db != NULL) {
-	if (rpmtag == RPMDBI_PACKAGES)
+/* Basename index entry of a queried path, ie a candidate match */
+struct fileCand_s {
+    unsigned int hdrNum;
+    unsigned int tagNum;
+    unsigned int qx;		/*!< index of the query */
+
+    bool operator<(const fileCand_s & o) const {
+	if (hdrNum != o.hdrNum)
+	    return hdrNum < o.hdrNum;
+	if (tagNum != o.tagNum)
+	    return tagNum < o.tagNum;
+	return qx < o.qx;
+    }
+};
+
+/*
+ * Batched rpmdbFindByFile(): look up each distinct basename once, in
+ * sorted order through a single index cursor, then load every candidate
+ * header once and match the fingerprints of all the paths it is a
+ * candidate for, using one fingerprint cache for the whole batch.
+ */
+static int rpmdbFindByFiles(rpmdb db, dbiIndex dbi, int usestate,
+			    vector<fileQuery_s> & queries)
+{
+    vector<unsigned int> order(queries.size());
+    vector<fileCand_s> cands;
+    vector<unsigned int> hdrNums;
+    fingerPrintCache fpc = NULL;
+    rpmdbMatchIterator mi = NULL;
+    dbiCursor dbc = NULL;
+    Header h;
+    size_t cx = 0;
+    int rc = 0;
+
+    for (unsigned int i = 0; i < order.size(); i++)
+	order[i] = i;
+    std::sort(order.begin(), order.end(),
+	[&queries](unsigned int a, unsigned int b) {
+	    return strcmp(queries[a].baseName, queries[b].baseName) < 0;
+	});
+
+    dbc = dbiCursorInit(dbi, DBC_READ);
+    for (size_t i = 0; i < order.size(); ) {
+	const char *baseName = queries[order[i]].baseName;
+	dbiIndexSet set = NULL;
+	size_t j = i;
+
+	while (j < order.size() && rstreq(queries[order[j]].baseName, baseName))
+	    j++;
+
+	rpmRC xx = idxdbGet(dbi, dbc, baseName, strlen(baseName), &set,
+			    DBC_NORMAL_SEARCH);
+	if (xx == RPMRC_FAIL) {
+	    dbiIndexSetFree(set);
+	    rc = -1;
+	    break;
+	}
+
+	for (unsigned int k = 0; set && k < dbiIndexSetCount(set); k++) {
+	    for (size_t q = i; q < j; q++) {
+		cands.push_back({ dbiIndexRecordOffset(set, k),
+				  dbiIndexRecordFileNumber(set, k), order[q] });
+	    }
+	}
+	dbiIndexSetFree(set);
+	i = j;
+    }
+    dbiCursorFree(dbi, dbc);
+
+    if (rc || cands.empty())
+	goto exit;
+
+    /* Group the candidates by header, each header gets loaded once */
+    std::sort(cands.begin(), cands.end());
+    for (auto const & c : cands) {
+	if (hdrNums.empty() || hdrNums.back() != c.hdrNum)
+	    hdrNums.push_back(c.hdrNum);
+    }
+
+    fpc = fpCacheCreate(cands.size(), NULL);
+    for (auto & q : queries)
+	fpLookup(fpc, q.dirName, q.baseName, &q.fp);
+
+    mi = rpmdbNewIterator(db, RPMDBI_PACKAGES);
+    if (mi == NULL) {
+	rc = -1;
+	goto exit;
+    }
+    rpmdbAppendIterator(mi, hdrNums.data(), hdrNums.size());
+    while ((h = rpmdbNextIterator(mi)) != NULL) {
+	unsigned int offset = rpmdbGetIteratorOffset(mi);
+	struct rpmtd_s bn, dn, di, fs;
+	const char ** baseNames, ** dirNames;
+	const uint32_t * dirIndexes;
+
+	/* Skip candidates of headers that failed to load */
+	while (cx < cands.size() && cands[cx].hdrNum < offset)
+	    cx++;
+
+	headerGet(h, RPMTAG_BASENAMES, &bn, HEADERGET_MINMEM);
+	headerGet(h, RPMTAG_DIRNAMES, &dn, HEADERGET_MINMEM);
+	headerGet(h, RPMTAG_DIRINDEXES, &di, HEADERGET_MINMEM);
+	baseNames = (const char **)bn.data;
+	dirNames = (const char **)dn.data;
+	dirIndexes = (const uint32_t *)di.data;
+	if (usestate)
+	    headerGet(h, RPMTAG_FILESTATES, &fs, HEADERGET_MINMEM);
+
+	for (; cx < cands.size() && cands[cx].hdrNum == offset; cx++) {
+	    struct fileQuery_s & q = queries[cands[cx].qx];
+	    unsigned int num = cands[cx].tagNum;
+
+	    if (usestate) {
+		rpmtdSetIndex(&fs, num);
+		if (!RPMFILE_IS_INSTALLED(rpmtdGetNumber(&fs)))
+		    continue;
+	    }
+
+	    if (fpLookupEquals(fpc, q.fp, dirNames[dirIndexes[num]],
+				baseNames[num])) {
+		if (q.matches == NULL)
+		    q.matches = dbiIndexSetNew(0);
+		dbiIndexSetAppendOne(q.matches, offset, num, 0);
+	    }
+	}
+
+	rpmtdFreeData(&bn);
+	rpmtdFreeData(&dn);
+	rpmtdFreeData(&di);
+	if (usestate)
+	    rpmtdFreeData(&fs);
+    }
+    rpmdbFreeIterator(mi);
+
+exit:
+    fpCacheFree(fpc);
+    return rc;
+}
+
+int rpmdbInitFileIterators(rpmdb db, rpmDbiTagVal rpmtag,
+			   const char * const * files, int nfiles,
+			   rpmdbMatchIterator * mis)
+{
+    vector<fileQuery_s> queries;
+    dbiIndex dbi = NULL;
+    int rc = -1;
+
+    if (db == NULL || files == NULL || mis == NULL || nfiles < 0)
+	return rc;
+    if (rpmtag != RPMDBI_BASENAMES && rpmtag != RPMDBI_INSTFILENAMES)
+	return rc;
+
+    for (int i = 0; i < nfiles; i++)
+	mis[i] = NULL;
+
+    if (indexOpen(db, RPMDBI_BASENAMES, 0, &dbi))
+	return rc;
+
+    queries.resize(nfiles);
+    for (int i = 0; i < nfiles; i++) {
+	struct fileQuery_s & q = queries[i];
+	const char *baseName = strrchr(files[i], '/');
+
+	if (baseName != NULL) {
+	    q.dirName = rstrndup(files[i], baseName - files[i] + 1);
+	    q.baseName = baseName + 1;
+	} else {
+	    q.dirName = xstrdup("");
+	    q.baseName = files[i];
+	}
+    }
+
+    rc = rpmdbFindByFiles(db, dbi, (rpmtag == RPMDBI_INSTFILENAMES), queries);
+
+    for (int i = 0; i < nfiles; i++) {
+	struct fileQuery_s & q = queries[i];
+
+	if (rc == 0 && q.matches) {
+	    mis[i] = rpmdbNewIterator(db, RPMDBI_BASENAMES);
+	    mis[i]->mi_set = q.matches;
+	    rpmdbSortIterator(mis[i]);
+	} else {
+	    dbiIndexSetFree(q.matches);
+	}
+	free(q.fp);
+	free(q.dirName);
+    }
+
+    return rc;
+}
+
+rpmdbMatchIterator rpmdbInitIterator(rpmdb db, rpmDbiTagVal rpmtag,
+		const void * keyp, size_t keylen)
+{
+    rpmdbMatchIterator mi = NULL;
+
+    if (db != NULL) {
+	if (rpmtag == RPMDBI_PACKAGES)
 	    mi = pkgdbIterInit(db, (unsigned int *)keyp, keylen);
 	else
 	    mi = indexIterInit(db, rpmtag, (const char *)keyp, keylen);
@@ -1901,12 +2779,13 @@ rpmdbIndexIterator rpmdbIndexIteratorFree(rpmdbIndexIterator ii)
     return NULL;
 }
 
-static void logAddRemove(const char *dbiname, int removing, rpmtd tagdata)
+static void logAddRemove(const char *dbiname, int removing,
+			 const struct idxKeys_s & keys)
 {
-    rpm_count_t c = rpmtdCount(tagdata);
-    if (c == 1 && rpmtdType(tagdata) == RPM_STRING_TYPE) {
+    rpm_count_t c = keys.count;
+    if (c == 1 && keys.type == RPM_STRING_TYPE && !keys.items.empty()) {
 	rpmlog(RPMLOG_DEBUG, "%s \"%s\" %s %s index.\n",
-		removing ? "removing" : "adding", rpmtdGetString(tagdata), 
+		removing ? "removing" : "adding", keys.items[0].key.c_str(),
 		removing ? "from" : "to", dbiname);
     } else if (c > 0) {
 	rpmlog(RPMLOG_DEBUG, "%s %d entries %s %s index.\n",
@@ -1947,6 +2826,7 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
     dbc = dbiCursorInit(dbi, DBC_WRITE);
     ret = pkgdbDel(dbi, dbc, hdrNum);
     dbiCursorFree(dbi, dbc);
+    hdrCacheDrop(db, hdrNum);
 
     /* Remove associated data from secondary indexes */
     if (ret == 0) {
@@ -1960,6 +2840,9 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
 	}
     }
 
+    dbCtrl(db, DB_CTRL_GENERATION);
+    hdrCacheChanged(db);
+    vfyCacheChanged(db, hdrNum);
     dbCtrl(db, DB_CTRL_INDEXSYNC);
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
     rpmsqBlock(SIG_UNBLOCK);
@@ -2022,11 +2905,10 @@ static rpmRC updateRichDepCB(void *cbdata, rpmrichParseType type,
     return RPMRC_OK;
 }
 
-static int updateRichDep(dbiIndex dbi, dbiCursor dbc, const char *str,
-                           struct dbiIndexItem_s *rec,
-                           idxfunc idxupdate)
+static void richDepKeys(const char *str, unsigned int tagNum,
+			struct idxKeys_s & keys)
 {
-    int n, i, rc = 0;
+    int n, i;
     struct updateRichDepData data;
 
     data.argv = argvNew();
@@ -2044,22 +2926,22 @@ static int updateRichDep(dbiIndex dbi, dbiCursor dbc, const char *str,
 		    continue;       /* ignore dups */
 		if (*name == ' ')
 		    name++;
-		rc += idxupdate(dbi, dbc, name, strlen(name), rec);
+		keys.items.push_back({name, tagNum});
 	    }
 	}
     }
     _free(data.nargv_level);
     argvFree(data.argv);
-    return rc;
 }
 
-rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
-		       unsigned int hdrNum, Header h,
-		       idxfunc idxupdate)
+void tag2keys(rpmTagVal rpmtag, Header h, struct idxKeys_s & keys)
 {
-    int i, rc = 0;
+    int i;
     struct rpmtd_s tagdata, reqflags, trig_index;
-    dbiCursor dbc = NULL;
+
+    keys.count = 0;
+    keys.type = RPM_NULL_TYPE;
+    keys.items.clear();
 
     switch (rpmtag) {
     case RPMTAG_REQUIRENAME:
@@ -2084,27 +2966,26 @@ rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
 	tagdata.count = 1;
     }
 
-    dbc = dbiCursorInit(dbi, DBC_WRITE);
+    keys.count = rpmtdCount(&tagdata);
+    keys.type = rpmtdType(&tagdata);
+    keys.items.reserve(keys.count);
 
-    logAddRemove(dbiName(dbi), 0, &tagdata);
     while ((i = rpmtdNext(&tagdata)) >= 0) {
 	const void * key = NULL;
 	unsigned int keylen = 0;
+	unsigned int tagNum;
 	int j;
-	struct dbiIndexItem_s rec;
 
 	switch (rpmtag) {
 	/* Include trigger index in db index for triggers */
 	case RPMTAG_FILETRIGGERNAME:
 	case RPMTAG_TRANSFILETRIGGERNAME:
-	    rec.hdrNum = hdrNum;
-	    rec.tagNum = *rpmtdNextUint32(&trig_index);
+	    tagNum = *rpmtdNextUint32(&trig_index);
 	    break;
 
 	/* Include the tagNum in the others indices (only files use though) */
 	default:
-	    rec.hdrNum = hdrNum;
-	    rec.tagNum = i;
+	    tagNum = i;
 	    break;
 	}
 
@@ -2135,7 +3016,7 @@ rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
 	if ((key = td2key(&tagdata, &keylen)) == NULL)
 	    continue;
 
-	rc += idxupdate(dbi, dbc, (const char *)key, keylen, &rec);
+	keys.items.push_back({std::string((const char *)key, keylen), tagNum});
 
 	if (*(char *)key == '(') {
 	    switch (rpmtag) {
@@ -2145,20 +3026,39 @@ rpmRC tag2index(dbiIndex dbi, rpmTagVal rpmtag,
 	    case RPMTAG_SUPPLEMENTNAME:
 	    case RPMTAG_RECOMMENDNAME:
 	    case RPMTAG_ENHANCENAME:
-		if (rpmtdType(&tagdata) == RPM_STRING_ARRAY_TYPE) {
-		    rc += updateRichDep(dbi, dbc, rpmtdGetString(&tagdata),
-			&rec, idxupdate);
-		}
+		if (rpmtdType(&tagdata) == RPM_STRING_ARRAY_TYPE)
+		    richDepKeys(rpmtdGetString(&tagdata), tagNum, keys);
 	    default:
 		break;
 	    }
 	}
     }
 
-    dbiCursorFree(dbi, dbc);
-
 exit:
     rpmtdFreeData(&tagdata);
+}
+
+rpmRC keys2index(dbiIndex dbi, unsigned int hdrNum,
+		const struct idxKeys_s & keys, idxfunc idxupdate)
+{
+    int rc = 0;
+    dbiCursor dbc = NULL;
+
+    if (keys.count == 0)
+	return RPMRC_OK;
+
+    dbc = dbiCursorInit(dbi, DBC_WRITE);
+
+    logAddRemove(dbiName(dbi), 0, keys);
+    for (auto const & item : keys.items) {
+	struct dbiIndexItem_s rec;
+	rec.hdrNum = hdrNum;
+	rec.tagNum = item.tagNum;
+	rc += idxupdate(dbi, dbc, item.key.data(), item.key.size(), &rec);
+    }
+
+    dbiCursorFree(dbi, dbc);
+
     return (rc == 0) ? RPMRC_OK : RPMRC_FAIL;
 }
 
@@ -2174,27 +3074,22 @@ static bool validHeader(Header h)
     return true;
 }
 
-int rpmdbAdd(rpmdb db, Header h)
+/*
+ * Add an exported header blob and its index keys to the database. If keys
+ * is NULL, the index keys are generated from the header here.
+ */
+static int rpmdbAddBlob(rpmdb db, Header h, uint8_t *hdrBlob,
+			unsigned int hdrLen,
+			const std::vector<idxKeys_s> *keys)
 {
     dbiIndex dbi = NULL;
     dbiCursor dbc = NULL;
     unsigned int hdrNum = 0;
-    unsigned int hdrLen = 0;
-    uint8_t *hdrBlob = NULL;
     int ret = 0;
 
-    if (db == NULL)
-	return 0;
-
-    hdrBlob = (uint8_t *)headerExport(h, &hdrLen);
-    if (!validHeader(h) || hdrBlob == NULL || hdrLen == 0) {
-	ret = -1;
-	goto exit;
-    }
-
     ret = pkgdbOpen(db, 0, &dbi);
     if (ret)
-	goto exit;
+	return ret;
 	
     rpmsqBlock(SIG_BLOCK);
     dbCtrl(db, DB_CTRL_LOCK_RW);
@@ -2203,6 +3098,7 @@ int rpmdbAdd(rpmdb db, Header h)
     dbc = dbiCursorInit(dbi, DBC_WRITE);
     ret = pkgdbPut(dbi, dbc, &hdrNum, hdrBlob, hdrLen);
     dbiCursorFree(dbi, dbc);
+    hdrCacheDrop(db, hdrNum);
 
     /* Add associated data to secondary indexes */
     if (ret == 0) {	
@@ -2212,10 +3108,16 @@ int rpmdbAdd(rpmdb db, Header h)
 	    if (indexOpen(db, rpmtag, 0, &dbi))
 		continue;
 
-	    ret += idxdbPut(dbi, rpmtag, hdrNum, h);
+	    if (keys)
+		ret += idxdbPutKeys(dbi, hdrNum, (*keys)[dbix]);
+	    else
+		ret += idxdbPut(dbi, rpmtag, hdrNum, h);
 	}
     }
 
+    dbCtrl(db, DB_CTRL_GENERATION);
+    hdrCacheChanged(db);
+    vfyCacheChanged(db, hdrNum);
     dbCtrl(db, DB_CTRL_INDEXSYNC);
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
     rpmsqBlock(SIG_UNBLOCK);
@@ -2229,12 +3131,55 @@ int rpmdbAdd(rpmdb db, Header h)
 	}
     }
 
+    return ret;
+}
+
+int rpmdbAdd(rpmdb db, Header h)
+{
+    unsigned int hdrLen = 0;
+    uint8_t *hdrBlob = NULL;
+    int ret = 0;
+
+    if (db == NULL)
+	return 0;
+
+    hdrBlob = (uint8_t *)headerExport(h, &hdrLen);
+    if (!validHeader(h) || hdrBlob == NULL || hdrLen == 0) {
+	ret = -1;
+	goto exit;
+    }
+
+    ret = rpmdbAddBlob(db, h, hdrBlob, hdrLen, NULL);
+
 exit:
     free(hdrBlob);
 
     return ret;
 }
 
+int rpmdbSnapshot(rpmdb db)
+{
+    std::vector<dbiIndex> indexes;
+    int rc = 0;
+
+    if (db == NULL || rpmExpandNumeric("%{?_db_snapshot}") <= 0)
+	return 0;
+
+    if (pkgdbOpen(db, 0, NULL))
+	return 1;
+    for (int dbix = 0; dbix < db->db_ndbi; dbix++) {
+	dbiIndex dbi = NULL;
+	if (indexOpen(db, db->db_tags[dbix], 0, &dbi) == 0)
+	    indexes.push_back(dbi);
+    }
+
+    dbCtrl(db, DB_CTRL_LOCK_RO);
+    rc = dbSnapshotWrite(db, db->db_pkgs, indexes);
+    dbCtrl(db, DB_CTRL_UNLOCK_RO);
+
+    return rc;
+}
+
 static int rpmdbRemoveFiles(char * pattern)
 {
     int rc = 0;
@@ -2358,6 +3303,215 @@ static int rpmdbSetPermissions(char * src, char * dest)
     return rc;
 }
 
+/* A header on its way from the old database to the new one */
+struct rebuildRec_s {
+    unsigned int offset;	/*!< header instance in old db */
+    unsigned char *uh;		/*!< header blob from old db */
+    unsigned int uhlen;		/*!< header blob length */
+    rpmRC rc;			/*!< header check result */
+    char *msg;			/*!< header check message */
+    Header h;			/*!< imported header */
+    uint8_t *hdrBlob;		/*!< header blob for new db */
+    unsigned int hdrLen;	/*!< header blob length for new db */
+    std::vector<idxKeys_s> keys;	/*!< index keys for new db */
+};
+
+/* Check and import a header blob, safe to run in parallel */
+static void rebuildDecode(struct rebuildRec_s & r, rpmts ts,
+		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg))
+{
+    if (ts && hdrchk)
+	r.rc = hdrchk(ts, r.uh, r.uhlen, &r.msg);
+
+    if (r.rc != RPMRC_FAIL) {
+	r.h = headerImport(r.uh, r.uhlen, HEADERIMPORT_FAST);
+	/* On success the header owns the blob */
+	if (r.h)
+	    r.uh = NULL;
+    }
+}
+
+/* Export the header and generate its index keys, safe to run in parallel */
+static void rebuildKeys(struct rebuildRec_s & r, rpmdb db)
+{
+    if (r.h == NULL || !validHeader(r.h))
+	return;
+
+    r.hdrBlob = (uint8_t *)headerExport(r.h, &r.hdrLen);
+    r.keys.resize(db->db_ndbi);
+    for (int dbix = 0; dbix < db->db_ndbi; dbix++)
+	tag2keys(db->db_tags[dbix], r.h, r.keys[dbix]);
+}
+
+/* Add a prepared header to the new database, in the original order */
+static int rebuildWrite(struct rebuildRec_s & r, rpmdb db, rpmts ts,
+		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg))
+{
+    if (ts && hdrchk) {
+	int lvl = (r.rc == RPMRC_FAIL ? RPMLOG_ERR : RPMLOG_DEBUG);
+	rpmlog(lvl, "%s h#%8u %s\n",
+	    (r.rc == RPMRC_FAIL ? _("rpmdbNextIterator: skipping") : " read"),
+		    r.offset, (r.msg ? r.msg : ""));
+	if (r.rc == RPMRC_FAIL)
+	    return 0;
+    }
+
+    if (r.h == NULL || !headerIsEntry(r.h, RPMTAG_NAME)) {
+	rpmlog(RPMLOG_ERR,
+		_("rpmdb: damaged header #%u retrieved -- skipping.\n"),
+		r.offset);
+	return 0;
+    }
+
+    /* let's sanity check this record a bit, otherwise just skip it */
+    if (!validHeader(r.h)) {
+	rpmlog(RPMLOG_ERR,
+		_("header #%u in the database is bad -- skipping.\n"),
+		r.offset);
+	return 0;
+    }
+
+    if (r.hdrBlob == NULL || r.hdrLen == 0 ||
+	    rpmdbAddBlob(db, r.h, r.hdrBlob, r.hdrLen, &r.keys)) {
+	rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
+	       r.offset);
+	return 1;
+    }
+    return 0;
+}
+
+static void rebuildFree(struct rebuildRec_s & r)
+{
+    free(r.uh);
+    free(r.msg);
+    headerFree(r.h);
+    free(r.hdrBlob);
+}
+
+static void rebuildLogStat(const char *name, struct rpmop_s * op)
+{
+    static const unsigned int scale = (1000 * 1000);
+    rpmlog(RPMLOG_DEBUG, "rebuilddb %s %6lu.%06lu MB %6lu.%06lu secs\n",
+	    name,
+	    (unsigned long)op->bytes/scale, (unsigned long)op->bytes%scale,
+	    op->usecs/scale, op->usecs%scale);
+}
+
+/*
+ * Copy all headers from olddb to newdb. Headers are read from olddb in
+ * batches, checked, imported and turned into index keys on
+ * %_rebuilddb_threads threads and then written to newdb one by one in
+ * their original order, so the end result does not depend on the number
+ * of threads.
+ */
+static int rebuildHeaders(rpmdb olddb, rpmdb newdb, rpmts ts,
+		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg))
+{
+    dbiIndex dbi = NULL;
+    dbiCursor dbc = NULL;
+    int nthreads = rpmExpandThreads("_rebuilddb_threads");
+    size_t batch = 64 * nthreads;
+    struct rpmop_s readop = {}, decodeop = {}, keysop = {}, writeop = {};
+    std::vector<rebuildRec_s> recs;
+    unsigned int nget = 0, nread = 0;
+    int done = 0;
+    int failed = 0;
+
+    if (pkgdbOpen(olddb, 0, &dbi))
+	return 0;
+
+    /* Load the keyring now, the checks below share it between threads */
+    if (ts && hdrchk)
+	rpmKeyringFree(rpmtsGetKeyring(ts, 1));
+
+    dbc = dbiCursorInit(dbi, 0);
+    recs.reserve(batch);
+
+    while (!done && !failed) {
+	unsigned char *uh;
+	unsigned int uhlen;
+
+	/* Stage 0: read a batch of header blobs */
+	(void) rpmswEnter(&readop, 0);
+	while (recs.size() < batch) {
+	    if (pkgdbGet(dbi, dbc, 0, &uh, &uhlen)) {
+		done = 1;
+		break;
+	    }
+	    /* Terminate on end of keys, like rpmdbNextIterator() does */
+	    unsigned int offset = pkgdbKey(dbi, dbc);
+	    if (offset == 0) {
+		if (nget++) {
+		    done = 1;
+		    break;
+		}
+		continue;
+	    }
+	    nget++;
+	    nread++;
+	    struct rebuildRec_s r = {};
+	    r.offset = offset;
+	    r.uh = (unsigned char *)memcpy(xmalloc(uhlen), uh, uhlen);
+	    r.uhlen = uhlen;
+	    r.rc = RPMRC_NOTFOUND;
+	    recs.push_back(std::move(r));
+	    readop.bytes += uhlen;
+	}
+	(void) rpmswExit(&readop, 0);
+
+	/* Stage 1: check and import the headers */
+	(void) rpmswEnter(&decodeop, 0);
+	#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+	{
+	    /* Digest statistics of ts can't be shared between threads */
+	    struct rpmop_s digestop = {};
+	    headerCheckSetStats(&digestop);
+
+	    #pragma omp for schedule(dynamic)
+	    for (size_t i = 0; i < recs.size(); i++)
+		rebuildDecode(recs[i], ts, hdrchk);
+
+	    headerCheckSetStats(NULL);
+	    #pragma omp critical(rebuild_digestop)
+	    if (ts)
+		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST), &digestop);
+	}
+	(void) rpmswExit(&decodeop, 0);
+
+	/* Stage 2: generate the new header blobs and index keys */
+	(void) rpmswEnter(&keysop, 0);
+	#pragma omp parallel for schedule(dynamic) num_threads(nthreads) if(nthreads > 1)
+	for (size_t i = 0; i < recs.size(); i++)
+	    rebuildKeys(recs[i], newdb);
+	(void) rpmswExit(&keysop, 0);
+
+	/* Stage 3: write out in the original order */
+	(void) rpmswEnter(&writeop, 0);
+	for (auto & r : recs) {
+	    if (!failed) {
+		failed = rebuildWrite(r, newdb, ts, hdrchk);
+		if (!failed)
+		    writeop.bytes += r.hdrLen;
+	    }
+	    rebuildFree(r);
+	}
+	(void) rpmswExit(&writeop, 0);
+
+	recs.clear();
+    }
+
+    dbiCursorFree(dbi, dbc);
+
+    rpmlog(RPMLOG_DEBUG, "rebuilddb read %u headers using %d thread(s)\n",
+	    nread, nthreads);
+    rebuildLogStat("read:  ", &readop);
+    rebuildLogStat("decode:", &decodeop);
+    rebuildLogStat("keys:  ", &keysop);
+    rebuildLogStat("write: ", &writeop);
+
+    return failed;
+}
+
 int rpmdbRebuild(const char * prefix, rpmts ts,
 		rpmRC (*hdrchk) (rpmts ts, const void *uh, size_t uc, char ** msg),
 		int rebuildflags)
@@ -2412,35 +3566,7 @@ int rpmdbRebuild(const char * prefix, rpmts ts,
 	goto exit;
     }
 
-    {	Header h = NULL;
-	rpmdbMatchIterator mi;
-
-	mi = rpmdbInitIterator(olddb, RPMDBI_PACKAGES, NULL, 0);
-	if (ts && hdrchk)
-	    (void) rpmdbSetHdrChk(mi, ts, hdrchk);
-
-	while ((h = rpmdbNextIterator(mi)) != NULL) {
-
-	    /* let's sanity check this record a bit, otherwise just skip it */
-	    if (!validHeader(h)) {
-		rpmlog(RPMLOG_ERR,
-			_("header #%u in the database is bad -- skipping.\n"),
-			rpmdbGetIteratorOffset(mi));
-		continue;
-	    }
-
-	    rc = rpmdbAdd(newdb, h);
-	    if (rc) {
-		rpmlog(RPMLOG_ERR, _("cannot add record originally at %u\n"),
-		       rpmdbGetIteratorOffset(mi));
-		failed = 1;
-		break;
-	    }
-	}
-
-	rpmdbFreeIterator(mi);
-
-    }
+    failed = rebuildHeaders(olddb, newdb, ts, hdrchk);
 
     rpmdbClose(olddb);
     dbCtrl(newdb, DB_CTRL_INDEXSYNC);
@@ -2501,10 +3627,21 @@ int rpmdbCtrl(rpmdb db, rpmdbCtrlOp ctrl)
 	dbctrl = DB_CTRL_INDEXSYNC;
 	break;
     }
-    return dbctrl ? dbCtrl(db, dbctrl) : 1;
+    int rc = dbctrl ? dbCtrl(db, dbctrl) : 1;
+    if (rc == 0)
+	hdrCacheLock(db, ctrl);
+    return rc;
 }
 
-char *rpmdbCookie(rpmdb db)
+int rpmdbGeneration(rpmdb db, uint64_t *generation)
+{
+    if (db == NULL || generation == NULL || pkgdbOpen(db, 0, NULL))
+	return 1;
+    return dbGeneration(db, generation);
+}
+
+/* Fallback for backends without a change generation: hash the Name index */
+static char *indexCookie(rpmdb db)
 {
     void *cookie = NULL;
     rpmdbIndexIterator ii = rpmdbIndexIteratorInit(db, RPMDBI_NAME);
@@ -2525,6 +3662,46 @@ char *rpmdbCookie(rpmdb db)
     return (char *)cookie;
 }
 
+/*
+ * The generation only identifies a state of one particular database file,
+ * mix in the file identity so a rebuilt database doesn't hand out the
+ * cookies of its predecessor.
+ */
+char *rpmdbCookie(rpmdb db)
+{
+    void *cookie = NULL;
+    uint64_t generation = 0;
+    int rc = rpmdbGeneration(db, &generation);
+
+    if (rc < 0)
+	return indexCookie(db);
+    if (rc > 0)
+	return NULL;
+
+    DIGEST_CTX ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+    const char *name = db->db_ops->name;
+    struct stat sb = {};
+    int havestat = 0;
+
+    /* A snapshot stands for its primary, the cookie must not change */
+    if (dbSnapshotPrimary(db, &name, &sb.st_dev, &sb.st_ino) == 0) {
+	havestat = 1;
+    } else if (db->db_ops->path) {
+	char *path = rpmGenPath(rpmdbHome(db), db->db_ops->path, NULL);
+	havestat = (stat(path, &sb) == 0);
+	free(path);
+    }
+    if (havestat) {
+	rpmDigestUpdate(ctx, &sb.st_dev, sizeof(sb.st_dev));
+	rpmDigestUpdate(ctx, &sb.st_ino, sizeof(sb.st_ino));
+    }
+    rpmDigestUpdate(ctx, name, strlen(name));
+    rpmDigestUpdate(ctx, &generation, sizeof(generation));
+    rpmDigestFinal(ctx, &cookie, NULL, 1);
+
+    return (char *)cookie;
+}
+
 int rpmdbFStat(rpmdb db, struct stat *statbuf)
 {
     int rc = -1;
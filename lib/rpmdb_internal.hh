@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <unordered_map>
 
+#include <rpm/rpmdb.h>
 #include <rpm/rpmsw.h>
 #include <rpm/rpmtypes.h>
 #include <rpm/rpmutil.h>
@@ -15,6 +16,16 @@ enum rpmdbRebuildFlags_e {
     RPMDB_REBUILD_FLAG_SALVAGE	= (1 << 0),
 };
 
+/*
+ * Cache statistics. These are numbered past RPMDB_OP_MAX instead of
+ * being part of the public rpmdbOpX, so its values don't change.
+ */
+static constexpr rpmdbOpX RPMDB_OP_STMTHIT = rpmdbOpX(RPMDB_OP_MAX + 0);
+static constexpr rpmdbOpX RPMDB_OP_STMTMISS = rpmdbOpX(RPMDB_OP_MAX + 1);
+static constexpr rpmdbOpX RPMDB_OP_HDRHIT = rpmdbOpX(RPMDB_OP_MAX + 2);
+static constexpr rpmdbOpX RPMDB_OP_HDRMISS = rpmdbOpX(RPMDB_OP_MAX + 3);
+static constexpr int RPMDB_OP_INTERNAL_MAX = RPMDB_OP_MAX + 4;
+
 /** \ingroup rpmdb
  * Reference a database instance.
  * @param db		rpm database
@@ -89,6 +100,15 @@ int rpmdbAdd(rpmdb db, Header h);
 RPM_GNUC_INTERNAL
 int rpmdbRemove(rpmdb db, unsigned int hdrNum);
 
+/** \ingroup rpmdb
+ * Write a read-only query snapshot of the database, if enabled
+ * with %_db_snapshot.
+ * @param db		rpm database
+ * @return		0 on success
+ */
+RPM_GNUC_INTERNAL
+int rpmdbSnapshot(rpmdb db);
+
 /** \ingroup rpmdb
  * Return rpmdb home directory (depending on chroot state)
  * param db		rpmdb handle
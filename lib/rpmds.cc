@@ -12,6 +12,7 @@
 #include <rpm/rpmbase64.h>
 
 #include "rpmds_internal.hh"
+#include "rpmver_internal.hh"
 
 #include "debug.h"
 
@@ -927,7 +928,7 @@ int rpmdsSearch(rpmds ds, rpmds ods)
 
 int rpmdsCompareIndex(rpmds A, int aix, rpmds B, int bix)
 {
-    const char *AEVR, *BEVR;
+    rpmver av, bv;
     rpmsenseFlags AFlags, BFlags;
     int result;
 
@@ -952,20 +953,15 @@ int rpmdsCompareIndex(rpmds A, int aix, rpmds B, int bix)
 	goto exit;
     }
 
-    AEVR = rpmdsEVRIndex(A, aix);
-    BEVR = rpmdsEVRIndex(B, bix);
-    if (!(AEVR && *AEVR && BEVR && *BEVR)) {
+    /* The same EVRs get compared over and over, use the pool's parses. */
+    av = rpmstrPoolVer(A->pool, rpmdsEVRIdIndex(A, aix));
+    bv = rpmstrPoolVer(B->pool, rpmdsEVRIdIndex(B, bix));
+    if (!(av && bv)) {
 	/* If either EVR is non-existent or empty, always overlap. */
 	result = 1;
     } else {
 	/* Both AEVR and BEVR exist, compare [epoch:]version[-release]. */
-	rpmver av = rpmverParse(AEVR);
-	rpmver bv = rpmverParse(BEVR);
-
 	result = rpmverOverlap(av, AFlags, bv, BFlags);
-
-	rpmverFree(av);
-	rpmverFree(bv);
     }
 
 exit:
@@ -108,6 +108,10 @@ struct rpmfiles_s {
     uint32_t * fddictn;		/*!< File depends dictionary count (header) */
     rpm_flag_t * vflags;	/*!< File verify flag(s) (from header) */
 
+    uint64_t * pframes;		/*!< File content payload frame (header) */
+    uint64_t * poffsets;	/*!< File content offset in frame (header) */
+    rpmsid pcompr;		/*!< Payload compressor (pool) */
+
     rpmfiFlags fiflags;		/*!< file info set control flags */
 
     struct fingerPrint * fps;	/*!< File fingerprint(s). */
@@ -1271,6 +1275,8 @@ rpmfiles rpmfilesFree(rpmfiles fi)
 	    fi->ddict = _free(fi->ddict);
 	    fi->fddictx = _free(fi->fddictx);
 	    fi->fddictn = _free(fi->fddictn);
+	    fi->pframes = _free(fi->pframes);
+	    fi->poffsets = _free(fi->poffsets);
 
 	}
     }
@@ -1614,6 +1620,13 @@ static int rpmfilesPopulate(rpmfiles fi, Header h, rpmfiFlags flags)
     /* FILELANGS are only interesting when installing */
     if ((headerGetInstance(h) == 0) && !(flags & RPMFI_NOFILELANGS))
 	fi->flangs = tag2pool(fi->pool, h, RPMTAG_FILELANGS, totalfc);
+    /* Payload index is only useful with the package file at hand */
+    if (headerGetInstance(h) == 0 && headerIsEntry(h, RPMTAG_FILEPAYLOADFRAMES)) {
+	_hgfi(h, RPMTAG_FILEPAYLOADFRAMES, &td, scareFlags, fi->pframes);
+	_hgfi(h, RPMTAG_FILEPAYLOADOFFSETS, &td, scareFlags, fi->poffsets);
+	fi->pcompr = rpmstrPoolId(fi->pool,
+			headerGetString(h, RPMTAG_PAYLOADCOMPRESSOR), 1);
+    }
 
     /* See if the package has non-md5 file digests */
     fi->digestalgo = RPM_HASH_MD5;
@@ -2017,6 +2030,57 @@ rpm_loff_t rpmfiArchiveTell(rpmfi fi)
     return (rpm_loff_t) rpmcpioTell(fi->archive);
 }
 
+FD_t rpmfilesFOpenContent(rpmfiles files, int ix, FD_t fd,
+			  rpm_loff_t payloadoff)
+{
+    FD_t dfd = NULL;
+    FD_t payload = NULL;
+    char buf[BUFSIZ];
+    off_t pos;
+
+    if (files == NULL || ix < 0 || (rpm_count_t)ix >= rpmfilesFC(files))
+	return NULL;
+    if (files->pframes == NULL || files->poffsets == NULL ||
+	    files->pframes[ix] == UINT64_MAX)
+	return NULL;
+
+    /* The duplicate shares the file position, restore it on failure */
+    pos = lseek(Fileno(fd), 0, SEEK_CUR);
+    if (pos < 0)
+	return NULL;
+    dfd = fdDup(Fileno(fd));
+    if (dfd == NULL)
+	goto err;
+    if (Fseek(dfd, payloadoff + files->pframes[ix], SEEK_SET) < 0)
+	goto err;
+
+    {
+	const char *compr = rpmstrPoolStr(files->pool, files->pcompr);
+	char *ioflags = rstrscat(NULL, "r.", compr ? compr : "gzip", NULL);
+	payload = Fdopen(dfd, ioflags);
+	free(ioflags);
+    }
+    if (payload == NULL)
+	goto err;
+
+    /* Skip to the file content within the frame */
+    for (uint64_t left = files->poffsets[ix]; left > 0; ) {
+	ssize_t len = (left > sizeof(buf)) ? sizeof(buf) : left;
+	if (Fread(buf, 1, len, payload) != len || Ferror(payload))
+	    goto err;
+	left -= len;
+    }
+    return payload;
+
+err:
+    if (payload)
+	Fclose(payload);
+    else if (dfd)
+	Fclose(dfd);
+    (void) lseek(Fileno(fd), pos, SEEK_SET);
+    return NULL;
+}
+
 static int rpmfiArchiveWriteHeader(rpmfi fi)
 {
     int rc;
@@ -1996,6 +1996,26 @@ int rpmIsKnownArch(const char *name)
     return known;
 }
 
+int rpmExpandThreads(const char *macro)
+{
+    int nthreads = 1;
+#ifdef ENABLE_OPENMP
+    if (rpmMacroIsDefined(NULL, macro)) {
+	char *m = rstrscat(NULL, "%{", macro, "}", NULL);
+	int nthreads_max = rpmExpandNumeric("%{?_smp_nthreads_max}");
+	nthreads = rpmExpandNumeric(m);
+	if (nthreads <= 0)
+	    nthreads = rpmExpandNumeric("%{getncpus:thread}");
+	if (nthreads_max > 0 && nthreads > nthreads_max)
+	    nthreads = nthreads_max;
+	if (nthreads < 1)
+	    nthreads = 1;
+	free(m);
+    }
+#endif
+    return nthreads;
+}
+
 void rpmGetArchInfo(const char ** name, int * num)
 {
     rpmrcCtx ctx = rpmrcCtxAcquire();
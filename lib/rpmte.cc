@@ -17,6 +17,7 @@
 #include <rpm/rpmlog.h>
 
 #include "misc.hh"
+#include "rpmio_internal.hh"	/* fdReadAhead */
 #include "rpmplugins.hh"
 #include "rpmte_internal.hh"
 /* strpool-related interfaces */
@@ -72,6 +73,7 @@ struct rpmte_s {
     int nrelocs;		/*!< (TR_ADDED) No. of relocations. */
     uint8_t *badrelocs;		/*!< (TR_ADDED) Bad relocations (or NULL) */
     FD_t fd;			/*!< (TR_ADDED) Payload file descriptor. */
+    FD_t payload;		/*!< (TR_ADDED) Payload opened ahead of time. */
     int verified;		/*!< (TR_ADDED) Verification status */
     int addop;			/*!< (TR_ADDED) RPMTE_INSTALL/UPDATE/REINSTALL */
 
@@ -626,6 +628,10 @@ static int rpmteClose(rpmte te, int reset_fi)
 
     switch (te->type) {
     case TR_ADDED:
+	if (te->payload) {
+	    Fclose(te->payload);
+	    te->payload = NULL;
+	}
 	if (te->fd) {
 	    rpmtsNotify(te->ts, te, RPMCALLBACK_INST_CLOSE_FILE, 0, 0);
 	    te->fd = NULL;
@@ -647,18 +653,55 @@ static int rpmteClose(rpmte te, int reset_fi)
     return 1;
 }
 
-FD_t rpmtePayload(rpmte te)
+/* Payload read-ahead buffer size in bytes, 0 if disabled */
+static size_t payloadReadAhead(void)
+{
+    int kbytes = rpmExpandNumeric("%{?_payload_readahead}");
+    return (kbytes > 0) ? (size_t)kbytes * 1024 : 0;
+}
+
+/* Decompression thread flag for payload types that support it */
+static char *payloadThreads(const char *compr)
+{
+    char *threads = NULL;
+    if (compr && (rstreq(compr, "zstd") || rstreq(compr, "xz")) &&
+	    rpmMacroIsDefined(NULL, "_payload_threads")) {
+	int nthreads = rpmExpandNumeric("%{_payload_threads}");
+	rasprintf(&threads, "T%d", nthreads > 0 ? nthreads : 0);
+    }
+    return threads;
+}
+
+static FD_t rpmteOpenPayload(rpmte te, size_t readahead)
 {
     FD_t payload = NULL;
     if (te->fd && te->h) {
 	const char *compr = headerGetString(te->h, RPMTAG_PAYLOADCOMPRESSOR);
-	char *ioflags = rstrscat(NULL, "r.", compr ? compr : "gzip", NULL);
+	char *threads = payloadThreads(compr);
+	char *ioflags = rstrscat(NULL, "r", threads ? threads : "", ".",
+				 compr ? compr : "gzip", NULL);
 	payload = Fdopen(fdDup(Fileno(te->fd)), ioflags);
 	free(ioflags);
+	free(threads);
+	/* Decompress on a separate thread while the consumer does its thing */
+	if (payload && readahead)
+	    fdReadAhead(payload, readahead);
     }
     return payload;
 }
 
+FD_t rpmtePayload(rpmte te)
+{
+    FD_t payload = te->payload;
+
+    /* Hand over the payload if it was opened ahead of time */
+    if (payload)
+	te->payload = NULL;
+    else
+	payload = rpmteOpenPayload(te, payloadReadAhead());
+    return payload;
+}
+
 static int rpmteMarkFailed(rpmte te)
 {
     te->failed++;
@@ -824,6 +867,17 @@ int rpmteProcess(rpmte te, pkgGoal goal, int num)
 			rpmtsMembers(te->ts)->order.size());
 	}
 
+	/*
+	 * With read-ahead enabled, start decompressing the payload right
+	 * away so it overlaps with the scriptlets and triggers running
+	 * before the files are unpacked.
+	 */
+	if (goal == PKG_INSTALL && !test && te->type == TR_ADDED) {
+	    size_t readahead = payloadReadAhead();
+	    if (readahead)
+		te->payload = rpmteOpenPayload(te, readahead);
+	}
+
 	failed = rpmpsmRun(te->ts, te, goal);
 	rpmteClose(te, reset_fi);
     }
@@ -75,6 +75,14 @@ int rpmtsCloseDB(rpmts ts)
 			rpmdbOp(ts->rdb, RPMDB_OP_DBPUT));
 	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBDEL),
 			rpmdbOp(ts->rdb, RPMDB_OP_DBDEL));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_STMTHIT),
+			rpmdbOp(ts->rdb, RPMDB_OP_STMTHIT));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_STMTMISS),
+			rpmdbOp(ts->rdb, RPMDB_OP_STMTMISS));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_HDRHIT),
+			rpmdbOp(ts->rdb, RPMDB_OP_HDRHIT));
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_HDRMISS),
+			rpmdbOp(ts->rdb, RPMDB_OP_HDRMISS));
 	rc = rpmdbClose(ts->rdb);
 	ts->rdb = NULL;
     }
@@ -244,6 +252,32 @@ exit:
     return mi;
 }
 
+int rpmtsInitFileIterators(const rpmts ts, rpmDbiTagVal rpmtag,
+			const char * const * files, int nfiles,
+			rpmdbMatchIterator * mis)
+{
+    int rc;
+
+    if (ts == NULL)
+	return -1;
+
+    if (ts->rdb == NULL && rpmtsOpenDB(ts, ts->dbmode))
+	return -1;
+
+    if (ts->keyring == NULL)
+	loadKeyring(ts);
+
+    rc = rpmdbInitFileIterators(ts->rdb, rpmtag, files, nfiles, mis);
+
+    /* Verify header signature/digest during retrieve (if not disabled). */
+    for (int i = 0; rc == 0 && i < nfiles; i++) {
+	if (mis[i] && !(ts->vsflags & RPMVSF_NOHDRCHK))
+	    (void) rpmdbSetHdrChk(mis[i], ts, headerCheck);
+    }
+
+    return rc;
+}
+
 rpmKeyring rpmtsGetKeyring(rpmts ts, int autoload)
 {
     rpmKeyring keyring = NULL;
@@ -544,6 +578,12 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("dbget:       ", rpmtsOp(ts, RPMTS_OP_DBGET));
     rpmtsPrintStat("dbput:       ", rpmtsOp(ts, RPMTS_OP_DBPUT));
     rpmtsPrintStat("dbdel:       ", rpmtsOp(ts, RPMTS_OP_DBDEL));
+    rpmtsPrintStat("stmthit:     ", rpmtsOp(ts, RPMTS_OP_STMTHIT));
+    rpmtsPrintStat("stmtmiss:    ", rpmtsOp(ts, RPMTS_OP_STMTMISS));
+    rpmtsPrintStat("ughit:       ", rpmtsOp(ts, RPMTS_OP_UGHIT));
+    rpmtsPrintStat("ugmiss:      ", rpmtsOp(ts, RPMTS_OP_UGMISS));
+    rpmtsPrintStat("hdrhit:      ", rpmtsOp(ts, RPMTS_OP_HDRHIT));
+    rpmtsPrintStat("hdrmiss:     ", rpmtsOp(ts, RPMTS_OP_HDRMISS));
 }
 
 rpmts rpmtsFree(rpmts ts)
@@ -822,7 +862,7 @@ rpmop rpmtsOp(rpmts ts, rpmtsOpX opx)
 {
     rpmop op = NULL;
 
-    if (ts != NULL && opx >= 0 && opx < RPMTS_OP_MAX)
+    if (ts != NULL && opx >= 0 && opx < RPMTS_OP_INTERNAL_MAX)
 	op = ts->ops + opx;
     return op;
 }
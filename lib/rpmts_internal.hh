@@ -17,6 +17,18 @@
 #include "rpmscript.hh"
 #include "rpmtriggers.hh"
 
+/*
+ * Cache statistics. These are numbered past RPMTS_OP_MAX instead of
+ * being part of the public rpmtsOpX, so its values don't change.
+ */
+static constexpr rpmtsOpX RPMTS_OP_STMTHIT = rpmtsOpX(RPMTS_OP_MAX + 0);
+static constexpr rpmtsOpX RPMTS_OP_STMTMISS = rpmtsOpX(RPMTS_OP_MAX + 1);
+static constexpr rpmtsOpX RPMTS_OP_UGHIT = rpmtsOpX(RPMTS_OP_MAX + 2);
+static constexpr rpmtsOpX RPMTS_OP_UGMISS = rpmtsOpX(RPMTS_OP_MAX + 3);
+static constexpr rpmtsOpX RPMTS_OP_HDRHIT = rpmtsOpX(RPMTS_OP_MAX + 4);
+static constexpr rpmtsOpX RPMTS_OP_HDRMISS = rpmtsOpX(RPMTS_OP_MAX + 5);
+static constexpr int RPMTS_OP_INTERNAL_MAX = RPMTS_OP_MAX + 6;
+
 struct diskspaceInfo {
     std::string mntPoint;/*!< File system mount point */
     dev_t dev;		/*!< File system device number. */
@@ -90,7 +102,7 @@ struct rpmts_s {
     ARGV_t netsharedPaths;	/*!< From %{_netsharedpath} */
     ARGV_t installLangs;	/*!< From %{_install_langs} */
 
-    struct rpmop_s ops[RPMTS_OP_MAX];
+    struct rpmop_s ops[RPMTS_OP_INTERNAL_MAX];
 
     rpmPlugins plugins;		/*!< Transaction plugins */
 
@@ -1,31 +1,58 @@
 #include "system.h"
 
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 
 #include <errno.h>
+#include <sys/stat.h>
 #include <rpm/rpmlog.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmmacro.h>
+#include <rpm/rpmsw.h>
 
 #include "misc.hh"
+#include "rpmchroot.hh"
 #include "rpmug.hh"
 #include "debug.h"
 
 using std::unordered_map;
+using std::unordered_set;
 using std::string;
 
+/* Name <-> id tables of a passwd or group file */
+struct ugTable_s {
+    char *path;
+    int loaded;			/*!< tables populated from path? */
+    struct stat sb;		/*!< path status at the time of loading */
+    unordered_map<string,id_t> byName;
+    unordered_map<id_t,const char *> byId;	/*!< names from ugnames */
+};
+
+/* Separate tables for outside [0] and inside [1] the chroot */
 struct rpmug_s {
-    char *pwpath;
-    char *grppath;
-    unordered_map<uid_t,string> uidMap;
-    unordered_map<gid_t,string> gidMap;
-    unordered_map<string,uid_t> unameMap;
-    unordered_map<string,gid_t> gnameMap;
+    struct ugTable_s pw[2];
+    struct ugTable_s grp[2];
+    struct rpmop_s hitop;	/*!< lookups served from the tables */
+    struct rpmop_s missop;	/*!< lookups that needed to check the file */
 };
 
 static __thread struct rpmug_s *rpmug = NULL;
 
+/*
+ * Names handed out by rpmugUname() and rpmugGname() are interned here.
+ * This is never freed, not even by rpmugFree(), so the returned pointers
+ * stay valid no matter how often the tables get reloaded.
+ */
+static __thread unordered_set<string> *ugnames = NULL;
+
+static const char *ugIntern(const char *name)
+{
+    if (ugnames == NULL)
+	ugnames = new unordered_set<string>;
+    return ugnames->insert(name).first->c_str();
+}
+
 static const char *getpath(const char *bn, const char *dfl, char **dest)
 {
     if (*dest == NULL) {
@@ -39,98 +66,155 @@ static const char *getpath(const char *bn, const char *dfl, char **dest)
     return *dest;
 }
 
-static const char *pwfile(void)
+static struct ugTable_s *pwtable(void)
 {
-    return getpath("passwd", "/etc/passwd", &rpmug->pwpath);
+    struct ugTable_s *t = &rpmug->pw[rpmChrootDone() ? 1 : 0];
+    getpath("passwd", "/etc/passwd", &t->path);
+    return t;
 }
 
-static const char *grpfile(void)
+static struct ugTable_s *grptable(void)
 {
-    return getpath("group", "/etc/group", &rpmug->grppath);
+    struct ugTable_s *t = &rpmug->grp[rpmChrootDone() ? 1 : 0];
+    getpath("group", "/etc/group", &t->path);
+    return t;
+}
+
+/* atol() with error handling, return 0/-1 on success/failure */
+static int stol(const char *s, long *ret)
+{
+    int rc = 0;
+    char *end = NULL;
+    long val = strtol(s, &end, 10);
+
+    /* only accept fully numeric data */
+    if (*s == '\0' || *end != '\0')
+	rc = -1;
+
+    if ((val == LONG_MIN || val == LONG_MAX) && errno == ERANGE)
+	rc = -1;
+
+    if (rc == 0)
+	*ret = val;
+
+    return rc;
 }
 
 /*
- * Lookup an arbitrary field based on contents of another in a ':' delimited
- * file, such as /etc/passwd or /etc/group.
+ * (Re)load the name and id columns of a ':' delimited file, such as
+ * /etc/passwd or /etc/group. Like with a linear scan of the file, the last
+ * entry wins on duplicates.
  */
-static int lookup_field(const char *path, const char *val, int vcol, int rcol,
-			char **ret)
+static int ugTableLoad(struct ugTable_s *t)
 {
-    int rc = -1; /* assume not found */
-    char *str, buf[BUFSIZ];
-    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t size = 0;
+    FILE *f = fopen(t->path, "r");
+
+    t->loaded = 0;
+    t->byName.clear();
+    t->byId.clear();
+
     if (f == NULL) {
 	rpmlog(RPMLOG_ERR, _("failed to open %s for id/name lookup: %s\n"),
-		path, strerror(errno));
-	return rc;
+		t->path, strerror(errno));
+	return -1;
     }
 
-    while ((str = fgets(buf, sizeof(buf), f)) != NULL) {
-	int nf = vcol > rcol ? vcol : rcol;
-	const char *fields[nf + 1];
-	char *tok, *save = NULL;
+    while (getline(&line, &size, f) >= 0) {
+	const char *fields[3];
+	char *str = line, *tok, *save = NULL;
 	int col = -1;
+	long id;
 
-	while ((tok = strtok_r(str, ":", &save)) != NULL) {
+	while ((tok = strtok_r(str, ":\n", &save)) != NULL) {
 	    fields[++col] = tok;
 	    str = NULL;
-	    if (col >= nf)
+	    if (col >= 2)
 		break;
 	}
 
-	if (col >= nf) {
-	    if (rstreq(val, fields[vcol])) {
-		*ret = xstrdup(fields[rcol]);
-		rc = 0;
-	    }
-	}
+	if (col < 2 || stol(fields[2], &id))
+	    continue;
+
+	t->byName[fields[0]] = id;
+	t->byId[id] = ugIntern(fields[0]);
     }
 
+    if (fstat(fileno(f), &t->sb) == 0)
+	t->loaded = 1;
+
+    free(line);
     fclose(f);
 
-    return rc;
+    return t->loaded ? 0 : -1;
 }
 
-/* atol() with error handling, return 0/-1 on success/failure */
-static int stol(const char *s, long *ret)
+/* Have the contents of the table file changed since it was loaded? */
+static int ugTableStale(struct ugTable_s *t)
 {
-    int rc = 0;
-    char *end = NULL;
-    long val = strtol(s, &end, 10);
+    struct stat sb;
+
+    if (!t->loaded)
+	return 1;
+    if (stat(t->path, &sb))
+	return 1;
+    return (sb.st_dev != t->sb.st_dev || sb.st_ino != t->sb.st_ino ||
+	    sb.st_size != t->sb.st_size ||
+	    sb.st_mtim.tv_sec != t->sb.st_mtim.tv_sec ||
+	    sb.st_mtim.tv_nsec != t->sb.st_mtim.tv_nsec);
+}
 
-    /* only accept fully numeric data */
-    if (*s == '\0' || *end != '\0')
-	rc = -1;
+/*
+ * Lookups are served from the tables as long as they succeed. A failed
+ * lookup reloads the table if the file changed since, eg a scriptlet
+ * added a user, and tries again.
+ */
+static int lookup_id(struct ugTable_s *t, const char *name, id_t *id)
+{
+    int rc = -1;
+    auto it = t->byName.find(name);
 
-    if ((val == LONG_MIN || val == LONG_MAX) && errno == ERANGE)
-	rc = -1;
+    if (it != t->byName.end()) {
+	rpmug->hitop.count++;
+	*id = it->second;
+	return 0;
+    }
 
-    if (rc == 0)
-	*ret = val;
+    rpmswEnter(&rpmug->missop, 0);
+    if (ugTableStale(t) && ugTableLoad(t) == 0)
+	it = t->byName.find(name);
+    else
+	it = t->byName.end();
+
+    if (it != t->byName.end()) {
+	*id = it->second;
+	rc = 0;
+    }
+    rpmswExit(&rpmug->missop, 0);
 
     return rc;
 }
 
-static int lookup_num(const char *path, const char *val, int vcol, int rcol,
-			long *ret)
+static const char *lookup_name(struct ugTable_s *t, id_t id)
 {
-    char *buf = NULL;
-    int rc = lookup_field(path, val, vcol, rcol, &buf);
-    if (rc == 0) {
-	rc = stol(buf, ret);
-	free(buf);
+    const char *name = NULL;
+    auto it = t->byId.find(id);
+
+    if (it != t->byId.end()) {
+	rpmug->hitop.count++;
+	return it->second;
     }
-    return rc;
-}
 
-static int lookup_str(const char *path, long val, int vcol, int rcol,
-			char **ret)
-{
-    char *vbuf = NULL;
-    rasprintf(&vbuf, "%ld", val);
-    int rc = lookup_field(path, vbuf, vcol, rcol, ret);
-    free(vbuf);
-    return rc;
+    rpmswEnter(&rpmug->missop, 0);
+    if (ugTableStale(t) && ugTableLoad(t) == 0) {
+	it = t->byId.find(id);
+	if (it != t->byId.end())
+	    name = it->second;
+    }
+    rpmswExit(&rpmug->missop, 0);
+
+    return name;
 }
 
 static void rpmugInit(void)
@@ -148,16 +232,10 @@ int rpmugUid(const char * thisUname, uid_t * uid)
 
     rpmugInit();
 
-    auto it = rpmug->unameMap.find(thisUname);
-    if (it == rpmug->unameMap.end()) {
-	long id;
-	if (lookup_num(pwfile(), thisUname, 0, 2, &id))
-	    return -1;
-	rpmug->unameMap.insert({thisUname, id});
-	*uid = id;
-    } else {
-	*uid = it->second;
-    }
+    id_t id;
+    if (lookup_id(pwtable(), thisUname, &id))
+	return -1;
+    *uid = id;
 
     return 0;
 }
@@ -171,16 +249,10 @@ int rpmugGid(const char * thisGname, gid_t * gid)
 
     rpmugInit();
 
-    auto it = rpmug->gnameMap.find(thisGname);
-    if (it == rpmug->gnameMap.end()) {
-	long id;
-	if (lookup_num(grpfile(), thisGname, 0, 2, &id))
-	    return -1;
-	rpmug->gnameMap.insert({thisGname, id});
-	*gid = id;
-    } else {
-	*gid = it->second;
-    }
+    id_t id;
+    if (lookup_id(grptable(), thisGname, &id))
+	return -1;
+    *gid = id;
 
     return 0;
 }
@@ -192,20 +264,7 @@ const char * rpmugUname(uid_t uid)
 
     rpmugInit();
 
-    const char *retname = NULL;
-    auto it = rpmug->uidMap.find(uid);
-    if (it == rpmug->uidMap.end()) {
-	char *uname = NULL;
-
-	if (lookup_str(pwfile(), uid, 2, 0, &uname))
-	    return NULL;
-
-	auto res = rpmug->uidMap.insert({uid, uname}).first;
-	retname = res->second.c_str();
-    } else {
-	retname = it->second.c_str();
-    }
-    return retname;
+    return lookup_name(pwtable(), uid);
 }
 
 const char * rpmugGname(gid_t gid)
@@ -215,27 +274,26 @@ const char * rpmugGname(gid_t gid)
 
     rpmugInit();
 
-    const char *retname = NULL;
-    auto it = rpmug->gidMap.find(gid);
-    if (it == rpmug->gidMap.end()) {
-	char *gname = NULL;
-
-	if (lookup_str(pwfile(), gid, 2, 0, &gname))
-	    return NULL;
+    return lookup_name(grptable(), gid);
+}
 
-	auto res = rpmug->gidMap.insert({gid, gname}).first;
-	retname = res->second.c_str();
-    } else {
-	retname = it->second.c_str();
+void rpmugStats(rpmop hit, rpmop miss)
+{
+    if (rpmug) {
+	rpmswAdd(hit, &rpmug->hitop);
+	rpmswAdd(miss, &rpmug->missop);
+	rpmug->hitop = {};
+	rpmug->missop = {};
     }
-    return retname;
 }
 
 void rpmugFree(void)
 {
     if (rpmug) {
-	free(rpmug->pwpath);
-	free(rpmug->grppath);
+	for (int i = 0; i < 2; i++) {
+	    free(rpmug->pw[i].path);
+	    free(rpmug->grp[i].path);
+	}
 	delete rpmug;
 	rpmug = NULL;
     }
@@ -2,6 +2,7 @@
 #define _RPMUG_H
 
 #include <rpm/rpmutil.h>
+#include <rpm/rpmsw.h>
 #include <sys/types.h>
 
 RPM_GNUC_INTERNAL
@@ -16,6 +17,13 @@ const char * rpmugUname(uid_t uid);
 RPM_GNUC_INTERNAL
 const char * rpmugGname(gid_t gid);
 
+/*
+ * Add the user/group lookup cache hit and miss statistics of the current
+ * thread to hit and miss, and reset them.
+ */
+RPM_GNUC_INTERNAL
+void rpmugStats(rpmop hit, rpmop miss);
+
 RPM_GNUC_INTERNAL
 void rpmugFree(void);
 
@@ -42,6 +42,7 @@
 #include "rpmts_internal.hh"
 #include "rpmvs.hh"
 #include "rpmtriggers.hh"
+#include "rpmug.hh"
 
 #include "rpmplugins.hh"
 
@@ -1458,6 +1459,8 @@ static int rpmtsFinish(rpmts ts)
     if (rpmtsGetDSIRotational(ts) == 0)
 	setSSD(0);
     rpmtsFreeDSI(ts);
+    /* Collect user/group cache statistics before the cache goes away */
+    rpmugStats(rpmtsOp(ts, RPMTS_OP_UGHIT), rpmtsOp(ts, RPMTS_OP_UGMISS));
     return rpmChrootSet(NULL);
 }
 
@@ -1838,6 +1841,7 @@ exit:
     /* Finish up... */
     if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_TEST) && nfailed >= 0) {
 	rpmtsSync(ts);
+	rpmdbSnapshot(rpmtsGetRdb(ts));
     }
     (void) umask(oldmask);
     (void) rpmtsFinish(ts);
@@ -178,27 +178,40 @@ static PyObject * hdrUnload(hdrObject * s)
     return hdrAsBytes(s);
 }
 
+/*
+ * Headers tend to get formatted in loops with the same format,
+ * parse the format once for all of them.
+ */
+static char * lastFmt = NULL;
+static rpmHeaderFormatter lastFormatter = NULL;
+
 static PyObject * hdrFormat(hdrObject * s, PyObject * args, PyObject * kwds)
 {
     const char * fmt;
-    char * r;
-    errmsg_t err;
-    PyObject * result;
+    const char * r = NULL;
+    errmsg_t err = NULL;
     char * kwlist[] = {"format", NULL};
 
     if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &fmt))
 	return NULL;
 
-    r = headerFormat(s->h, fmt, &err);
+    if (lastFmt == NULL || !rstreq(lastFmt, fmt)) {
+	lastFormatter = rpmHeaderFormatterFree(lastFormatter);
+	free(lastFmt);
+	lastFmt = NULL;
+	lastFormatter = rpmHeaderFormatterNew(fmt, &err);
+	if (lastFormatter)
+	    lastFmt = rstrdup(fmt);
+    }
+
+    if (lastFormatter)
+	r = rpmHeaderFormatterFormat(lastFormatter, s->h, &err);
     if (!r) {
 	PyErr_SetString(pyrpmError, err);
 	return NULL;
     }
 
-    result = utf8FromString(r);
-    free(r);
-
-    return result;
+    return utf8FromString(r);
 }
 
 static PyObject *hdrIsSource(hdrObject *s)
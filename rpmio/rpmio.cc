@@ -4,6 +4,11 @@
 
 #include "system.h"
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <stdarg.h>
@@ -802,7 +807,22 @@ static LZFILE *lzopen_internal(const char *mode, int fd, int xz)
 	    ret = lzma_alone_encoder(&lzfile->strm, &options);
 	}
     } else {   /* lzma_easy_decoder_memusage(level) is not ready yet, use hardcoded limit for now */
-	ret = lzma_auto_decoder(&lzfile->strm, mem_limit ? mem_limit : 100<<20, 0);
+	uint64_t limit = mem_limit ? mem_limit : 100<<20;
+#if LZMA_VERSION >= 50040002
+	if (xz && threads > 1) {
+	    /* Like xz(1), allow threading to use up to a quarter of the RAM */
+	    uint64_t mt_limit = mem_limit ? mem_limit : lzma_physmem() / 4;
+	    lzma_mt mt_options = {
+		.flags = 0,
+		.threads = threads,
+		.timeout = 0,
+		.memlimit_threading = mt_limit,
+		.memlimit_stop = mt_limit > limit ? mt_limit : limit };
+
+	    ret = lzma_stream_decoder_mt(&lzfile->strm, &mt_options);
+	} else
+#endif
+	ret = lzma_auto_decoder(&lzfile->strm, limit, 0);
     }
     if (ret != LZMA_OK) {
 	switch (ret) {
@@ -1002,6 +1022,26 @@ const FDIO_t lzdio = &lzdio_s;
 
 #include <zstd.h>
 
+/*
+ * Seekable zstd payloads consist of independent frames, followed by a
+ * seek table in a skippable frame as described in the zstd seekable
+ * format specification (contrib/seekable_format in zstd sources).
+ * Regular zstd decoders skip the table, so these are readable everywhere,
+ * but knowing the frame boundaries allows decompressing them in parallel.
+ */
+#define ZSTD_SEEKABLE_MAGIC		0x8F92EAB1
+#define ZSTD_SEEKTABLE_SKIPPABLE	(ZSTD_MAGIC_SKIPPABLE_START | 0xE)
+#define ZSTD_SEEKTABLE_FOOTER_SIZE	9
+#define ZSTD_SEEKTABLE_CHECKSUM_FLAG	0x80
+/* Largest frame decompressed in one go, bigger ones are streamed instead */
+#define ZSTD_SEEKABLE_MAX_DSIZE		(64 * 1024 * 1024)
+
+struct zstdFrame {
+    off_t offset;		/*!< offset of compressed frame in file */
+    uint32_t csize;		/*!< compressed size */
+    uint32_t dsize;		/*!< decompressed size */
+};
+
 typedef struct rpmzstd_s {
     int flags;			/*!< open flags. */
     int fdno;
@@ -1014,8 +1054,229 @@ typedef struct rpmzstd_s {
     std::vector<uint8_t> b;
     ZSTD_inBuffer zib;          /*!< ZSTD_inBuffer */
     ZSTD_outBuffer zob;         /*!< ZSTD_outBuffer */
+
+    size_t framesize;		/*!< max. frame size when writing seekable */
+    size_t framein;		/*!< uncompressed bytes in current frame */
+    size_t frameout;		/*!< compressed bytes in current frame */
+    std::vector<zstdFrame> frames; /*!< frame (seek) table */
+
+    /* Parallel decompression of seekable payloads */
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<size_t,std::vector<uint8_t>> done; /*!< decompressed frames */
+    size_t nextframe;		/*!< next frame to decompress */
+    size_t readframe;		/*!< frame being consumed */
+    size_t maxahead;		/*!< max. frames decompressed ahead */
+    size_t errframe;		/*!< first frame that failed */
+    const char *errcookie;	/*!< error of the failed frame */
+    int stop;			/*!< tell workers to quit */
+    std::vector<uint8_t> cur;	/*!< frame being consumed */
+    size_t curpos;		/*!< read position in cur */
 } * rpmzstd;
 
+static uint32_t zstdGetLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void zstdPutLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static int zstdPread(int fdno, void *buf, size_t count, off_t offset)
+{
+    uint8_t *b = (uint8_t *)buf;
+    while (count > 0) {
+	ssize_t nb = pread(fdno, b, count, offset);
+	if (nb < 0 && errno == EINTR)
+	    continue;
+	if (nb <= 0)
+	    return -1;
+	b += nb;
+	count -= nb;
+	offset += nb;
+    }
+    return 0;
+}
+
+/*
+ * Read the seek table at the end of a stream in range start - end of a
+ * file. The frames must exactly cover everything from the start up to
+ * the table, otherwise this isn't (just) a seekable zstd stream.
+ */
+static int zstdReadSeekTable(int fdno, off_t start, off_t end,
+			     std::vector<zstdFrame> & frames)
+{
+    uint8_t footer[ZSTD_SEEKTABLE_FOOTER_SIZE];
+    uint8_t skiphdr[8];
+    off_t tablestart, offset;
+    uint32_t nframes;
+    size_t esize, tsize;
+    std::vector<uint8_t> entries;
+
+    if (end - start < (off_t)(sizeof(skiphdr) + sizeof(footer)))
+	return -1;
+
+    if (zstdPread(fdno, footer, sizeof(footer), end - sizeof(footer)))
+	return -1;
+    if (zstdGetLE32(footer + 5) != ZSTD_SEEKABLE_MAGIC)
+	return -1;
+
+    nframes = zstdGetLE32(footer);
+    esize = (footer[4] & ZSTD_SEEKTABLE_CHECKSUM_FLAG) ? 12 : 8;
+    tsize = nframes * esize;
+    tablestart = end - sizeof(footer) - tsize - sizeof(skiphdr);
+    if (nframes == 0 || tablestart < start)
+	return -1;
+
+    if (zstdPread(fdno, skiphdr, sizeof(skiphdr), tablestart))
+	return -1;
+    if (zstdGetLE32(skiphdr) != ZSTD_SEEKTABLE_SKIPPABLE ||
+	    zstdGetLE32(skiphdr + 4) != tsize + sizeof(footer))
+	return -1;
+
+    entries.resize(tsize);
+    if (zstdPread(fdno, entries.data(), tsize, tablestart + sizeof(skiphdr)))
+	return -1;
+
+    offset = start;
+    for (uint32_t i = 0; i < nframes; i++) {
+	const uint8_t *e = entries.data() + i * esize;
+	zstdFrame frame = { offset, zstdGetLE32(e), zstdGetLE32(e + 4) };
+	offset += frame.csize;
+	frames.push_back(frame);
+    }
+
+    if (offset != tablestart) {
+	frames.clear();
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * Load seek table of a stream from current position to end of file.
+ * The decompressed sizes come from the file and determine the buffers
+ * allocated for each frame, so tables with frames above a sane size
+ * (or ones no zstd frame of its compressed size can expand to) are
+ * refused and the stream is decompressed the regular way instead.
+ */
+static int zstdLoadSeekTable(rpmzstd zstd)
+{
+    struct stat sb;
+    off_t start;
+
+    if (fstat(zstd->fdno, &sb) || !S_ISREG(sb.st_mode))
+	return -1;
+    if ((start = lseek(zstd->fdno, 0, SEEK_CUR)) < 0)
+	return -1;
+    if (zstdReadSeekTable(zstd->fdno, start, sb.st_size, zstd->frames))
+	return -1;
+
+    for (auto const & frame : zstd->frames) {
+	/* Every block of up to 128kB takes at least 4 bytes */
+	uint64_t maxdsize = (uint64_t)frame.csize * (128 * 1024 / 4);
+	if (frame.dsize > ZSTD_SEEKABLE_MAX_DSIZE || frame.dsize > maxdsize) {
+	    rpmlog(RPMLOG_DEBUG, "zstd: frame of %u bytes, "
+		    "parallel decompression disabled\n", frame.dsize);
+	    zstd->frames.clear();
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+static void zstdDecompressFrames(rpmzstd zstd)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    std::vector<uint8_t> in;
+
+    for (;;) {
+	const char *err = NULL;
+	size_t ix;
+
+	{
+	    std::unique_lock<std::mutex> lock(zstd->mutex);
+	    zstd->cond.wait(lock, [zstd] {
+		return zstd->stop || zstd->errframe != SIZE_MAX ||
+		       zstd->nextframe >= zstd->frames.size() ||
+		       zstd->nextframe < zstd->readframe + zstd->maxahead;
+	    });
+	    if (zstd->stop || zstd->errframe != SIZE_MAX ||
+		    zstd->nextframe >= zstd->frames.size())
+		break;
+	    ix = zstd->nextframe++;
+	}
+
+	const zstdFrame & frame = zstd->frames[ix];
+	std::vector<uint8_t> out(frame.dsize);
+	in.resize(frame.csize);
+
+	if (dctx == NULL) {
+	    err = "zstd: failed to create decompression context";
+	} else if (zstdPread(zstd->fdno, in.data(), in.size(), frame.offset)) {
+	    err = "zstd: reading frame failed";
+	} else {
+	    size_t xx = ZSTD_decompressDCtx(dctx, out.data(), out.size(),
+					    in.data(), in.size());
+	    if (ZSTD_isError(xx))
+		err = ZSTD_getErrorName(xx);
+	    else if (xx != out.size())
+		err = "zstd: frame size mismatch";
+	}
+
+	std::lock_guard<std::mutex> lock(zstd->mutex);
+	if (err) {
+	    if (ix < zstd->errframe) {
+		zstd->errframe = ix;
+		zstd->errcookie = err;
+	    }
+	} else {
+	    zstd->done[ix] = std::move(out);
+	}
+	zstd->cond.notify_all();
+    }
+
+    ZSTD_freeDCtx(dctx);
+}
+
+static void zstdStopWorkers(rpmzstd zstd)
+{
+    {
+	std::lock_guard<std::mutex> lock(zstd->mutex);
+	zstd->stop = 1;
+	zstd->cond.notify_all();
+    }
+    for (auto & w : zstd->workers)
+	w.join();
+    zstd->workers.clear();
+}
+
+static void zstdStartWorkers(rpmzstd zstd, int threads)
+{
+    if ((size_t)threads > zstd->frames.size())
+	threads = zstd->frames.size();
+
+    zstd->errframe = SIZE_MAX;
+    zstd->maxahead = 2 * threads;
+    try {
+	for (int i = 0; i < threads; i++)
+	    zstd->workers.emplace_back(zstdDecompressFrames, zstd);
+    } catch (const std::system_error & e) {
+	rpmlog(RPMLOG_DEBUG, "zstd: parallel decompression disabled: %s\n",
+		e.what());
+	/* Whatever got started will finish the job all right */
+	if (zstd->workers.empty())
+	    zstd->frames.clear();
+    }
+}
+
 static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 {
     rpmzstd zstd = NULL;
@@ -1029,6 +1290,7 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
     int threads = 0;
     int windowlog = 27;
     int longdist = 0;
+    size_t framesize = 0;
 
     switch ((c = *s++)) {
     case 'a':
@@ -1060,6 +1322,18 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 	case 'T':
 	    threads = parsethreadn(s, (char **)&s);
 	    continue;
+	case 'S':
+	    /* Seekable: independent frames of given size (in kB) + seek table */
+	    framesize = strtoul(s, (char **)&s, 10);
+	    if (framesize == 0)
+		framesize = 4096;
+	    /* Bigger frames would be read back serially */
+	    if (framesize > ZSTD_SEEKABLE_MAX_DSIZE / 1024) {
+		framesize = ZSTD_SEEKABLE_MAX_DSIZE / 1024;
+		rpmlog(RPMLOG_WARNING, "Invalid frame size for zstd. Using %zu instead.\n", framesize);
+	    }
+	    framesize *= 1024;
+	    continue;
     case 'L':
 	    c = *s++;
 	    longdist = 1;
@@ -1126,6 +1400,12 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
 		rpmlog(RPMLOG_DEBUG, "zstd library does not support multi-threading\n");
 	}
 
+	/* Seekable frames are decompressed without a stream, checksum each */
+	if (framesize) {
+	    if (ZSTD_isError(ZSTD_CCtx_setParameter(zstd->stream.c, ZSTD_c_checksumFlag, 1)))
+		goto err;
+	}
+
 	nb = ZSTD_CStreamOutSize();
     }
 
@@ -1133,8 +1413,15 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
     zstd->fdno = fdno;
     zstd->level = level;
     zstd->fp = fp;
+    zstd->framesize = framesize;
     zstd->b.resize(nb);
 
+    /* Decompress independent frames in parallel if possible */
+    if ((flags & O_ACCMODE) == O_RDONLY && threads > 1) {
+	if (zstdLoadSeekTable(zstd) == 0)
+	    zstdStartWorkers(zstd, threads);
+    }
+
     return zstd;
 
 err:
@@ -1143,6 +1430,7 @@ err:
 	ZSTD_freeDStream(zstd->stream.d);
     else
 	ZSTD_freeCCtx(zstd->stream.c);
+    delete zstd;
     return NULL;
 }
 
@@ -1163,6 +1451,83 @@ static FD_t zstdFdopen(FD_t fd, int fdno, const char * fmode)
     return fd;
 }
 
+/* Compress (and write out) data, flushing or ending the frame if asked to */
+static int zstdCompress(FDSTACK_t fps, rpmzstd zstd, ZSTD_inBuffer *zib,
+			ZSTD_EndDirective op)
+{
+    for (;;) {
+	if (op == ZSTD_e_continue && zib->pos >= zib->size)
+	    break;
+
+	/* Reset to beginning of compressed data buffer. */
+	zstd->zob.dst  = zstd->b.data();
+	zstd->zob.size = zstd->b.size();
+	zstd->zob.pos  = 0;
+
+	/* Compress next chunk. */
+	size_t xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, zib, op);
+	if (ZSTD_isError(xx)) {
+	    fps->errcookie = ZSTD_getErrorName(xx);
+	    return -1;
+	}
+
+	/* Write compressed data buffer. */
+	if (zstd->zob.pos > 0) {
+	    size_t nw = fwrite(zstd->b.data(), 1, zstd->zob.pos, zstd->fp);
+	    if (nw != zstd->zob.pos) {
+		fps->errcookie = "zstdWrite fwrite failed.";
+		return -1;
+	    }
+	    zstd->frameout += nw;
+	}
+
+	if (op != ZSTD_e_continue && xx == 0)
+	    break;
+    }
+    return 0;
+}
+
+/* End current seekable frame and record it in the seek table */
+static int zstdEndFrame(FDSTACK_t fps, rpmzstd zstd)
+{
+    ZSTD_inBuffer zib = { NULL, 0, 0 };
+
+    if (zstdCompress(fps, zstd, &zib, ZSTD_e_end))
+	return -1;
+
+    zstdFrame frame = { 0, (uint32_t)zstd->frameout, (uint32_t)zstd->framein };
+    zstd->frames.push_back(frame);
+    zstd->framein = 0;
+    zstd->frameout = 0;
+    return 0;
+}
+
+static int zstdWriteSeekTable(FDSTACK_t fps, rpmzstd zstd)
+{
+    size_t nframes = zstd->frames.size();
+    size_t tsize = nframes * 8;
+    std::vector<uint8_t> table(8 + tsize + ZSTD_SEEKTABLE_FOOTER_SIZE);
+    uint8_t *p = table.data();
+
+    zstdPutLE32(p, ZSTD_SEEKTABLE_SKIPPABLE);
+    zstdPutLE32(p + 4, tsize + ZSTD_SEEKTABLE_FOOTER_SIZE);
+    p += 8;
+    for (auto const & frame : zstd->frames) {
+	zstdPutLE32(p, frame.csize);
+	zstdPutLE32(p + 4, frame.dsize);
+	p += 8;
+    }
+    zstdPutLE32(p, nframes);
+    p[4] = 0;	/* no per-entry checksums, the frames carry their own */
+    zstdPutLE32(p + 5, ZSTD_SEEKABLE_MAGIC);
+
+    if (fwrite(table.data(), 1, table.size(), zstd->fp) != table.size()) {
+	fps->errcookie = "zstdClose fwrite failed.";
+	return -1;
+    }
+    return 0;
+}
+
 static int zstdFlush(FDSTACK_t fps)
 {
     rpmzstd zstd = zstdFp(fps);
@@ -1172,35 +1537,59 @@ assert(zstd);
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
     } else {					/* compressing */
-	/* close frame */
-	int xx;
-	do {
-	  ZSTD_inBuffer zib = { NULL, 0, 0 };
-	  zstd->zob.dst  = zstd->b.data();
-	  zstd->zob.size = zstd->b.size();
-	  zstd->zob.pos  = 0;
-	  xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, ZSTD_e_flush);
-	  if (ZSTD_isError(xx)) {
-	      fps->errcookie = ZSTD_getErrorName(xx);
-	      break;
-	  }
-	  else if (zstd->zob.pos != fwrite(zstd->b.data(), 1, zstd->zob.pos, zstd->fp)) {
-	      fps->errcookie = "zstdClose fwrite failed.";
-	      break;
-	  }
-	  else
-	      rc = 0;
-	} while (xx != 0);
+	ZSTD_inBuffer zib = { NULL, 0, 0 };
+	rc = zstdCompress(fps, zstd, &zib, ZSTD_e_flush);
     }
     return rc;
 }
 
+/* Read from frames decompressed in parallel, in order */
+static ssize_t zstdReadFrames(FDSTACK_t fps, rpmzstd zstd,
+			      uint8_t * buf, size_t count)
+{
+    size_t nb = 0;
+
+    while (nb < count) {
+	if (zstd->curpos == zstd->cur.size()) {
+	    if (zstd->readframe == zstd->frames.size())
+		break;		/* EOF */
+
+	    std::unique_lock<std::mutex> lock(zstd->mutex);
+	    zstd->cond.wait(lock, [zstd] {
+		return zstd->done.count(zstd->readframe) ||
+		       zstd->errframe == zstd->readframe;
+	    });
+	    auto it = zstd->done.find(zstd->readframe);
+	    if (it == zstd->done.end()) {
+		fps->errcookie = zstd->errcookie;
+		return -1;
+	    }
+	    zstd->cur = std::move(it->second);
+	    zstd->done.erase(it);
+	    zstd->curpos = 0;
+	    zstd->readframe++;
+	    zstd->cond.notify_all();
+	}
+
+	size_t n = zstd->cur.size() - zstd->curpos;
+	if (n > count - nb)
+	    n = count - nb;
+	memcpy(buf + nb, zstd->cur.data() + zstd->curpos, n);
+	zstd->curpos += n;
+	nb += n;
+    }
+    return nb;
+}
+
 static ssize_t zstdRead(FDSTACK_t fps, void * buf, size_t count)
 {
     rpmzstd zstd = zstdFp(fps);
 assert(zstd);
     ZSTD_outBuffer zob = { buf, count, 0 };
 
+    if (!zstd->workers.empty())
+	return zstdReadFrames(fps, zstd, (uint8_t *)buf, count);
+
     while (zob.pos < zob.size) {
 	/* Re-fill compressed data buffer. */
 	if (zstd->zib.pos >= zstd->zib.size) {
@@ -1225,32 +1614,28 @@ static ssize_t zstdWrite(FDSTACK_t fps, const void * buf, size_t count)
 {
     rpmzstd zstd = zstdFp(fps);
 assert(zstd);
-    ZSTD_inBuffer zib = { buf, count, 0 };
+    const uint8_t *b = (const uint8_t *)buf;
+    size_t nb = 0;
 
-    while (zib.pos < zib.size) {
+    while (nb < count) {
+	size_t n = count - nb;
 
-	/* Reset to beginning of compressed data buffer. */
-	zstd->zob.dst  = zstd->b.data();
-	zstd->zob.size = zstd->b.size();
-	zstd->zob.pos  = 0;
+	/* Don't let seekable frames grow past the frame size */
+	if (zstd->framesize && n > zstd->framesize - zstd->framein)
+	    n = zstd->framesize - zstd->framein;
 
-	/* Compress next chunk. */
-	int xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, ZSTD_e_continue);
-	if (ZSTD_isError(xx)) {
-	    fps->errcookie = ZSTD_getErrorName(xx);
+	ZSTD_inBuffer zib = { b + nb, n, 0 };
+	if (zstdCompress(fps, zstd, &zib, ZSTD_e_continue))
 	    return -1;
-	}
+	nb += n;
+	zstd->framein += n;
 
-	/* Write compressed data buffer. */
-        if (zstd->zob.pos > 0) {
-	    size_t nw = fwrite(zstd->b.data(), 1, zstd->zob.pos, zstd->fp);
-	    if (nw != zstd->zob.pos) {
-		fps->errcookie = "zstdWrite fwrite failed.";
+	if (zstd->framesize && zstd->framein == zstd->framesize) {
+	    if (zstdEndFrame(fps, zstd))
 		return -1;
-	    }
 	}
     }
-    return zib.pos;
+    return nb;
 }
 
 static int zstdClose(FDSTACK_t fps)
@@ -1261,27 +1646,19 @@ assert(zstd);
 
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
+	zstdStopWorkers(zstd);
 	ZSTD_freeDStream(zstd->stream.d);
+    } else if (zstd->framesize) {		/* compressing seekable */
+	/* close last frame, if any, and add the seek table */
+	if ((zstd->framein == 0 || zstdEndFrame(fps, zstd) == 0) &&
+		zstdWriteSeekTable(fps, zstd) == 0) {
+	    rc = 0;
+	}
+	ZSTD_freeCCtx(zstd->stream.c);
     } else {					/* compressing */
 	/* close frame */
-	int xx;
-	do {
-	  ZSTD_inBuffer zib = { NULL, 0, 0 };
-	  zstd->zob.dst  = zstd->b.data();
-	  zstd->zob.size = zstd->b.size();
-	  zstd->zob.pos  = 0;
-	  xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, ZSTD_e_end);
-	  if (ZSTD_isError(xx)) {
-	      fps->errcookie = ZSTD_getErrorName(xx);
-	      break;
-	  }
-	  else if (zstd->zob.pos != fwrite(zstd->b.data(), 1, zstd->zob.pos, zstd->fp)) {
-	      fps->errcookie = "zstdClose fwrite failed.";
-	      break;
-	  }
-	  else
-	      rc = 0;
-	} while (xx != 0);
+	ZSTD_inBuffer zib = { NULL, 0, 0 };
+	rc = zstdCompress(fps, zstd, &zib, ZSTD_e_end);
 	ZSTD_freeCCtx(zstd->stream.c);
     }
 
@@ -1302,6 +1679,176 @@ const FDIO_t zstdio = &zstdio_s ;
 
 #endif	/* HAVE_ZSTD */
 
+int fdSeekableFrames(FD_t fd, off_t start, off_t end,
+		     std::vector<std::pair<uint64_t,uint64_t>> & frames)
+{
+    int rc = -1;
+#ifdef HAVE_ZSTD
+    std::vector<zstdFrame> zframes;
+    if (zstdReadSeekTable(Fileno(fd), start, end, zframes) == 0) {
+	frames.clear();
+	for (auto const & f : zframes)
+	    frames.push_back({f.csize, f.dsize});
+	rc = 0;
+    }
+#endif
+    return rc;
+}
+
+/* =============================================================== */
+/* Support for read-ahead on a separate thread.  */
+
+#define RA_CHUNKSIZE (128 * 1024)
+
+typedef struct rpmreadahead_s {
+    FDSTACK_t lower;		/*!< layer to read from */
+    std::thread thread;		/*!< producer thread */
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::vector<uint8_t>> chunks; /*!< data ready for reading */
+    size_t maxchunks;		/*!< max. number of queued chunks */
+    size_t pos;			/*!< read position in the first chunk */
+    int eof;			/*!< producer is done */
+    int stop;			/*!< consumer is done */
+    int syserrno;		/*!< errno from lower layer read */
+    const char *errcookie;	/*!< error string from lower layer read */
+} * rpmreadahead;
+
+static rpmreadahead raFp(FDSTACK_t fps)
+{
+    return (rpmreadahead)fps->fp;
+}
+
+static void raProduce(rpmreadahead ra)
+{
+    FDSTACK_t lower = ra->lower;
+    int done = 0;
+
+    while (!done) {
+	std::vector<uint8_t> chunk(RA_CHUNKSIZE);
+	ssize_t nb;
+
+	do {
+	    nb = lower->io->read(lower, chunk.data(), chunk.size());
+	} while (nb == -1 && errno == EINTR);
+
+	std::unique_lock<std::mutex> lock(ra->mutex);
+	if (nb > 0) {
+	    chunk.resize(nb);
+	    ra->cond.wait(lock, [ra] {
+		return ra->stop || ra->chunks.size() < ra->maxchunks;
+	    });
+	    if (!ra->stop)
+		ra->chunks.push_back(std::move(chunk));
+	} else {
+	    if (nb < 0) {
+		ra->syserrno = lower->syserrno ? lower->syserrno : errno;
+		ra->errcookie = lower->errcookie;
+	    }
+	    ra->eof = 1;
+	}
+	done = (ra->stop || ra->eof);
+	ra->cond.notify_all();
+    }
+}
+
+static ssize_t raRead(FDSTACK_t fps, void * buf, size_t count)
+{
+    rpmreadahead ra = raFp(fps);
+    uint8_t *b = (uint8_t *)buf;
+    size_t nb = 0;
+
+    std::unique_lock<std::mutex> lock(ra->mutex);
+    while (nb < count) {
+	ra->cond.wait(lock, [ra] { return !ra->chunks.empty() || ra->eof; });
+	if (ra->chunks.empty()) {
+	    if (ra->syserrno || ra->errcookie) {
+		fps->errcookie = ra->errcookie;
+		errno = ra->syserrno ? ra->syserrno : EIO;
+		return -1;
+	    }
+	    break;		/* EOF */
+	}
+
+	std::vector<uint8_t> & chunk = ra->chunks.front();
+	size_t n = chunk.size() - ra->pos;
+	if (n > count - nb)
+	    n = count - nb;
+	memcpy(b + nb, chunk.data() + ra->pos, n);
+	nb += n;
+	ra->pos += n;
+
+	if (ra->pos == chunk.size()) {
+	    ra->chunks.pop_front();
+	    ra->pos = 0;
+	    ra->cond.notify_all();
+	}
+    }
+    return nb;
+}
+
+static int raFlush(FDSTACK_t fps)
+{
+    return 0;
+}
+
+static int raClose(FDSTACK_t fps)
+{
+    rpmreadahead ra = raFp(fps);
+
+    if (ra == NULL) return -2;
+
+    {
+	std::lock_guard<std::mutex> lock(ra->mutex);
+	ra->stop = 1;
+	ra->cond.notify_all();
+    }
+    ra->thread.join();
+    delete ra;
+
+    /* The lower layers are closed separately */
+    return 0;
+}
+
+static const char * raStrerr(FDSTACK_t fps)
+{
+    if (fps->errcookie != NULL)
+	return fps->errcookie;
+    return (fps->syserrno != 0) ? strerror(fps->syserrno) : "";
+}
+
+static const struct FDIO_s readahead_s = {
+  "readahead", NULL,
+  raRead, NULL, NULL, raClose,
+  NULL, NULL, raFlush, NULL, zfdError, raStrerr
+};
+
+int fdReadAhead(FD_t fd, size_t bufsize)
+{
+    FDSTACK_t fps = fdGetFps(fd);
+    rpmreadahead ra;
+
+    if (fps == NULL || fps->io->read == NULL || bufsize == 0)
+	return -1;
+
+    ra = new rpmreadahead_s {};
+    ra->lower = fps;
+    ra->maxchunks = bufsize / RA_CHUNKSIZE;
+    if (ra->maxchunks < 1)
+	ra->maxchunks = 1;
+
+    try {
+	ra->thread = std::thread(raProduce, ra);
+    } catch (const std::system_error & e) {
+	rpmlog(RPMLOG_DEBUG, "read-ahead disabled: %s\n", e.what());
+	delete ra;
+	return -1;
+    }
+
+    fdPush(fd, &readahead_s, ra, fps->fdno);
+    return 0;
+}
+
 /* =============================================================== */
 
 #define	FDIOVEC(_fps, _vec)	\
@@ -5,6 +5,9 @@
  * \file rpmio_internal.h
  */
 
+#include <utility>
+#include <vector>
+
 #include <rpm/rpmio.h>
 #include <rpm/rpmpgp.h>
 
@@ -37,6 +40,28 @@ DIGEST_CTX fdDupDigest(FD_t fd, int id);
 int rpmioSlurp(const char * fn,
                 uint8_t ** bp, ssize_t * blenp);
 
+/** \ingroup rpmio
+ * Read data ahead of the consumer on a separate thread.
+ * Pushes a layer on a descriptor opened for reading, which fills a
+ * bounded buffer from the underlying (eg decompressing) layers in the
+ * background. Only sequential reads are supported on the result.
+ * @param fd		file handle
+ * @param bufsize	max. amount of data to buffer (in bytes)
+ * @return		0 on success, -1 if read-ahead is not possible
+ */
+int fdReadAhead(FD_t fd, size_t bufsize);
+
+/** \ingroup rpmio
+ * Return the frames of a seekable (zstd) stream as per its seek table.
+ * @param fd		file handle
+ * @param start		offset of the stream start in the file
+ * @param end		offset of the stream end in the file
+ * @param[out] frames	compressed and uncompressed size of each frame
+ * @return		0 on success, -1 if not a seekable stream
+ */
+int fdSeekableFrames(FD_t fd, off_t start, off_t end,
+		     std::vector<std::pair<uint64_t,uint64_t>> & frames);
+
 /**
  * Set close-on-exec flag for all opened file descriptors, except
  * stdin/stdout/stderr.
@@ -3,11 +3,13 @@
 #include <shared_mutex>
 #include <mutex>
 #include <atomic>
+#include <unordered_map>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmstrpool.h>
+#include "rpmver_internal.hh"
 #include "debug.h"
 
 #define STRDATA_CHUNKS 1024
@@ -46,6 +48,9 @@ struct rpmstrPool_s {
     int frozen;			/* are new id additions allowed? */
     std::atomic_int nrefs;	/* refcount */
     std::shared_mutex mutex;
+
+    std::unordered_map<rpmsid,rpmver> *vers; /* parsed evr's by id */
+    std::shared_mutex vermutex;
 };
 
 static inline const char *id2str(rpmstrPool pool, rpmsid sid);
@@ -263,6 +268,11 @@ rpmstrPool rpmstrPoolFree(rpmstrPool pool)
     if (pool_debug)
 	poolHashPrintStats(pool);
     poolHashFree(pool->hash);
+    if (pool->vers) {
+	for (auto & v : *pool->vers)
+	    rpmverFree(v.second);
+	delete pool->vers;
+    }
     free(pool->offs);
     for (int i=1; i<=pool->chunks_size; i++) {
 	pool->chunks[i] = _free(pool->chunks[i]);
@@ -476,3 +486,33 @@ rpmsid rpmstrPoolNumStr(rpmstrPool pool)
     }
     return n;
 }
+
+rpmver rpmstrPoolVer(rpmstrPool pool, rpmsid sid)
+{
+    rpmver rv = NULL;
+
+    if (pool == NULL || sid == 0)
+	return NULL;
+
+    {
+	rdlock lock(pool->vermutex);
+	if (pool->vers) {
+	    auto it = pool->vers->find(sid);
+	    if (it != pool->vers->end())
+		return it->second;
+	}
+    }
+
+    /* Parse outside the lock, the first one to get back wins */
+    rv = rpmverParseSplit(rpmstrPoolStr(pool, sid));
+    if (rv) {
+	wrlock lock(pool->vermutex);
+	if (pool->vers == NULL)
+	    pool->vers = new std::unordered_map<rpmsid,rpmver>;
+	auto ret = pool->vers->insert({ sid, rv });
+	if (!ret.second)
+	    rpmverFree(rv);
+	rv = ret.first->second;
+    }
+    return rv;
+}
@@ -1,15 +1,43 @@
 #include "system.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <rpm/rpmver.h>
 #include <rpm/rpmstring.h>
 #include <stdlib.h>
 
+#include "rpmver_internal.hh"
 #include "debug.h"
 
+enum segType {
+    SEG_TILDE,
+    SEG_CARET,
+    SEG_ALPHA,
+    SEG_NUM,
+};
+
+/* Segment of a version string, as compared by rpmvercmp() */
+struct rpmverseg_s {
+    const char *s;	/* segment, numbers without leading zeros */
+    unsigned int len;	/* length of segment */
+    segType type;
+};
+
+/* Segments of epoch, version and release */
+enum { SPLIT_E, SPLIT_V, SPLIT_R, SPLIT_MAX };
+
+struct rpmversplit_s {
+    const struct rpmverseg_s *segs;
+    int nsegs;
+};
+
 struct rpmver_s {
     const char *e;
     const char *v;
     const char *r;
+    struct rpmversplit_s *split;	/* segments, if split */
     char arena[];
 };
 
@@ -56,6 +84,91 @@ void parseEVR(char * evr,
     if (rp) *rp = release;
 }
 
+/* Split a version string into the segments rpmvercmp() compares */
+static void splitSegs(const char *s, std::vector<rpmverseg_s> & segs)
+{
+    while (*s) {
+	const char *se = s + 1;
+	segType type;
+
+	if (*s == '~') {
+	    type = SEG_TILDE;
+	} else if (*s == '^') {
+	    type = SEG_CARET;
+	} else if (risdigit(*s)) {
+	    while (*se && risdigit(*se)) se++;
+	    /* throw away any leading zeros - it's a number, right? */
+	    while (*s == '0') s++;
+	    type = SEG_NUM;
+	} else if (risalpha(*s)) {
+	    while (*se && risalpha(*se)) se++;
+	    type = SEG_ALPHA;
+	} else {
+	    /* separators only delimit segments */
+	    s = se;
+	    continue;
+	}
+	segs.push_back({ s, (unsigned int)(se - s), type });
+	s = se;
+    }
+}
+
+/* rpmvercmp() on split segments, see there for the rules */
+static int segcmp(const struct rpmverseg_s *a, int na,
+		  const struct rpmverseg_s *b, int nb)
+{
+    for (int i = 0; ; i++) {
+	const struct rpmverseg_s *one = (i < na) ? &a[i] : NULL;
+	const struct rpmverseg_s *two = (i < nb) ? &b[i] : NULL;
+
+	/* handle the tilde separator, it sorts before everything else */
+	if ((one && one->type == SEG_TILDE) || (two && two->type == SEG_TILDE)) {
+	    if (!one || one->type != SEG_TILDE) return 1;
+	    if (!two || two->type != SEG_TILDE) return -1;
+	    continue;
+	}
+
+	/* caret is the same, except that it sorts after end of string */
+	if ((one && one->type == SEG_CARET) || (two && two->type == SEG_CARET)) {
+	    if (!one) return -1;
+	    if (!two) return 1;
+	    if (one->type != SEG_CARET) return 1;
+	    if (two->type != SEG_CARET) return -1;
+	    continue;
+	}
+
+	/* whichever version still has segments left over wins */
+	if (!one || !two)
+	    return (one ? 1 : 0) - (two ? 1 : 0);
+
+	/* numeric segments are always newer than alpha segments */
+	if (one->type != two->type)
+	    return (one->type == SEG_NUM) ? 1 : -1;
+
+	/* whichever number has more digits wins */
+	if (one->type == SEG_NUM && one->len != two->len)
+	    return (one->len > two->len) ? 1 : -1;
+
+	int rc = memcmp(one->s, two->s, (one->len < two->len) ?
+					 one->len : two->len);
+	if (rc)
+	    return (rc < 0) ? -1 : 1;
+	if (one->len != two->len)
+	    return (one->len > two->len) ? 1 : -1;
+    }
+}
+
+/* Compare epoch, version or release, on the segments when split */
+static int vercmp(rpmver v1, rpmver v2, int part,
+		  const char *str1, const char *str2)
+{
+    if (v1->split && v2->split) {
+	return segcmp(v1->split[part].segs, v1->split[part].nsegs,
+		      v2->split[part].segs, v2->split[part].nsegs);
+    }
+    return rpmvercmp(str1, str2);
+}
+
 int rpmverOverlap(rpmver v1, rpmsenseFlags f1, rpmver v2, rpmsenseFlags f2)
 {
     int sense = 0;
@@ -63,17 +176,17 @@ int rpmverOverlap(rpmver v1, rpmsenseFlags f1, rpmver v2, rpmsenseFlags f2)
 
     /* Compare {A,B} [epoch:]version[-release] */
     if (v1->e && *v1->e && v2->e && *v2->e)
-	sense = rpmvercmp(v1->e, v2->e);
+	sense = vercmp(v1, v2, SPLIT_E, v1->e, v2->e);
     else if (v1->e && *v1->e && atol(v1->e) > 0) {
 	sense = 1;
     } else if (v2->e && *v2->e && atol(v2->e) > 0)
 	sense = -1;
 
     if (sense == 0) {
-	sense = rpmvercmp(v1->v, v2->v);
+	sense = vercmp(v1, v2, SPLIT_V, v1->v, v2->v);
 	if (sense == 0) {
 	    if (v1->r && *v1->r && v2->r && *v2->r) {
-		sense = rpmvercmp(v1->r, v2->r);
+		sense = vercmp(v1, v2, SPLIT_R, v1->r, v2->r);
 	    } else {
 		/* always matches if the side with no release has SENSE_EQUAL */
 		if ((v1->r && *v1->r && (f2 & RPMSENSE_EQUAL)) ||
@@ -101,7 +214,8 @@ exit:
     return result;
 }
 
-static int compare_values(const char *str1, const char *str2)
+static int compare_values(rpmver v1, rpmver v2, int part,
+			  const char *str1, const char *str2)
 {
     if (!str1 && !str2)
 	return 0;
@@ -109,7 +223,7 @@ static int compare_values(const char *str1, const char *str2)
 	return 1;
     else if (!str1 && str2)
 	return -1;
-    return rpmvercmp(str1, str2);
+    return vercmp(v1, v2, part, str1, str2);
 }
 
 int rpmverCmp(rpmver v1, rpmver v2)
@@ -117,15 +231,99 @@ int rpmverCmp(rpmver v1, rpmver v2)
     const char *e1 = (v1->e != NULL) ? v1->e : "0";
     const char *e2 = (v2->e != NULL) ? v2->e : "0";
 
-    int rc = compare_values(e1, e2);
+    int rc = compare_values(v1, v2, SPLIT_E, e1, e2);
     if (!rc) {
-	rc = compare_values(v1->v, v2->v);
+	rc = compare_values(v1, v2, SPLIT_V, v1->v, v2->v);
 	if (!rc)
-	    rc = compare_values(v1->r, v2->r);
+	    rc = compare_values(v1, v2, SPLIT_R, v1->r, v2->r);
     }
     return rc;
 }
 
+/*
+ * Collation key bytes. Segment types are ordered like rpmvercmp()
+ * orders them, with end of string between tilde and caret.
+ */
+enum {
+    KEY_NONE	= 0x01,	/* end of alpha segment, missing release */
+    KEY_TILDE	= 0x02,
+    KEY_END	= 0x03,
+    KEY_CARET	= 0x04,
+    KEY_ALPHA	= 0x05,
+    KEY_NUM	= 0x06,
+};
+
+/* Append collation key of a version string, see rpmvercmpKey() */
+static void appendKey(std::string & key, const char *s)
+{
+    std::vector<rpmverseg_s> segs;
+
+    splitSegs(s, segs);
+    for (auto & seg : segs) {
+	switch (seg.type) {
+	case SEG_TILDE:
+	    key += KEY_TILDE;
+	    break;
+	case SEG_CARET:
+	    key += KEY_CARET;
+	    break;
+	case SEG_ALPHA:
+	    key += KEY_ALPHA;
+	    key.append(seg.s, seg.len);
+	    key += KEY_NONE;
+	    break;
+	case SEG_NUM:
+	    key += KEY_NUM;
+	    /*
+	     * Whichever number has more digits wins, so the length goes
+	     * first. Short lengths take a byte, longer ones the number of
+	     * 7-bit groups and the groups, all with the high bit set.
+	     */
+	    if (seg.len < 0x7f) {
+		key += (char)(seg.len + 1);
+	    } else {
+		int ngroups = 0;
+		for (unsigned int l = seg.len; l; l >>= 7)
+		    ngroups++;
+		key += (char)(0x80 | ngroups);
+		for (int i = ngroups - 1; i >= 0; i--)
+		    key += (char)(0x80 | ((seg.len >> (7 * i)) & 0x7f));
+	    }
+	    key.append(seg.s, seg.len);
+	    break;
+	}
+    }
+    key += KEY_END;
+}
+
+char *rpmvercmpKey(const char *s)
+{
+    std::string key;
+
+    if (s == NULL)
+	return NULL;
+
+    appendKey(key, s);
+    return xstrdup(key.c_str());
+}
+
+char *rpmverKey(rpmver rv)
+{
+    std::string key;
+
+    if (rv == NULL)
+	return NULL;
+
+    /* Like rpmverCmp(), missing epoch is zero and missing release lowest */
+    appendKey(key, rv->e ? rv->e : "0");
+    appendKey(key, rv->v);
+    if (rv->r)
+	appendKey(key, rv->r);
+    else
+	key += KEY_NONE;
+    return xstrdup(key.c_str());
+}
+
 uint32_t rpmverEVal(rpmver rv)
 {
     return (rv != NULL && rv->e != NULL) ? atol(rv->e) : 0;
@@ -165,6 +363,37 @@ rpmver rpmverParse(const char *evr)
 	rv = (rpmver)xmalloc(sizeof(*rv) + evrlen);
 	memcpy(rv->arena, evr, evrlen);
 	parseEVR(rv->arena, &rv->e, &rv->v, &rv->r);
+	rv->split = NULL;
+    }
+    return rv;
+}
+
+rpmver rpmverParseSplit(const char *evr)
+{
+    rpmver rv = rpmverParse(evr);
+    if (rv) {
+	std::vector<rpmverseg_s> segs;
+	size_t nsegs[SPLIT_MAX];
+	/* missing epoch compares as zero */
+	const char *parts[SPLIT_MAX] = { rv->e ? rv->e : "0", rv->v, rv->r };
+
+	for (int i = 0; i < SPLIT_MAX; i++) {
+	    size_t start = segs.size();
+	    if (parts[i])
+		splitSegs(parts[i], segs);
+	    nsegs[i] = segs.size() - start;
+	}
+
+	/* One allocation for all, the segments point into the arena */
+	rv->split = (struct rpmversplit_s *)xmalloc(
+			SPLIT_MAX * sizeof(*rv->split) +
+			segs.size() * sizeof(segs[0]));
+	struct rpmverseg_s *sp = (struct rpmverseg_s *)(rv->split + SPLIT_MAX);
+	std::copy(segs.begin(), segs.end(), sp);
+	for (int i = 0; i < SPLIT_MAX; i++) {
+	    rv->split[i] = { sp, (int)nsegs[i] };
+	    sp += nsegs[i];
+	}
     }
     return rv;
 }
@@ -182,6 +411,7 @@ rpmver rpmverNew(const char *e, const char *v, const char *r)
 	rv->e = NULL;
 	rv->v = NULL;
 	rv->r = NULL;
+	rv->split = NULL;
 
 	char *p = rv->arena;
 	if (e) {
@@ -206,6 +436,7 @@ rpmver rpmverNew(const char *e, const char *v, const char *r)
 rpmver rpmverFree(rpmver rv)
 {
     if (rv) {
+	free(rv->split);
 	free(rv);
     }
     return NULL;
@@ -0,0 +1,26 @@
+#ifndef H_RPMVER_INTERNAL
+#define H_RPMVER_INTERNAL 1
+
+#include <rpm/rpmver.h>
+#include <rpm/rpmstrpool.h>
+
+/** \ingroup rpmver
+ * Parse rpm version handle from evr string, with epoch, version and
+ * release also split into the segments rpmvercmp() compares. Such
+ * versions compare against each other without reparsing the strings.
+ * @param evr		[epoch:]version[-release] string
+ * @return		rpm version, NULL on invalid evr
+ */
+rpmver rpmverParseSplit(const char *evr);
+
+/** \ingroup rpmver
+ * Get the parsed and split version of an evr string in a pool. Each
+ * evr is parsed only once per pool, the version stays valid and owned
+ * by the pool until the pool is freed.
+ * @param pool		string pool
+ * @param sid		pool id of [epoch:]version[-release] string
+ * @return		rpm version (not to be freed), NULL on invalid evr
+ */
+rpmver rpmstrPoolVer(rpmstrPool pool, rpmsid sid);
+
+#endif
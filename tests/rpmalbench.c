@@ -0,0 +1,188 @@
+/*
+ * Add a synthetic transaction of configurable size to a transaction set
+ * and check its dependencies, reporting the time spent in both and the
+ * peak memory use before and after. This mostly exercises the provides
+ * and file indexes of the added packages.
+ *
+ * Package i has "-p" virtual provides and "-f" files, and requires "-r"
+ * provides or files of randomly picked packages before it. One extra
+ * package requires something nobody provides, so the check must come
+ * back with exactly one problem.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmlib.h>
+#include <rpm/rpmts.h>
+#include <rpm/rpmps.h>
+#include <rpm/rpmds.h>
+#include <rpm/rpmsw.h>
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t n)
+{
+    /* xorshift32, to be reproducible everywhere */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % n;
+}
+
+static void require(Header h, const char *name)
+{
+    uint32_t rflags = 0;
+
+    headerPutString(h, RPMTAG_REQUIRENAME, name);
+    headerPutUint32(h, RPMTAG_REQUIREFLAGS, &rflags, 1);
+    headerPutString(h, RPMTAG_REQUIREVERSION, "");
+}
+
+/* Peak resident set size so far, in kB */
+static long maxrss(void)
+{
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) ? -1 : ru.ru_maxrss;
+}
+
+static Header mkheader(int i, int nprovs, int nfiles, int nreqs, int broken)
+{
+    Header h = headerNew();
+    uint32_t pflags = RPMSENSE_EQUAL;
+    uint32_t fmode = 0100644;
+    uint32_t fsize = 0;
+    uint32_t dindex = 0;
+    char name[64];
+
+    snprintf(name, sizeof(name), "albench%d", i);
+    headerPutString(h, RPMTAG_NAME, name);
+    headerPutString(h, RPMTAG_VERSION, "1.0");
+    headerPutString(h, RPMTAG_RELEASE, "1");
+    headerPutString(h, RPMTAG_ARCH, "noarch");
+    headerPutString(h, RPMTAG_OS, "linux");
+    headerPutString(h, RPMTAG_SOURCERPM, "albench-1.0-1.src.rpm");
+
+    headerPutString(h, RPMTAG_PROVIDENAME, name);
+    headerPutUint32(h, RPMTAG_PROVIDEFLAGS, &pflags, 1);
+    headerPutString(h, RPMTAG_PROVIDEVERSION, "1.0-1");
+    for (int j = 0; j < nprovs; j++) {
+	uint32_t flags = 0;
+	snprintf(name, sizeof(name), "albench%d-cap%d", i, j);
+	headerPutString(h, RPMTAG_PROVIDENAME, name);
+	headerPutUint32(h, RPMTAG_PROVIDEFLAGS, &flags, 1);
+	headerPutString(h, RPMTAG_PROVIDEVERSION, "");
+    }
+
+    if (nfiles > 0) {
+	snprintf(name, sizeof(name), "/usr/share/albench/%d/", i);
+	headerPutString(h, RPMTAG_DIRNAMES, name);
+    }
+    for (int j = 0; j < nfiles; j++) {
+	snprintf(name, sizeof(name), "file%d", j);
+	headerPutString(h, RPMTAG_BASENAMES, name);
+	headerPutUint32(h, RPMTAG_DIRINDEXES, &dindex, 1);
+	headerPutUint32(h, RPMTAG_FILEMODES, &fmode, 1);
+	headerPutUint32(h, RPMTAG_FILESIZES, &fsize, 1);
+    }
+
+    for (int j = 0; i > 0 && j < nreqs; j++) {
+	int k = rnd(i);
+	if (nfiles > 0 && (nprovs == 0 || rnd(2))) {
+	    snprintf(name, sizeof(name), "/usr/share/albench/%d/file%d",
+		     k, (int)rnd(nfiles));
+	} else if (nprovs > 0) {
+	    snprintf(name, sizeof(name), "albench%d-cap%d", k, (int)rnd(nprovs));
+	} else {
+	    snprintf(name, sizeof(name), "albench%d", k);
+	}
+	require(h, name);
+    }
+
+    if (broken)
+	require(h, "albench-nosuch");
+
+    return headerReload(h, RPMTAG_HEADERIMMUTABLE);
+}
+
+int main(int argc, char *argv[])
+{
+    int npkgs = 10000, nprovs = 5, nfiles = 10, nreqs = 5;
+    struct rpmop_s addop = {};
+    long rss0, rss1;
+    int c, rc = 1;
+    rpmps ps = NULL;
+    rpmts ts = NULL;
+
+    while ((c = getopt(argc, argv, "n:p:f:r:s:")) != -1) {
+	switch (c) {
+	case 'n': npkgs = atoi(optarg); break;
+	case 'p': nprovs = atoi(optarg); break;
+	case 'f': nfiles = atoi(optarg); break;
+	case 'r': nreqs = atoi(optarg); break;
+	case 's': seed = strtoul(optarg, NULL, 10); break;
+	default:
+	    fprintf(stderr, "usage: %s [-n packages] [-p provides] "
+			    "[-f files] [-r requires] [-s seed]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if (npkgs < 1 || nprovs < 0 || nfiles < 0 || nreqs < 0 || seed == 0)
+	return 1;
+
+    if (rpmReadConfigFiles(NULL, NULL))
+	return 1;
+
+    ts = rpmtsCreate();
+    rss0 = maxrss();
+
+    /* Each add looks up the packages added so far */
+    for (int i = 0; i <= npkgs; i++) {
+	/* The one package with a dependency problem goes last */
+	Header h = mkheader(i, nprovs, nfiles, nreqs, i == npkgs);
+	rpmswEnter(&addop, 0);
+	int xx = rpmtsAddInstallElement(ts, h, NULL, 0, NULL);
+	rpmswExit(&addop, 0);
+	headerFree(h);
+	if (xx) {
+	    fprintf(stderr, "failed to add package %d\n", i);
+	    goto exit;
+	}
+    }
+
+    if (rpmtsCheck(ts))
+	goto exit;
+    rss1 = maxrss();
+
+    printf("%d packages, %d provides, %d files, %d requires: "
+	   "added in %.3f s, checked in %.3f s, "
+	   "peak rss %ld kB before, %ld kB after\n",
+	   npkgs, nprovs, nfiles, nreqs,
+	   addop.usecs / 1000000.0,
+	   rpmtsOp(ts, RPMTS_OP_CHECK)->usecs / 1000000.0,
+	   rss0, rss1);
+
+    ps = rpmtsProblems(ts);
+    if (rpmpsNumProblems(ps) != 1) {
+	rpmpsi psi = rpmpsInitIterator(ps);
+	rpmProblem p;
+	fprintf(stderr, "expected exactly one problem:\n");
+	while ((p = rpmpsiNext(psi)) != NULL) {
+	    char *msg = rpmProblemString(p);
+	    fprintf(stderr, "\t%s\n", msg);
+	    free(msg);
+	}
+	rpmpsFreeIterator(psi);
+	goto exit;
+    }
+    rc = 0;
+
+exit:
+    rpmpsFree(ps);
+    rpmtsFree(ts);
+    rpmFreeRpmrc();
+    return rc;
+}
@@ -0,0 +1,128 @@
+/*
+ * Check that version collation keys sort like rpmvercmp() and
+ * rpmverCmp() on random versions. Arguments are the number of
+ * iterations and the random seed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <rpm/rpmver.h>
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t n)
+{
+    /* xorshift32, to be reproducible everywhere */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % n;
+}
+
+/* Random string of pieces that matter to version comparison */
+static void rndver(char *buf, size_t size, const char *base)
+{
+    static const char *pieces[] = {
+	"0", "00", "1", "01", "9", "10", "99", "100",
+	"123456789012345678901234567890", "a", "b", "ab", "Z", "rc", "git",
+	".", "_", "+", "~", "^", "-", ":", "\xc3\xa4",
+    };
+    int npieces = sizeof(pieces) / sizeof(pieces[0]);
+    int n = rnd(8);
+
+    /* Often start from the other string to get long common prefixes */
+    if (base && rnd(2)) {
+	size_t len = strlen(base);
+	snprintf(buf, size, "%.*s", (int)rnd(len + 1), base);
+    } else {
+	*buf = '\0';
+    }
+    for (int i = 0; i < n; i++) {
+	size_t len = strlen(buf);
+	int p = rnd(npieces + 1);
+	if (p < npieces) {
+	    snprintf(buf + len, size - len, "%s", pieces[p]);
+	} else {
+	    /* numbers of more than 126 digits have longer keys */
+	    for (int l = 120 + rnd(20); l > 0 && len < size - 1; l--)
+		buf[len++] = '1' + rnd(2);
+	    buf[len] = '\0';
+	}
+    }
+}
+
+static int sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+    int rc = 0;
+
+    if (argc > 2)
+	seed = strtoul(argv[2], NULL, 10);
+    if (seed == 0)
+	return 1;
+
+    for (int i = 0; i < iterations && rc < 10; i++) {
+	char a[2048], b[2048], c[2048], d[2048];
+	rndver(a, sizeof(a), NULL);
+	rndver(b, sizeof(b), a);
+	rndver(c, sizeof(c), NULL);
+	rndver(d, sizeof(d), c);
+
+	/* Single strings against rpmvercmp() */
+	char *ka = rpmvercmpKey(a);
+	char *kb = rpmvercmpKey(b);
+	if (sign(strcmp(ka, kb)) != rpmvercmp(a, b)) {
+	    fprintf(stderr, "key order of \"%s\" and \"%s\" differs\n", a, b);
+	    rc++;
+	}
+
+	/* Concatenated keys compare like the strings one by one */
+	char *kc = rpmvercmpKey(c);
+	char *kd = rpmvercmpKey(d);
+	char *kac = malloc(strlen(ka) + strlen(kc) + 1);
+	char *kbd = malloc(strlen(kb) + strlen(kd) + 1);
+	int cmp = rpmvercmp(a, b);
+	if (cmp == 0)
+	    cmp = rpmvercmp(c, d);
+	strcat(strcpy(kac, ka), kc);
+	strcat(strcpy(kbd, kb), kd);
+	if (sign(strcmp(kac, kbd)) != cmp) {
+	    fprintf(stderr, "key order of \"%s\" \"%s\" and \"%s\" \"%s\" "
+			    "differs\n", a, c, b, d);
+	    rc++;
+	}
+
+	/* Whole versions against rpmverCmp() */
+	rpmver va = rpmverParse(a);
+	rpmver vb = rpmverParse(b);
+	if (va && vb) {
+	    char *kva = rpmverKey(va);
+	    char *kvb = rpmverKey(vb);
+	    if (sign(strcmp(kva, kvb)) != rpmverCmp(va, vb)) {
+		fprintf(stderr, "key order of versions \"%s\" and \"%s\" "
+				"differs\n", a, b);
+		rc++;
+	    }
+	    free(kva);
+	    free(kvb);
+	}
+
+	rpmverFree(va);
+	rpmverFree(vb);
+	free(ka);
+	free(kb);
+	free(kc);
+	free(kd);
+	free(kac);
+	free(kbd);
+    }
+
+    return (rc != 0);
+}
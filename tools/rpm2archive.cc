@@ -24,6 +24,7 @@
 
 int compress = 1;
 const char *format = "pax";
+const char *extract = NULL;
 
 static struct poptOption optionsTable[] = {
     { "nocompression", 'n', POPT_ARG_VAL, &compress, 0,
@@ -32,6 +33,9 @@ static struct poptOption optionsTable[] = {
     { "format", 'f', POPT_ARG_STRING, &format, 0,
 	N_("archive format (pax|cpio)"),
         NULL },
+    { "extract", 'x', POPT_ARG_STRING, &extract, 0,
+	N_("write content of a single file to standard out"),
+        N_("<path>") },
     POPT_AUTOHELP
     POPT_TABLEEND
 };
@@ -94,6 +98,63 @@ static int write_file_content(struct archive * a, char * buf, rpmfi fi)
     return (left > 0);
 }
 
+/* Copy content of a single file to stdout, using payload index if possible */
+static int extract_file(Header h, FD_t fdi, const char * path)
+{
+    rpmfiles files = rpmfilesNew(NULL, h, 0, RPMFI_KEEPHEADER);
+    int ix = rpmfilesFindFN(files, path);
+    rpmfi fi = NULL;
+    FD_t payload = NULL;
+    rpm_loff_t left;
+    char * buf = NULL;
+    int rc = 1;
+
+    if (ix < 0 || !S_ISREG(rpmfilesFMode(files, ix))) {
+	fprintf(stderr, "Error: %s: not a regular file in package\n", path);
+	goto exit;
+    }
+    left = rpmfilesFSize(files, ix);
+
+    /* Jump straight to the content if the package has a payload index */
+    payload = rpmfilesFOpenContent(files, ix, fdi, Ftell(fdi));
+    if (payload == NULL) {
+	const char *compr = headerGetString(h, RPMTAG_PAYLOADCOMPRESSOR);
+	char *rpmio_flags = rstrscat(NULL, "r.", compr ? compr : "gzip", NULL);
+	FD_t gzdi = Fdopen(fdi, rpmio_flags);	/* XXX gzdi == fdi */
+	free(rpmio_flags);
+
+	fi = rpmfiNewArchiveReader(gzdi, files,
+				   RPMFI_ITER_READ_ARCHIVE_CONTENT_FIRST);
+	while ((rc = rpmfiNext(fi)) >= 0 && rc != ix) {}
+	if (rc != ix) {
+	    fprintf(stderr, "Error reading file from rpm payload\n");
+	    rc = 1;
+	    goto exit;
+	}
+    }
+
+    buf = (char *)xmalloc(BUFSIZE);
+    while (left) {
+	size_t len = (left > BUFSIZE ? BUFSIZE : left);
+	ssize_t nb = payload ? Fread(buf, 1, len, payload) :
+			       rpmfiArchiveRead(fi, buf, len);
+	if (nb != (ssize_t)len || fwrite(buf, 1, len, stdout) != len)
+	    break;
+	left -= len;
+    }
+    if (left)
+	fprintf(stderr, "Error reading file from rpm payload\n");
+    rc = (left > 0) || fflush(stdout);
+
+exit:
+    if (payload)
+	Fclose(payload);
+    free(buf);
+    rpmfiFree(fi);
+    rpmfilesFree(files);
+    return rc;
+}
+
 /* This code sets the charset of the open archive. Messing with the
    locale is currently the only way to do it, see:
    https://github.com/libarchive/libarchive/pull/1966
@@ -159,6 +220,13 @@ static int process_package(rpmts ts, const char * filename)
     }
 
 
+    if (extract) {
+	rc = extract_file(h, fdi, extract);
+	Fclose(fdi);
+	headerFree(h);
+	return rc;
+    }
+
     /* Retrieve payload size and compression type. */
     {	const char *compr = headerGetString(h, RPMTAG_PAYLOADCOMPRESSOR);
 	rpmio_flags = rstrscat(NULL, "r.", compr ? compr : "gzip", NULL);
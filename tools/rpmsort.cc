@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include <rpm/rpmlib.h>
+#include <rpm/rpmstring.h>
 
 #include "debug.h"
 #include "system.h"
@@ -82,41 +83,47 @@ static void split_package_string(char *package_string, char **name,
     }
 }
 
+/* A package line with its name and the collation key of its version and
+ * release, so sorting doesn't need to parse the line on every compare. */
+struct package_s {
+    char *line;
+    char *name;
+    char *key;
+};
+
+static void package_init(struct package_s *pkg, char *line)
+{
+    char *name, *version, *release;
+    char *vkey, *rkey;
+
+    pkg->line = line;
+    pkg->name = rstrdup(line);
+    split_package_string(pkg->name, &name, &version, &release);
+
+    /* Version and release keys are self-terminating, they concatenate */
+    vkey = rpmvercmpKey(version == NULL ? "" : version);
+    rkey = rpmvercmpKey(release == NULL ? "" : release);
+    pkg->key = rstrscat(NULL, vkey, rkey, NULL);
+    rfree(vkey);
+    rfree(rkey);
+}
+
 /* A package name-version-release comparator for qsort.  It expects p, q which
- * are pointers to character strings and will not be altered in this
+ * are pointers to package_s structs and will not be altered in this
  * function. */
 static int package_version_compare(const void *p, const void *q)
 {
-    char *local_p, *local_q;
-    char *lhs_name, *lhs_version, *lhs_release;
-    char *rhs_name, *rhs_version, *rhs_release;
-    int vercmpflag = 0;
-
-    local_p = rstrdup(*(char * const *)p);
-    local_q = rstrdup(*(char * const *)q);
-
-    split_package_string(local_p, &lhs_name, &lhs_version, &lhs_release);
-    split_package_string(local_q, &rhs_name, &rhs_version, &rhs_release);
+    const struct package_s *lhs = (const struct package_s *)p;
+    const struct package_s *rhs = (const struct package_s *)q;
+    int vercmpflag;
 
     /* Check Name and return if unequal */
-    vercmpflag = strcmp((lhs_name == NULL ? "" : lhs_name),
-			(rhs_name == NULL ? "" : rhs_name));
+    vercmpflag = strcmp(lhs->name, rhs->name);
     if (vercmpflag != 0)
-	goto exit;
+	return vercmpflag;
 
-    /* Check version and return if unequal */
-    vercmpflag = rpmvercmp((lhs_version == NULL ? "" : lhs_version),
-			   (rhs_version == NULL ? "" : rhs_version));
-    if (vercmpflag != 0)
-	goto exit;
-
-    /* Check release and return the version compare value */
-    vercmpflag = rpmvercmp((lhs_release == NULL ? "" : lhs_release),
-			   (rhs_release == NULL ? "" : rhs_release));
-exit:
-    rfree(local_p);
-    rfree(local_q);
-    return vercmpflag;
+    /* Check version, and then release, in collation order of rpmvercmp */
+    return strcmp(lhs->key, rhs->key);
 }
 
 static void add_input(const char *filename, char ***package_names,
@@ -176,6 +183,7 @@ int main(int argc, const char *argv[])
     poptContext optCon;
     const char *arg;
     char **package_names = NULL;
+    struct package_s *packages = NULL;
     size_t n_package_names = 0;
     char seen_file = 0;
 
@@ -200,15 +208,22 @@ int main(int argc, const char *argv[])
 	exit(EXIT_FAILURE);
     }
 
-    qsort(package_names, n_package_names, sizeof(char *),
+    packages = (struct package_s *)xmalloc(sizeof(*packages) * n_package_names);
+    for (size_t i = 0; i < n_package_names; i++)
+	package_init(&packages[i], package_names[i]);
+
+    qsort(packages, n_package_names, sizeof(*packages),
 	  package_version_compare);
 
     /* Send sorted list to stdout. */
-    for (int i = 0; i < n_package_names; i++) {
-	fprintf(stdout, "%s\n", package_names[i]);
-	free(package_names[i]);
+    for (size_t i = 0; i < n_package_names; i++) {
+	fprintf(stdout, "%s\n", packages[i].line);
+	free(packages[i].line);
+	free(packages[i].name);
+	free(packages[i].key);
     }
 
+    free(packages);
     free(package_names);
     poptFreeContext(optCon);
     return 0;